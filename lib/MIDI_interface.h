@@ -109,6 +109,7 @@ typedef struct
 
 #define MIDI_COMMAND_MAX_COUNT 50
 #define MIDI_CLOCK_COMMAND_SENT (1<<0)
+#define MIDI_CLOCK_SYNCHRONOUS (1<<1) // clocks step the sequencer on the calling thread, used for offline rendering
 #define MIDI_INTERFACE_DESTORY (1<<7)
 typedef struct MIDI_Controller
 {
@@ -265,6 +266,24 @@ MIDI_INLINE void midi_increment_step_count_simd(MIDI_Controller* controller)
 }
 
 
+// one clock tick, launches the due commands and pushes out the processed ones. Called with the mutex held
+MIDI_INLINE void midi_clock_step(MIDI_Controller* controller)
+{
+    midi_increment_step_count_simd(controller);
+
+    //push processed commands
+    if (controller->commands_processed > 0)
+    {
+        uint8_t difference = controller->command_count - controller->commands_processed;
+        //printf("%u differ\n", difference);
+        memmove(&controller->commands[0], &controller->commands[controller->commands_processed], difference * sizeof(MIDI_Command));
+        memset(&controller->commands[difference], 0, controller->commands_processed);
+
+        controller->commands_processed = 0;
+        controller->command_count = difference;
+    }
+}
+
 MIDI_INLINE void* midi_thread_loop(void* arg)
 {
     MIDI_Controller* controller = (MIDI_Controller*)arg;
@@ -283,21 +302,7 @@ MIDI_INLINE void* midi_thread_loop(void* arg)
             break;
         }
 
-        midi_increment_step_count_simd(controller);
-
-
-        //push processed commands
-        if (controller->commands_processed > 0)
-        {
-            uint8_t difference = controller->command_count - controller->commands_processed;
-            //printf("%u differ\n", difference);
-            memmove(&controller->commands[0], &controller->commands[controller->commands_processed], difference * sizeof(MIDI_Command));
-            memset(&controller->commands[difference], 0, controller->commands_processed);
-
-            controller->commands_processed = 0;
-            controller->command_count = difference;
-        }
-
+        midi_clock_step(controller);
 
         pthread_mutex_unlock(&controller->mutex);
     }
@@ -599,12 +604,10 @@ MIDI_INLINE int midi_parse_commands(MIDI_Controller* controller, const char* fil
 
 MIDI_INLINE void midi_controller_set(MIDI_Controller* controller, const char* filepath)
 {
-    for (uint8_t i = 0; i < MIDI_COMMAND_MAX_COUNT; ++i)
-        memset(&controller->commands[i], 0, sizeof(MIDI_Command));
-
-    controller->command_count = 0;
-    controller->commands_processed = 0;
-    controller->flags = 0;
+    // the controller usually lives on the stack, nothing of it can be left to chance
+    memset(controller, 0, sizeof(MIDI_Controller));
+    pthread_mutex_init(&controller->mutex, NULL);
+    pthread_cond_init(&controller->cond, NULL);
     pthread_t midi_interface_thread;
     pthread_create(&midi_interface_thread, NULL, midi_thread_loop, controller);
     pthread_detach(midi_interface_thread);
@@ -631,8 +634,13 @@ MIDI_INLINE void midi_command_clock(MIDI_Controller* controller)
     assert(controller->command_count < MIDI_COMMAND_MAX_COUNT);
     pthread_mutex_lock(&controller->mutex);
     controller->commands[controller->command_count++].command_byte = MIDI_SYSTEM_MESSAGE | MIDI_CLOCK;
-    controller->flags |= MIDI_CLOCK_COMMAND_SENT;
-    pthread_cond_signal(&controller->cond);
+    if (controller->flags & MIDI_CLOCK_SYNCHRONOUS)
+        midi_clock_step(controller);
+    else
+    {
+        controller->flags |= MIDI_CLOCK_COMMAND_SENT;
+        pthread_cond_signal(&controller->cond);
+    }
     pthread_mutex_unlock(&controller->mutex);
 }
 
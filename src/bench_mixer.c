@@ -0,0 +1,303 @@
+#include "planetary_loop_machine/planetary_loop_machine.h"
+#include <time.h>
+#include <x86intrin.h>
+
+/* Mixer throughput benchmark. Builds a session of synthetic samples, fills it with voices and synths and
+times data_callback_f32 in a tight loop, the synths are refilled between periods outside the timing as
+the main loop would. Loops take the first MAX_CHANNELS voices, the rest are one shots long enough to
+outlast the run */
+
+#define BENCH_SAMPLE_RATE     44100
+#define BENCH_CHANNEL_COUNT   2
+#define BENCH_SAMPLE_FILES    8     // voices are spread over this many samples so they don't all read the same memory
+#define BENCH_VOICES_MAX      256
+#define BENCH_SYNTHS_MAX      32
+#define BENCH_CONFIGS_MAX     16
+#define BENCH_WARMUP_PERIODS  16
+
+typedef struct
+{
+    uint16_t voices;
+    uint16_t voicesPlaying;
+    uint8_t synths;
+    uint32_t periodFrames;
+    uint64_t frames;
+    double seconds;
+    uint64_t cycles;
+    double nsPerFrame;
+    double cyclesPerVoiceSample;
+    double voicesPerCore[3];
+} BenchResult;
+
+static const uint32_t benchRates[3] = { 44100, 48000, 96000 };
+
+static double bench_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Each sample is a detuned pair of sines, different per file, long enough that no one shot ends mid run.
+// With mono both sides are the first sine so the samples are kept as mono
+static bool bench_session_write(const char* directory, double seconds, bool mono)
+{
+    uint64_t frames = (uint64_t)((seconds + 1.0) * BENCH_SAMPLE_RATE);
+    float* buffer = malloc(frames * BENCH_CHANNEL_COUNT * sizeof(float));
+    if (buffer == NULL)
+        return false;
+
+    bool written = true;
+    for (uint32_t f = 0; f < BENCH_SAMPLE_FILES && written; ++f)
+    {
+        double frequency = 110.0 * (f + 1);
+        for (uint64_t i = 0; i < frames; ++i)
+        {
+            double t = (double)i / BENCH_SAMPLE_RATE;
+            buffer[i * 2] = (float)(0.1 * sin(2.0 * M_PI * frequency * t));
+            buffer[i * 2 + 1] = mono ? buffer[i * 2] : (float)(0.1 * sin(2.0 * M_PI * frequency * 1.003 * t));
+        }
+
+        char path[512];
+        snprintf(path, sizeof(path), "%s/bench_%u.wav", directory, f);
+        ma_encoder encoder;
+        ma_encoder_config config = ma_encoder_config_init(ma_encoding_format_wav, ma_format_f32, BENCH_CHANNEL_COUNT, BENCH_SAMPLE_RATE);
+        if (ma_encoder_init_file(path, &config, &encoder) != MA_SUCCESS)
+        {
+            written = false;
+            break;
+        }
+        ma_uint64 framesWritten = 0;
+        written = ma_encoder_write_pcm_frames(&encoder, buffer, frames, &framesWritten) == MA_SUCCESS && framesWritten == frames;
+        ma_encoder_uninit(&encoder);
+    }
+    free(buffer);
+    return written;
+}
+
+static void bench_session_remove(const char* directory)
+{
+    char path[512];
+    for (uint32_t f = 0; f < BENCH_SAMPLE_FILES; ++f)
+    {
+        snprintf(path, sizeof(path), "%s/bench_%u.wav", directory, f);
+        remove(path);
+    }
+    snprintf(path, sizeof(path), "%s/" STRETCH_CACHE_DIRECTORY, directory); // made by every load, empty as nothing here is stretched
+    rmdir(path);
+    // every bench sample is decoded into the sample cache
+    snprintf(path, sizeof(path), "%s/" SAMPLE_CACHE_DIRECTORY, directory);
+    DIR* cache = opendir(path);
+    if (cache != NULL)
+    {
+        struct dirent* entry;
+        char file[1024];
+        while ((entry = readdir(cache)) != NULL)
+        {
+            if (entry->d_name[0] == '.')
+                continue;
+            snprintf(file, sizeof(file), "%s%s", path, entry->d_name);
+            remove(file);
+        }
+        closedir(cache);
+    }
+    rmdir(path);
+    rmdir(directory);
+}
+
+static void bench_run(const char* directory, uint16_t voices, uint8_t synths, uint32_t periodFrames, uint8_t workers, Sample_Format storage, double seconds, BenchResult* result)
+{
+    SoundController* s = sound_controller_init(120, directory, 4, 2, BENCH_SAMPLE_RATE, BENCH_CHANNEL_COUNT, ma_format_f32, synths + 1, voices, NULL, false, storage);
+    for (uint8_t i = 0; i < synths; ++i)
+    {
+        char name[12];
+        snprintf(name, sizeof(name), "bench%u", i);
+        synth_init(s, name, SYNTH_TYPE_BASIC_SINEWAVE, BENCH_SAMPLE_RATE, 220.0f * (i + 1), 0.5f, 1.0f, SYNTH_ACTIVE);
+    }
+    voice_workers_start(s, workers);
+
+    ma_device device;
+    memset(&device, 0, sizeof(device));
+    device.pUserData = s;
+    float* period = malloc(periodFrames * BENCH_CHANNEL_COUNT * sizeof(float));
+    assert(period != NULL && "ERROR: bench period allocation failed");
+
+    // a snapshot only carries MIX_SNAPSHOT_MAX_COMMANDS commands, so voices go in a batch a period
+    for (uint16_t v = 0; v < voices; )
+    {
+        for (uint32_t c = 0; c < MIX_SNAPSHOT_MAX_COMMANDS && v < voices; ++c, ++v)
+        {
+            VoiceCommand command = { .type = VOICE_COMMAND_LAUNCH, .sampleIndex = v % s->sampleCount, .channel = v,
+                                     .volume = VOICE_VOLUME_UNCHANGED, .quantize = { QUANTIZE_IMMEDIATE, 0 } };
+            if (v >= MAX_CHANNELS)
+                command.type = VOICE_COMMAND_ONE_SHOT;
+            voice_command_push(s, command);
+        }
+        mix_publish(s);
+        memset(period, 0, periodFrames * BENCH_CHANNEL_COUNT * sizeof(float));
+        data_callback_f32(&device, period, NULL, periodFrames);
+        controller_synth_generate_audio(s);
+    }
+    for (uint32_t i = 0; i < BENCH_WARMUP_PERIODS; ++i)
+    {
+        memset(period, 0, periodFrames * BENCH_CHANNEL_COUNT * sizeof(float));
+        data_callback_f32(&device, period, NULL, periodFrames);
+        controller_synth_generate_audio(s);
+    }
+    result->voicesPlaying = s->voices.liveCount;
+
+    uint64_t periods = (uint64_t)(seconds * BENCH_SAMPLE_RATE) / periodFrames;
+    if (periods == 0)
+        periods = 1;
+    double elapsed = 0.0;
+    uint64_t cycles = 0;
+    for (uint64_t p = 0; p < periods; ++p)
+    {
+        memset(period, 0, periodFrames * BENCH_CHANNEL_COUNT * sizeof(float));
+        double start = bench_now();
+        uint64_t startCycles = __rdtsc();
+        data_callback_f32(&device, period, NULL, periodFrames);
+        cycles += __rdtsc() - startCycles;
+        elapsed += bench_now() - start;
+        controller_synth_generate_audio(s);
+    }
+    free(period);
+    sound_controller_destroy(s);
+
+    result->voices = voices;
+    result->synths = synths;
+    result->periodFrames = periodFrames;
+    result->frames = periods * periodFrames;
+    result->seconds = elapsed;
+    result->cycles = cycles;
+    result->nsPerFrame = elapsed * 1e9 / result->frames;
+    result->cyclesPerVoiceSample = voices > 0 ? (double)cycles / ((double)result->frames * BENCH_CHANNEL_COUNT * voices) : 0.0;
+    // how many of these voices one core could keep up with, fixed costs counted against the voices
+    for (uint32_t r = 0; r < 3; ++r)
+        result->voicesPerCore[r] = voices * 1e9 / (result->nsPerFrame * benchRates[r]);
+}
+
+static const char* benchStorageNames[] = { "f32", "s16", "f16" };
+
+static bool bench_json_write(const char* path, const BenchResult* results, uint32_t count, uint8_t workers, Sample_Format storage, bool mono)
+{
+    FILE* file = fopen(path, "w");
+    if (file == NULL)
+    {
+        printf(MAGENTA "\t\tWARNING: Couldn't open %s for the results (%s)\n" RESET, path, strerror(errno));
+        return false;
+    }
+    fprintf(file, "{\n  \"benchmark\": \"mixer\",\n  \"sample_rate\": %u,\n  \"channels\": %u,\n  \"workers\": %u,\n  \"storage\": \"%s\",\n  \"mono\": %s,\n  \"results\": [\n",
+            BENCH_SAMPLE_RATE, BENCH_CHANNEL_COUNT, workers, benchStorageNames[storage], mono ? "true" : "false");
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        const BenchResult* r = &results[i];
+        fprintf(file, "    { \"voices\": %u, \"voices_playing\": %u, \"synths\": %u, \"period_frames\": %u, \"frames\": %llu, "
+                "\"ns_per_frame\": %.3f, \"cycles_per_voice_sample\": %.3f, "
+                "\"voices_per_core\": { \"44100\": %.1f, \"48000\": %.1f, \"96000\": %.1f } }%s\n",
+                r->voices, r->voicesPlaying, r->synths, r->periodFrames, (unsigned long long)r->frames,
+                r->nsPerFrame, r->cyclesPerVoiceSample,
+                r->voicesPerCore[0], r->voicesPerCore[1], r->voicesPerCore[2], i + 1 < count ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+    printf(BOLD_GREEN "\tResults written to %s\n" RESET, path);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    // bench_mixer [--voices <n>[,<n>...]] [--synths <m>] [--period <frames>] [--seconds <s>] [--workers <count>] [--storage <f32|s16|f16>] [--mono] [--json <path>]
+    uint16_t voiceCounts[BENCH_CONFIGS_MAX] = { 1, 8, 32, 64, 128, 256 };
+    uint32_t configCount = 6;
+    uint8_t synths = 0;
+    uint32_t periodFrames = 512;
+    double seconds = 2.0;
+    uint8_t workers = 0;
+    Sample_Format storage = SAMPLE_FORMAT_F32;
+    bool mono = false;
+    const char* jsonPath = NULL;
+    for (int a = 1; a < argc; ++a)
+    {
+        if (strcmp(argv[a], "--voices") == 0 && a + 1 < argc)
+        {
+            configCount = 0;
+            for (char* token = strtok(argv[++a], ","); token != NULL && configCount < BENCH_CONFIGS_MAX; token = strtok(NULL, ","))
+                voiceCounts[configCount++] = atoi(token);
+        }
+        else if (strcmp(argv[a], "--synths") == 0 && a + 1 < argc)
+            synths = atoi(argv[++a]);
+        else if (strcmp(argv[a], "--period") == 0 && a + 1 < argc)
+            periodFrames = atoi(argv[++a]);
+        else if (strcmp(argv[a], "--seconds") == 0 && a + 1 < argc)
+            seconds = atof(argv[++a]);
+        else if (strcmp(argv[a], "--workers") == 0 && a + 1 < argc)
+            workers = atoi(argv[++a]);
+        else if (strcmp(argv[a], "--storage") == 0 && a + 1 < argc)
+        {
+            const char* name = argv[++a];
+            uint32_t format = 0;
+            while (format < 3 && strcmp(name, benchStorageNames[format]) != 0)
+                ++format;
+            if (format == 3)
+            {
+                printf("Unknown storage %s, one of f32, s16 or f16\n", name);
+                return -5;
+            }
+            storage = (Sample_Format)format;
+        }
+        else if (strcmp(argv[a], "--mono") == 0)
+            mono = true;
+        else if (strcmp(argv[a], "--json") == 0 && a + 1 < argc)
+            jsonPath = argv[++a];
+        else
+        {
+            printf("Unknown option %s. Options: --voices <n>[,<n>...], --synths <m>, --period <frames>, --seconds <s>, --workers <count>, --storage <f32|s16|f16>, --mono, --json <path>\n", argv[a]);
+            return -5;
+        }
+    }
+    for (uint32_t i = 0; i < configCount; ++i)
+    {
+        if (voiceCounts[i] < 1 || voiceCounts[i] > BENCH_VOICES_MAX)
+        {
+            printf("Voices must be 1 - %u\n", BENCH_VOICES_MAX);
+            return -5;
+        }
+    }
+    if (synths > BENCH_SYNTHS_MAX || periodFrames == 0 || periodFrames > BENCH_SAMPLE_RATE || seconds <= 0.0)
+    {
+        printf("Synths must be 0 - %u, the period 1 - %u frames and the run longer than 0 seconds\n", BENCH_SYNTHS_MAX, BENCH_SAMPLE_RATE);
+        return -5;
+    }
+
+    char directory[] = "/tmp/bench_mixer_XXXXXX";
+    if (mkdtemp(directory) == NULL || !bench_session_write(directory, seconds, mono))
+    {
+        printf("Couldn't write the benchmark samples to /tmp\n");
+        return -1;
+    }
+
+    char session[sizeof(directory) + 1];
+    snprintf(session, sizeof(session), "%s/", directory); // sessions are loaded from a path ending in a slash
+    BenchResult results[BENCH_CONFIGS_MAX];
+    for (uint32_t i = 0; i < configCount; ++i)
+        bench_run(session, voiceCounts[i], synths, periodFrames, workers, storage, seconds, &results[i]);
+    bench_session_remove(directory);
+
+    printf(BOLD_CYAN "\nMixer benchmark: %u synths, %u frame periods, %u workers, %u Hz session, %s%s samples\n" RESET, synths, periodFrames, workers,
+           BENCH_SAMPLE_RATE, benchStorageNames[storage], mono ? " mono" : "");
+    printf("%8s %8s %12s %14s %12s %12s %12s\n", "voices", "playing", "ns/frame", "cycles/v-smpl", "per core 44k", "per core 48k", "per core 96k");
+    for (uint32_t i = 0; i < configCount; ++i)
+    {
+        const BenchResult* r = &results[i];
+        printf("%8u %8u %12.1f %14.2f %12.0f %12.0f %12.0f\n", r->voices, r->voicesPlaying, r->nsPerFrame, r->cyclesPerVoiceSample,
+               r->voicesPerCore[0], r->voicesPerCore[1], r->voicesPerCore[2]);
+    }
+    for (uint32_t i = 0; i < configCount; ++i)
+        if (results[i].voicesPlaying != results[i].voices)
+            printf(MAGENTA "\t\tWARNING: only %u of %u voices were playing\n" RESET, results[i].voicesPlaying, results[i].voices);
+
+    if (jsonPath != NULL && !bench_json_write(jsonPath, results, configCount, workers, storage, mono))
+        return -1;
+    return 0;
+}
@@ -3,34 +3,112 @@
 #define SAMPLE_RATE     44100
 #define CHANNEL_COUNT   2
 #define SAMPLE_FORMAT   ma_format_f32
+#define REALTIME_PRIORITY_DEFAULT 70
+#define VOICE_MAX       32
 
 
 void sanity_checks(SoundController* sc, InputController* ic)
 {
-    // check active count matches actual active samples
-    uint8_t activeSampleCount = 0;
-    for (uint32_t i = 0; i < MAX_ACTIVE_SAMPLES; ++i)
-        if (sc->activeSamples[i] != NULL)
-            ++activeSampleCount;
-    if (activeSampleCount != sc->activeCount)
-        assert(false && "ERROR: active samples count mismatch");
-
-    // check active index points to valid samples
-    for (uint32_t i = 0; i < sc->activeCount; ++i)
-        if (sc->activeSamples[sc->activeIndex[i]] == NULL)
-            assert(false && "ERROR: active sample index points to NULL sample");
-
-    // Checking rest of active index pointing to nothing
-    for (uint32_t i = sc->activeCount; i < MAX_ACTIVE_SAMPLES; i++)
-        assert(sc->activeIndex[i] == NO_ACTIVE_SAMPLE && "ERROR: non-active sampleIndex doesn't point to NO_ACTIVE_SAMPLE");
-
+    // the voice pool belongs to the audio thread, which checks it each period and flags what it finds broken
+    uint32_t poolFaults = atomic_load_explicit(&sc->poolFaults, memory_order_relaxed);
+    assert(!(poolFaults & VOICE_POOL_LIVE_INDEX) && "ERROR: live voice doesn't point back to its place in the live array");
+    assert(!(poolFaults & VOICE_POOL_NO_SAMPLE) && "ERROR: live voice without a sample");
+    assert(!(poolFaults & VOICE_POOL_CHANNEL) && "ERROR: channel doesn't point to its voice");
+    assert(!(poolFaults & VOICE_POOL_LOST) && "ERROR: voices lost from the pool");
+    (void)poolFaults;
 }
 
 
 int main(int argc, char** argv)
 {
+    // opt in to real-time mode with: --realtime [priority] [cpu]
+    // and to rendering voices over a worker pool with: --workers <count>
+    // rendering headless to a WAV, without a sound card or keyboard: --render <script> <output.wav> [seconds]
+    // and to loading each sample the first time it's asked for, starting with a list of them: --lazy [preload list]
+    // keeping the samples in half the memory as 16 bit ints or half floats: --storage <f32|s16|f16>
+    RealtimeConfig realtime = { .enabled = false, .priority = REALTIME_PRIORITY_DEFAULT, .cpu = -1 };
+    uint8_t workerCount = 0;
+    const char* renderScript = NULL;
+    const char* renderOutput = NULL;
+    double renderSeconds = 0.0;
+    bool lazyLoad = false;
+    const char* preloadList = NULL;
+    Sample_Format storage = SAMPLE_FORMAT_F32;
+    for (int a = 1; a < argc; ++a)
+    {
+        if (strcmp(argv[a], "--realtime") == 0)
+        {
+            realtime.enabled = true;
+            if (a + 1 < argc && isdigit(argv[a + 1][0]))
+                realtime.priority = atoi(argv[++a]);
+            if (a + 1 < argc && isdigit(argv[a + 1][0]))
+                realtime.cpu = atoi(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--workers") == 0 && a + 1 < argc)
+            workerCount = atoi(argv[++a]);
+        else if (strcmp(argv[a], "--render") == 0 && a + 2 < argc)
+        {
+            renderScript = argv[++a];
+            renderOutput = argv[++a];
+            if (a + 1 < argc && (isdigit(argv[a + 1][0]) || argv[a + 1][0] == '.'))
+                renderSeconds = atof(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--lazy") == 0)
+        {
+            lazyLoad = true;
+            if (a + 1 < argc && strncmp(argv[a + 1], "--", 2) != 0)
+                preloadList = argv[++a];
+        }
+        else if (strcmp(argv[a], "--storage") == 0 && a + 1 < argc)
+        {
+            const char* name = argv[++a];
+            if (strcmp(name, "s16") == 0)
+                storage = SAMPLE_FORMAT_S16;
+            else if (strcmp(name, "f16") == 0)
+                storage = SAMPLE_FORMAT_F16;
+            else if (strcmp(name, "f32") != 0)
+            {
+                printf("Unknown storage %s, one of f32, s16 or f16\n", name);
+                return -5;
+            }
+        }
+        else
+        {
+            printf("Unknown option %s. Options: --realtime [priority] [cpu], --workers <count>, --render <script> <output.wav> [seconds], --lazy [preload list], --storage <f32|s16|f16>\n", argv[a]);
+            return -5;
+        }
+    }
+    if (realtime.enabled && renderScript != NULL)
+    {
+        printf("--realtime has no effect on a render, the render runs as fast as it can\n");
+        return -5;
+    }
+    if (realtime.enabled)
+    {
+        int maxPriority = sched_get_priority_max(SCHED_FIFO);
+        int minPriority = sched_get_priority_min(SCHED_FIFO);
+        if (realtime.priority < minPriority || realtime.priority > maxPriority)
+        {
+            printf("Real-time priority must be %d - %d\n", minPriority, maxPriority);
+            return -5;
+        }
+    }
+
     MIDI_Controller midiController;
     midi_controller_set(&midiController, "src/audio_data/midi_commands_test.midi");
+
+    if (renderScript != NULL)
+    {
+        SoundController* s = sound_controller_init(122, "src/audio_data/song_1/", 4, 2, SAMPLE_RATE, CHANNEL_COUNT, SAMPLE_FORMAT, 3, VOICE_MAX, &midiController, lazyLoad, storage);
+        if (preloadList != NULL)
+            sample_preload_list(s, preloadList);
+        synth_init(s, "synth1", SYNTH_TYPE_BASIC_SINEWAVE, SAMPLE_RATE, 440, 0.5f, 1.0f, SYNTH_ACTIVE);
+        voice_workers_start(s, workerCount);
+        bool rendered = offline_render(s, renderScript, renderOutput, renderSeconds);
+        sound_controller_destroy(s);
+        return rendered ? 0 : -6;
+    }
+
     // fining the context of the connected audio-interfaces
     ma_context context;
     if (ma_context_init(NULL, 0, NULL, &context) != MA_SUCCESS)
@@ -61,7 +139,9 @@ int main(int argc, char** argv)
     InputController ic = {0};
     int i = input_controller_init(&ic, 16);
     printf("%d\n", i);
-    SoundController* s = sound_controller_init(122, "src/audio_data/song_1/", 4, 2, SAMPLE_RATE, CHANNEL_COUNT, SAMPLE_FORMAT, 3, &midiController);
+    SoundController* s = sound_controller_init(122, "src/audio_data/song_1/", 4, 2, SAMPLE_RATE, CHANNEL_COUNT, SAMPLE_FORMAT, 3, VOICE_MAX, &midiController, lazyLoad, storage);
+    if (preloadList != NULL)
+        sample_preload_list(s, preloadList);
     Synth* synth1 = synth_init(s, "synth1", SYNTH_TYPE_BASIC_SINEWAVE, SAMPLE_RATE, 440, 0.5f, 1.0f, SYNTH_ACTIVE);
     //Synth* synth2 = synth_init(s, "synth2", SYNTH_TYPE_BASIC_SINEWAVE, SAMPLE_RATE, 2990, SYNTH_ACTIVE);
     //LFO_attach(s, synth2, LFO_TYPE_PHASE_MODULATION, 0.02, bpm_to_hz((float)122/2), LFO_MODULE_ACTIVE);
@@ -71,8 +151,11 @@ int main(int argc, char** argv)
     //LFO_attach(s, synth2, LFO_TYPE_PHASE_MODULATION, 0.02, bpm_to_hz((float)122/8), LFO_MODULE_ACTIVE);
     //LFO_attach(s, synth1, LFO_TYPE_PHASE_MODULATION, 0.02, bpm_to_hz((float)122/2), LFO_MODULE_ACTIVE);
     synth_print_out(s);
+    callback_xrun_log_attach(s, ma_context_get_log(&context));
+    if (realtime.enabled)
+        realtime_setup(s, realtime);
+    voice_workers_start(s, workerCount);
 
-    s->activeCount = 0;
 
     /*
     FILE* file = fopen("sample_val.cvs", "a");
@@ -115,25 +198,18 @@ int main(int argc, char** argv)
         return -4;
     }
 
-    s->activeIndex[s->activeCount++] = 1;
-    s->activeSamples[1] = s->samples[1];
-    s->newQueued = true;
+    voice_command_push(s, (VoiceCommand){ .type = VOICE_COMMAND_LAUNCH, .sampleIndex = 1, .channel = 1, .volume = VOICE_VOLUME_UNCHANGED, .quantize = { QUANTIZE_BARS, 1 } });
     printf("Sample index 1 has been queued up to channel 1\n");
 
-    s->activeIndex[s->activeCount++] = 2;
-    s->activeSamples[2] = s->samples[2];
-    s->newQueued = true;
+    voice_command_push(s, (VoiceCommand){ .type = VOICE_COMMAND_LAUNCH, .sampleIndex = 2, .channel = 2, .volume = VOICE_VOLUME_UNCHANGED, .quantize = { QUANTIZE_BARS, 1 } });
     printf("Sample index 2 has been queued up to channel 2\n");
 
-    s->activeIndex[s->activeCount++] = 3;
-    s->activeSamples[3] = s->samples[3];
-    s->newQueued = true;
+    voice_command_push(s, (VoiceCommand){ .type = VOICE_COMMAND_LAUNCH, .sampleIndex = 3, .channel = 3, .volume = VOICE_VOLUME_UNCHANGED, .quantize = { QUANTIZE_BARS, 1 } });
     printf("Sample index 3 has been queued up to channel 3\n");
 
-    s->activeIndex[s->activeCount++] = 0;
-    s->activeSamples[0] = s->samples[0];
-    s->newQueued = true;
+    voice_command_push(s, (VoiceCommand){ .type = VOICE_COMMAND_LAUNCH, .sampleIndex = 0, .channel = 0, .volume = VOICE_VOLUME_UNCHANGED, .quantize = { QUANTIZE_BARS, 1 } });
     printf("Sample index 0 has been queued up to channel 0\n");
+    mix_publish(s);
 
     bool running = true;
     while (running)
@@ -145,8 +221,13 @@ int main(int argc, char** argv)
         if (input_process(&ic, s) == END_MISSION)
             running = false;
 
-        slider_update(&ic, s);
-        one_shot_check(s);
+        transport_display(s);
+        realtime_report(s);
+        callback_timing_report(s);
+        stream_report(s);
+        voice_workers_report(s);
+        event_scheduler_report(s);
+        sample_load_report(s);
 
         sanity_checks(s, &ic);
 
@@ -1,6 +1,8 @@
+#define _GNU_SOURCE // pthread_setaffinity_np
 #include "planetary_loop_machine.h"
 
 #include "math.h"
+#include <immintrin.h>
 
 
 uint32_t calculate_loop_frames(float bpm, uint32_t sample_rate, uint32_t beats_per_bar, uint32_t bars)
@@ -16,305 +18,4372 @@ float bpm_to_hz(float bpm)
     return bpm / 120;
 }
 
-Sample* sample_F32_load(SoundController* soundController, const char* filename, uint16_t index, uint8_t beatsPerBar, uint8_t barsPerLoop, uint16_t sampleRate, uint8_t channelCount)
+/* Tempo conformed loading */
+
+// a <name>.bpm file next to the sample wins over a tag in the name, 0 when neither gives a tempo
+static float sample_source_bpm(const char* filename)
+{
+    float bpm = 0.0f;
+    const char* dot = strrchr(filename, '.');
+    size_t stem = dot != NULL && strchr(dot, '/') == NULL ? (size_t)(dot - filename) : strlen(filename);
+    char sidecar[stem + 5];
+    memcpy(sidecar, filename, stem);
+    memcpy(sidecar + stem, ".bpm", 5);
+    FILE* file = fopen(sidecar, "r");
+    if (file != NULL)
+    {
+        if (fscanf(file, "%f", &bpm) != 1)
+            bpm = 0.0f;
+        fclose(file);
+    }
+    else
+    {
+        // "128bpm", "128 BPM" or "97.5bpm" anywhere in the name
+        const char* name = strrchr(filename, '/') != NULL ? strrchr(filename, '/') + 1 : filename;
+        for (const char* tag = name; *tag != '\0' && tag < filename + stem; ++tag)
+        {
+            if (strncasecmp(tag, "bpm", 3) != 0)
+                continue;
+            const char* number = tag;
+            while (number > name && number[-1] == ' ')
+                --number;
+            while (number > name && (isdigit(number[-1]) || number[-1] == '.'))
+                --number;
+            if (isdigit(*number))
+            {
+                bpm = strtof(number, NULL);
+                break;
+            }
+        }
+    }
+    if (bpm != 0.0f && (bpm < STRETCH_BPM_MIN || bpm > STRETCH_BPM_MAX))
+    {
+        printf(MAGENTA "\t\tWARNING: %s gives a tempo of %0.2f BPM, playing it as it is\n" RESET, filename, bpm);
+        bpm = 0.0f;
+    }
+    return bpm;
+}
+
+// 64 bit FNV-1a over the files bytes, so a cached stretch follows the audio not the filename
+static bool sample_file_hash(const char* filename, uint64_t* hash)
+{
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL)
+        return false;
+    uint8_t chunk[1 << 16];
+    size_t read;
+    *hash = 0xcbf29ce484222325ull;
+    while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0)
+    {
+        for (size_t i = 0; i < read; ++i)
+            *hash = (*hash ^ chunk[i]) * 0x100000001b3ull;
+    }
+    fclose(file);
+    return true;
+}
+
+/* Sample storage */
+
+static size_t sample_format_bytes(uint8_t format)
+{
+    return format == SAMPLE_FORMAT_F32 ? sizeof(float) : sizeof(uint16_t);
+}
+
+// Round to nearest even as F16C does, anything past the largest half is infinity
+static uint16_t sample_half_from_float(float value)
+{
+#if defined(__F16C__)
+    return _cvtss_sh(value, _MM_FROUND_TO_NEAREST_INT);
+#else
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint16_t sign = (bits >> 16) & 0x8000;
+    uint32_t magnitude = bits & 0x7FFFFFFF;
+    if (magnitude > 0x7F800000)
+        return sign | 0x7E00;
+    if (magnitude >= 0x47800000)
+        return sign | 0x7C00;
+    uint32_t half, rest, midpoint;
+    if (magnitude >= 0x38800000)
+    {
+        half = (magnitude >> 13) - (112 << 10);
+        rest = magnitude & 0x1FFF;
+        midpoint = 0x1000;
+    }
+    else
+    {
+        // subnormal, counted in steps of 2^-24
+        if (magnitude < 0x33000000)
+            return sign;
+        uint32_t shift = 126 - (magnitude >> 23);
+        uint32_t mantissa = (magnitude & 0x7FFFFF) | 0x800000;
+        half = mantissa >> shift;
+        rest = mantissa & ((1u << shift) - 1);
+        midpoint = 1u << (shift - 1);
+    }
+    if (rest > midpoint || (rest == midpoint && (half & 1)))
+        ++half;
+    return sign | half;
+#endif
+}
+
+static float sample_half_to_float(uint16_t half)
+{
+#if defined(__F16C__)
+    return _cvtsh_ss(half);
+#else
+    uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1F;
+    uint32_t mantissa = half & 0x3FF;
+    uint32_t bits;
+    if (exponent == 0x1F)
+        bits = sign | 0x7F800000 | (mantissa << 13);
+    else if (exponent != 0)
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    else if (mantissa == 0)
+        bits = sign;
+    else
+    {
+        // subnormal, normalised as a float
+        exponent = 113;
+        while (!(mantissa & 0x400))
+        {
+            mantissa <<= 1;
+            --exponent;
+        }
+        bits = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+    }
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+#endif
+}
+
+static int16_t sample_s16_from_float(float value)
+{
+    long step = lrintf(value * SAMPLE_S16_SCALE);
+    return (int16_t)(step > INT16_MAX ? INT16_MAX : (step < INT16_MIN ? INT16_MIN : step));
+}
+
+// One sample of a buffer in any format
+static inline float sample_read(const void* buffer, size_t i, uint8_t format)
+{
+    switch (format)
+    {
+    case SAMPLE_FORMAT_S16:
+        return ((const int16_t*)buffer)[i] * (1.0f / SAMPLE_S16_SCALE);
+    case SAMPLE_FORMAT_F16:
+        return sample_half_to_float(((const uint16_t*)buffer)[i]);
+    default:
+        return ((const float*)buffer)[i];
+    }
+}
+
+#if defined(__AVX2__)
+// 2 samples of a buffer from i as f32 in the low half, a mono frame and the one after it
+static inline __m128 sample_load2_f32(const void* buffer, int64_t i, uint8_t format)
+{
+    switch (format)
+    {
+    case SAMPLE_FORMAT_S16:
+    {
+        int32_t pair;
+        memcpy(&pair, (const int16_t*)buffer + i, sizeof(pair));
+        return _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepi16_epi32(_mm_cvtsi32_si128(pair))), _mm_set1_ps(1.0f / SAMPLE_S16_SCALE));
+    }
+    case SAMPLE_FORMAT_F16:
+    {
+#if defined(__F16C__)
+        int32_t pair;
+        memcpy(&pair, (const uint16_t*)buffer + i, sizeof(pair));
+        return _mm_cvtph_ps(_mm_cvtsi32_si128(pair));
+#else
+        return _mm_setr_ps(sample_read(buffer, i, format), sample_read(buffer, i + 1, format), 0.0f, 0.0f);
+#endif
+    }
+    default:
+    {
+        int64_t pair;
+        memcpy(&pair, (const float*)buffer + i, sizeof(pair));
+        return _mm_castsi128_ps(_mm_cvtsi64_si128(pair));
+    }
+    }
+}
+
+// 4 and 8 samples of a buffer from i as f32, packed formats converted as they load
+static inline __m128 sample_load4_f32(const void* buffer, int64_t i, uint8_t format)
+{
+    switch (format)
+    {
+    case SAMPLE_FORMAT_S16:
+        return _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i*)((const int16_t*)buffer + i)))),
+                          _mm_set1_ps(1.0f / SAMPLE_S16_SCALE));
+    case SAMPLE_FORMAT_F16:
+#if defined(__F16C__)
+        return _mm_cvtph_ps(_mm_loadl_epi64((const __m128i*)((const uint16_t*)buffer + i)));
+#else
+        return _mm_setr_ps(sample_read(buffer, i, format), sample_read(buffer, i + 1, format), sample_read(buffer, i + 2, format),
+                           sample_read(buffer, i + 3, format));
+#endif
+    default:
+        return _mm_loadu_ps((const float*)buffer + i);
+    }
+}
+
+static inline __m256 sample_load8_f32(const void* buffer, int64_t i, uint8_t format)
+{
+    switch (format)
+    {
+    case SAMPLE_FORMAT_S16:
+        return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)((const int16_t*)buffer + i)))),
+                             _mm256_set1_ps(1.0f / SAMPLE_S16_SCALE));
+    case SAMPLE_FORMAT_F16:
+#if defined(__F16C__)
+        return _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)((const uint16_t*)buffer + i)));
+#else
+        return _mm256_set_m128(sample_load4_f32(buffer, i + 4, format), sample_load4_f32(buffer, i, format));
+#endif
+    default:
+        return _mm256_loadu_ps((const float*)buffer + i);
+    }
+}
+#endif
+
+// count samples of a buffer from first as f32
+static void sample_unpack(float* out, const void* buffer, size_t first, uint32_t count, uint8_t format)
+{
+    uint32_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 8 <= count; i += 8)
+        _mm256_storeu_ps(out + i, sample_load8_f32(buffer, first + i, format));
+#endif
+    for (; i < count; ++i)
+        out[i] = sample_read(buffer, first + i, format);
+}
+
+// count samples of a mono buffer played as stereo from sample first of the stereo stream, each frame on both sides
+static void sample_unpack_mono(float* out, const void* buffer, size_t first, uint32_t count, uint8_t format)
+{
+    for (uint32_t i = 0; i < count; ++i)
+        out[i] = sample_read(buffer, (first + i) / 2, format);
+}
+
+// Converts count f32 samples into the format, out can't be in. The vector and scalar paths round the same.
+// Returns the peak magnitude so callers can tell when 16-bit integer storage clipped the sample
+static float sample_pack(void* out, const float* in, size_t count, uint8_t format)
+{
+    size_t i = 0;
+    float peak = 0.0f;
+    if (format == SAMPLE_FORMAT_S16)
+    {
+        int16_t* packed = out;
+#if defined(__AVX2__)
+        __m256 scale8 = _mm256_set1_ps(SAMPLE_S16_SCALE);
+        __m256 low8 = _mm256_set1_ps(INT16_MIN);
+        __m256 high8 = _mm256_set1_ps(INT16_MAX);
+        __m256 sign8 = _mm256_set1_ps(-0.0f);
+        __m256 peak8 = _mm256_setzero_ps();
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 in8 = _mm256_loadu_ps(in + i);
+            peak8 = _mm256_max_ps(peak8, _mm256_andnot_ps(sign8, in8));
+            __m256 scaled = _mm256_min_ps(high8, _mm256_max_ps(low8, _mm256_mul_ps(in8, scale8)));
+            __m256i steps = _mm256_cvtps_epi32(scaled);
+            __m256i narrowed = _mm256_permute4x64_epi64(_mm256_packs_epi32(steps, steps), 0x08);
+            _mm_storeu_si128((__m128i*)(packed + i), _mm256_castsi256_si128(narrowed));
+        }
+        float lanes[8];
+        _mm256_storeu_ps(lanes, peak8);
+        for (int lane = 0; lane < 8; ++lane)
+            peak = fmaxf(peak, lanes[lane]);
+#endif
+        for (; i < count; ++i)
+        {
+            peak = fmaxf(peak, fabsf(in[i]));
+            packed[i] = sample_s16_from_float(in[i]);
+        }
+    }
+    else if (format == SAMPLE_FORMAT_F16)
+    {
+        uint16_t* packed = out;
+#if defined(__AVX2__) && defined(__F16C__)
+        for (; i + 8 <= count; i += 8)
+            _mm_storeu_si128((__m128i*)(packed + i), _mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT));
+#endif
+        for (; i < count; ++i)
+            packed[i] = sample_half_from_float(in[i]);
+    }
+    else
+        memcpy(out, in, count * sizeof(float));
+    return peak;
+}
+
+// True when both sides of every stereo frame are the same, a mono file comes out of the decoder that way
+static bool sample_stereo_is_mono(const float* frames, uint64_t frameCount)
+{
+    for (uint64_t i = 0; i < frameCount; ++i)
+    {
+        if (frames[i * 2] != frames[i * 2 + 1])
+            return false;
+    }
+    return true;
+}
+
+// Keeps the left side of each stereo frame, in place
+static void sample_stereo_to_mono(float* frames, uint64_t frameCount)
+{
+    for (uint64_t i = 1; i < frameCount; ++i)
+        frames[i] = frames[i * 2];
+}
+
+// Float sources can run past full scale, which 16-bit integer storage can't hold
+static void sample_clip_warn(const Sample* sample, float peak)
+{
+    if (sample->format == SAMPLE_FORMAT_S16 && peak * SAMPLE_S16_SCALE > INT16_MAX)
+        printf(MAGENTA "\t\tWARNING: Sample %u peaks at %0.2f, clipped to full scale in 16-bit storage\n" RESET, sample->index, peak);
+}
+
+/* Sample cache */
+
+// 64 bit FNV-1a over a string, a plain sample's cache file is named by its path
+static uint64_t sample_path_hash(const char* path)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (; *path != '\0'; ++path)
+        hash = (hash ^ (uint8_t)*path) * 0x100000001b3ull;
+    return hash;
+}
+
+static size_t sample_cache_bytes(uint64_t frames, uint32_t channelCount, uint8_t format)
+{
+    return SAMPLE_CACHE_HEADER_BYTES + (size_t)frames * channelCount * sample_format_bytes(format);
+}
+
+// Maps the cache file when its header matches what the sample is expected to be. The pages are asked for
+// ahead so the audio thread mostly finds them resident, real-time mode's mlockall pins them
+static bool sample_cache_map(Sample* sample, const char* path, const SampleCacheHeader* expected)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    SampleCacheHeader header;
+    struct stat info;
+    bool matches = pread(fd, &header, sizeof(header), 0) == sizeof(header) && header.magic == SAMPLE_CACHE_MAGIC &&
+                   header.version == SAMPLE_CACHE_VERSION && header.sampleRate == expected->sampleRate &&
+                   header.channelCount == expected->channelCount && header.sourceMtime == expected->sourceMtime &&
+                   header.sourceSize == expected->sourceSize && header.sourceHash == expected->sourceHash &&
+                   header.sourceBpm == expected->sourceBpm && header.bpm == expected->bpm && header.format == expected->format &&
+                   (header.channels == 1 || header.channels == header.channelCount);
+    if (!matches)
+    {
+        close(fd);
+        return false;
+    }
+    size_t bytes = sample_cache_bytes(header.frames, header.channels, header.format);
+    void* mapping = MAP_FAILED;
+    if (header.frames > 0 && header.frames < UINT32_MAX && fstat(fd, &info) == 0 && (size_t)info.st_size >= bytes)
+        mapping = mmap(NULL, bytes, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        printf(MAGENTA "\t\tWARNING: Sample cache %s is damaged, decoding again\n" RESET, path);
+        return false;
+    }
+    madvise(mapping, bytes, MADV_WILLNEED);
+    sample->buffer = (float*)((char*)mapping + SAMPLE_CACHE_HEADER_BYTES);
+    sample->length = (uint32_t)header.frames;
+    sample->format = header.format;
+    sample->channels = header.channels;
+    sample->mapped = true;
+    return true;
+}
+
+static void sample_cache_unmap(Sample* sample)
+{
+    if (!sample->mapped)
+        return;
+    munmap((char*)sample->buffer - SAMPLE_CACHE_HEADER_BYTES, sample_cache_bytes(sample->length, sample->channels, sample->format));
+    sample->mapped = false;
+}
+
+// Writes to every page of the arena so none of them fault on first touch in the callback
+static size_t arena_prefault(Arena* arena, size_t pageSize)
+{
+    size_t touched = 0;
+    for (ArenaBlock* block = arena->first; block != NULL; block = block->next)
+    {
+        volatile uint8_t* memory = block->memory;
+        for (size_t i = 0; i < block->size; i += pageSize)
+            memory[i] = memory[i];
+        touched += block->size;
+    }
+    return touched;
+}
+
+// The cache mapping is read only so its pages are read in instead
+static size_t sample_cache_prefault(const Sample* sample, size_t pageSize)
+{
+    if (!sample->mapped)
+        return 0;
+    size_t bytes = sample_cache_bytes(sample->length, sample->channels, sample->format);
+    const volatile uint8_t* mapping = (const uint8_t*)sample->buffer - SAMPLE_CACHE_HEADER_BYTES;
+    uint8_t sink = 0;
+    for (size_t i = 0; i < bytes; i += pageSize)
+        sink ^= mapping[i];
+    (void)sink;
+    return bytes;
+}
+
+/* written under a temporary name first so a load that is cut short never leaves half a file behind. The name
+is made unique by mkstemp, two sessions caching the same sample each write their own and the last rename wins */
+static void sample_cache_write(const Sample* sample, const char* path, const SampleCacheHeader* header)
+{
+    char temporary[strlen(path) + 8];
+    sprintf(temporary, "%s.XXXXXX", path);
+    int fd = mkstemp(temporary);
+    if (fd < 0)
+        return;
+    // mkstemp leaves the file private, the cache is as readable as the samples it came from
+    fchmod(fd, 0644);
+    FILE* file = fdopen(fd, "wb");
+    if (file == NULL)
+    {
+        close(fd);
+        remove(temporary);
+        return;
+    }
+    uint8_t page[SAMPLE_CACHE_HEADER_BYTES] = {0};
+    SampleCacheHeader written = *header;
+    written.frames = sample->length;
+    written.channels = sample->channels;
+    memcpy(page, &written, sizeof(written));
+    bool complete = fwrite(page, sizeof(page), 1, file) == 1 &&
+                    fwrite(sample->buffer, sample_format_bytes(header->format) * sample->channels, sample->length, file) == sample->length;
+    if (fclose(file) == 0 && complete && rename(temporary, path) == 0)
+        return;
+    printf(MAGENTA "\t\tWARNING: Couldn't write sample cache %s\n" RESET, path);
+    remove(temporary);
+}
+
+/* WSOLA, each grain is read from near where the tempo change puts it, shifted by up to
+STRETCH_SEEK_FRAMES to where it best continues the grain before so the overlap add stays in phase.
+Loops are stretched as a circle, reading and writing around the ends, so the result loops as cleanly
+as the source did */
+static void sample_stretch(const float* source, uint32_t sourceFrames, float* output, uint32_t outputFrames, uint8_t channelCount)
+{
+    float window[STRETCH_WINDOW_FRAMES];
+    for (uint32_t n = 0; n < STRETCH_WINDOW_FRAMES; ++n)
+        window[n] = 0.5f - 0.5f * cosf(2.0f * (float)M_PI * n / STRETCH_WINDOW_FRAMES);
+
+    // the channels summed down, unwrapped far enough past both ends that the search never has to wrap
+    uint32_t monoFrames = sourceFrames + 2 * STRETCH_SEEK_FRAMES + STRETCH_WINDOW_FRAMES + STRETCH_HOP_FRAMES;
+    float* mono = malloc(sizeof(float) * monoFrames);
+    float* weight = calloc(outputFrames, sizeof(float));
+    assert(mono != NULL && weight != NULL && "ERROR - Failed to allocate stretch scratch");
+    for (uint32_t j = 0; j < monoFrames; ++j)
+    {
+        uint32_t frame = (j + sourceFrames - STRETCH_SEEK_FRAMES % sourceFrames) % sourceFrames;
+        mono[j] = 0.0f;
+        for (uint8_t c = 0; c < channelCount; ++c)
+            mono[j] += source[frame * channelCount + c];
+    }
+    memset(output, 0, sizeof(float) * outputFrames * channelCount);
+
+    double sourceHop = (double)STRETCH_HOP_FRAMES * sourceFrames / outputFrames;
+    uint32_t grains = (outputFrames + STRETCH_HOP_FRAMES - 1) / STRETCH_HOP_FRAMES;
+    uint32_t previous = 0;
+    for (uint32_t k = 0; k < grains; ++k)
+    {
+        uint32_t nominal = (uint64_t)llround(k * sourceHop) % sourceFrames;
+        uint32_t start = nominal;
+        if (k > 0)
+        {
+            // mono is offset by the seek range, so candidate nominal + d sits at mono[nominal + STRETCH_SEEK_FRAMES + d]
+            const float* natural = mono + (previous + STRETCH_HOP_FRAMES) % sourceFrames + STRETCH_SEEK_FRAMES;
+            float best = -INFINITY;
+            for (int32_t d = -STRETCH_SEEK_FRAMES; d <= STRETCH_SEEK_FRAMES; ++d)
+            {
+                const float* candidate = mono + nominal + STRETCH_SEEK_FRAMES + d;
+                float similarity = 0.0f;
+                for (uint32_t n = 0; n < STRETCH_WINDOW_FRAMES; n += STRETCH_SEEK_STRIDE)
+                    similarity += natural[n] * candidate[n];
+                if (similarity > best)
+                {
+                    best = similarity;
+                    start = (uint32_t)((((int64_t)nominal + d) % sourceFrames + sourceFrames) % sourceFrames);
+                }
+            }
+        }
+        for (uint32_t n = 0; n < STRETCH_WINDOW_FRAMES; ++n)
+        {
+            uint32_t in = (start + n) % sourceFrames;
+            uint32_t out = (k * STRETCH_HOP_FRAMES + n) % outputFrames;
+            for (uint8_t c = 0; c < channelCount; ++c)
+                output[out * channelCount + c] += window[n] * source[in * channelCount + c];
+            weight[out] += window[n];
+        }
+        previous = start;
+    }
+    // grains overlapping the start again when the length isn't a whole number of hops pile up there
+    for (uint32_t j = 0; j < outputFrames; ++j)
+    {
+        if (weight[j] > 1e-3f)
+        {
+            for (uint8_t c = 0; c < channelCount; ++c)
+                output[j * channelCount + c] /= weight[j];
+        }
+    }
+    free(mono);
+    free(weight);
+}
+
+static void* sample_stretch_run(void* arg)
+{
+    SampleStretchQueue* queue = arg;
+    uint32_t i;
+    while ((i = atomic_fetch_add_explicit(&queue->next, 1, memory_order_relaxed)) < queue->count)
+    {
+        SampleStretchJob* job = &queue->jobs[i];
+        float* output = job->output != NULL ? job->output : job->sample->buffer;
+        sample_stretch(job->source, job->sourceFrames, output, job->sample->length, job->channelCount);
+        free(job->source);
+        job->source = NULL;
+        if (job->output != NULL)
+        {
+            float peak = sample_pack(job->sample->buffer, job->output, (size_t)job->sample->length * job->channelCount, job->sample->format);
+            sample_clip_warn(job->sample, peak);
+            free(job->output);
+            job->output = NULL;
+        }
+        if (job->cachePath[0] != '\0')
+            sample_cache_write(job->sample, job->cachePath, &job->cacheHeader);
+    }
+    return NULL;
+}
+
+// stretches everything queued while loading, returning once every sample is ready to play
+static void sample_stretch_queue_run(SampleStretchQueue* queue, float bpm)
+{
+    if (queue->count == 0)
+        return;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t threadCount = cores > 1 ? (uint32_t)cores : 1;
+    if (threadCount > STRETCH_THREADS_MAX)
+        threadCount = STRETCH_THREADS_MAX;
+    if (threadCount > queue->count)
+        threadCount = queue->count;
+    printf(BOLD_CYAN "Stretching %u samples to %0.2f BPM over %u thread%s\n" RESET, queue->count, bpm, threadCount, threadCount > 1 ? "s" : "");
+
+    // the loading thread takes jobs too, so a thread that fails to start only costs time
+    pthread_t threads[STRETCH_THREADS_MAX];
+    uint32_t started = 0;
+    for (; started + 1 < threadCount; ++started)
+    {
+        if (pthread_create(&threads[started], NULL, sample_stretch_run, queue) != 0)
+            break;
+    }
+    sample_stretch_run(queue);
+    for (uint32_t i = 0; i < started; ++i)
+        pthread_join(threads[i], NULL);
+}
+
+static bool sample_stretched(float sourceBpm, float bpm)
+{
+    return sourceBpm != 0.0f && fabsf(sourceBpm - bpm) > 0.005f;
+}
+
+/* Decodes the file at the sessions sample rate and channel count. With a sourceBpm other than the
+sessions the sample is mapped from the stretch cache when it's there, otherwise it is decoded to the
+side and queued to be stretched, the buffer it will be stretched into allocated here as the arena
+isn't safe to use from the stretch threads. A plain sample is mapped from cacheDirectory when the file
+hasn't changed since it was cached, and cached once decoded otherwise. The sample is kept in storage,
+decoded as f32 and packed, except a streamed one which stays f32. Safe to run on several threads at
+once as long as each has an arena of its own */
+Sample* sample_F32_load(Arena* arena, float bpm, const char* filename, uint16_t index, uint16_t sampleRate, uint8_t channelCount, float sourceBpm, SampleStretchQueue* stretch, const char* cacheDirectory, uint8_t storage)
 {
     ma_decoder decoder;
     ma_decoder_config config;
     ma_uint64 total_frame_count;
 
+    bool stretched = sample_stretched(sourceBpm, bpm);
+    char cachePath[sizeof(stretch->directory) + 64];
+    cachePath[0] = '\0';
+    SampleCacheHeader cacheHeader = { .magic = SAMPLE_CACHE_MAGIC, .version = SAMPLE_CACHE_VERSION, .sampleRate = sampleRate, .channelCount = channelCount, .format = storage };
+    const char* formatTag = storage == SAMPLE_FORMAT_S16 ? "_s16" : (storage == SAMPLE_FORMAT_F16 ? "_f16" : "");
+    if (stretched)
+    {
+        assert(stretch != NULL && "ERROR stretching a sample without a stretch queue");
+        Sample* sample = arena_alloc(arena, sizeof(Sample), NULL);
+        memset(sample, 0, sizeof(Sample));
+        sample->index = index;
+        sample->sourceBpm = sourceBpm;
+        sample->format = storage;
+
+        uint64_t hash;
+        if (stretch->directory[0] != '\0' && sample_file_hash(filename, &hash))
+        {
+            snprintf(cachePath, sizeof(cachePath), "%s%016llx_%0.2fto%0.2f_%u_%u%s.pcm", stretch->directory,
+                     (unsigned long long)hash, sourceBpm, bpm, sampleRate, channelCount, formatTag);
+            cacheHeader.sourceHash = hash;
+            cacheHeader.sourceBpm = sourceBpm;
+            cacheHeader.bpm = bpm;
+            if (sample_cache_map(sample, cachePath, &cacheHeader))
+                return sample;
+        }
+
+        config = ma_decoder_config_init(ma_format_f32, channelCount, sampleRate);
+        if (ma_decoder_init_file(filename, &config, &decoder) != MA_SUCCESS)
+        {
+            printf("Failed to load file: %s\n", filename);
+            return NULL;
+        }
+        if (ma_decoder_get_length_in_pcm_frames(&decoder, &total_frame_count) != MA_SUCCESS || total_frame_count == 0)
+        {
+            printf("Failed to get length of file: %s\n", filename);
+            ma_decoder_uninit(&decoder);
+            return NULL;
+        }
+        float* source = malloc(total_frame_count * channelCount * sizeof(float));
+        if (source == NULL)
+        {
+            printf("ERROR - Failed to allocate memory\n");
+            ma_decoder_uninit(&decoder);
+            return NULL;
+        }
+        ma_uint64 frames_read = 0;
+        ma_result result = ma_decoder_read_pcm_frames(&decoder, source, total_frame_count, &frames_read);
+        if (result != MA_SUCCESS || frames_read != total_frame_count)
+        {
+            printf("WARNING: Only read %llu of %llu frames\n", frames_read, total_frame_count);
+            memset(source + frames_read * channelCount, 0, (total_frame_count - frames_read) * channelCount * sizeof(float));
+        }
+        ma_decoder_uninit(&decoder);
+
+        // a mono source is stretched and kept as one channel
+        sample->channels = channelCount;
+        if (channelCount == 2 && sample_stereo_is_mono(source, total_frame_count))
+        {
+            sample_stereo_to_mono(source, total_frame_count);
+            sample->channels = 1;
+        }
+        sample->length = (uint32_t)llround((double)total_frame_count * sourceBpm / bpm);
+        sample->buffer = arena_alloc(arena, (size_t)sample->length * sample->channels * sample_format_bytes(storage), NULL);
+        float* output = storage != SAMPLE_FORMAT_F32 ? malloc((size_t)sample->length * sample->channels * sizeof(float)) : NULL;
+        if (sample->buffer == NULL || (storage != SAMPLE_FORMAT_F32 && output == NULL))
+        {
+            printf("ERROR - Failed to allocate memory\n");
+            free(source);
+            free(output);
+            return NULL;
+        }
+
+        SampleStretchJob* job = &stretch->jobs[atomic_fetch_add_explicit(&stretch->count, 1, memory_order_relaxed)];
+        job->sample = sample;
+        job->source = source;
+        job->output = output;
+        job->sourceFrames = (uint32_t)total_frame_count;
+        job->channelCount = sample->channels;
+        strcpy(job->cachePath, cachePath);
+        job->cacheHeader = cacheHeader;
+        return sample;
+    }
+
+    Sample* sample = arena_alloc(arena, sizeof(Sample), NULL);
+    memset(sample, 0, sizeof(Sample));
+    sample->index = index;
+
+    struct stat info;
+    if (cacheDirectory != NULL && cacheDirectory[0] != '\0' && stat(filename, &info) == 0)
+    {
+        cacheHeader.sourceMtime = (int64_t)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+        cacheHeader.sourceSize = info.st_size;
+        cacheHeader.sourceHash = sample_path_hash(filename);
+        snprintf(cachePath, sizeof(cachePath), "%s%016llx_%u_%u%s.pcm", cacheDirectory, (unsigned long long)cacheHeader.sourceHash, sampleRate, channelCount, formatTag);
+        if (sample_cache_map(sample, cachePath, &cacheHeader))
+            return sample;
+    }
+
     config = ma_decoder_config_init(ma_format_f32, channelCount, sampleRate);
 
     if (ma_decoder_init_file(filename, &config, &decoder) != MA_SUCCESS)
     {
-        printf("Failed to load file: %s\n", filename);
-        return NULL;
+        printf("Failed to load file: %s\n", filename);
+        return NULL;
+    }
+
+    // Get total length in frames
+    ma_result result = ma_decoder_get_length_in_pcm_frames(&decoder, &total_frame_count);
+    if (result != MA_SUCCESS)
+    {
+        printf("Failed to get length of file: %s\n", filename);
+        ma_decoder_uninit(&decoder);
+        return NULL;
+    }
+
+    // long samples only keep their head, the rest is streamed while they play
+    ma_uint64 resident_frame_count = total_frame_count;
+    if (total_frame_count > (ma_uint64)STREAM_MIN_SECONDS * sampleRate)
+    {
+        resident_frame_count = STREAM_HEAD_FRAMES;
+        sample->path = arena_alloc(arena, strlen(filename) + 1, NULL);
+        strcpy(sample->path, filename);
+    }
+
+    sample->length = total_frame_count;
+    sample->channels = channelCount;
+    sample->format = sample->path == NULL ? storage : SAMPLE_FORMAT_F32;
+    ma_uint64 frames_read = 0;
+    if (sample->path != NULL)
+    {
+        // a streamed samples head is copied into the rings as it is, so it stays f32 with every channel
+        sample->buffer = arena_alloc(arena, resident_frame_count * channelCount * sizeof(float), NULL);
+        if (sample->buffer == NULL)
+        {
+            printf("ERROR - Failed to allocate memory\n");
+            ma_decoder_uninit(&decoder);
+            return NULL;
+        }
+        result = ma_decoder_read_pcm_frames(&decoder, sample->buffer, resident_frame_count, &frames_read);
+    }
+    else
+    {
+        // decoded to the side first, then kept in its format and as mono when both sides are the same
+        float* decoded = calloc(resident_frame_count * channelCount, sizeof(float));
+        if (decoded == NULL)
+        {
+            printf("ERROR - Failed to allocate memory\n");
+            ma_decoder_uninit(&decoder);
+            return NULL;
+        }
+        result = ma_decoder_read_pcm_frames(&decoder, decoded, resident_frame_count, &frames_read);
+        if (channelCount == 2 && sample_stereo_is_mono(decoded, resident_frame_count))
+        {
+            sample_stereo_to_mono(decoded, resident_frame_count);
+            sample->channels = 1;
+        }
+        sample->buffer = arena_alloc(arena, resident_frame_count * sample->channels * sample_format_bytes(sample->format), NULL);
+        if (sample->buffer == NULL)
+        {
+            printf("ERROR - Failed to allocate memory\n");
+            free(decoded);
+            ma_decoder_uninit(&decoder);
+            return NULL;
+        }
+        float peak = sample_pack(sample->buffer, decoded, resident_frame_count * sample->channels, sample->format);
+        free(decoded);
+        sample_clip_warn(sample, peak);
+    }
+
+    if (result != MA_SUCCESS || frames_read != resident_frame_count)
+        printf("WARNING: Only read %llu of %llu frames\n", frames_read, resident_frame_count);
+    // streamed samples are already read off the disk as they play
+    else if (cachePath[0] != '\0' && sample->path == NULL)
+        sample_cache_write(sample, cachePath, &cacheHeader);
+
+    ma_decoder_uninit(&decoder);
+
+    return sample;
+}
+
+// .bpm sidecars sit next to the samples but aren't samples
+static bool sample_file_listed(const char* name)
+{
+    size_t length = strlen(name);
+    return name[0] != '.' && !(length > 4 && strcasecmp(name + length - 4, ".bpm") == 0);
+}
+
+/* Parallel loading */
+
+static int sample_load_job_compare(const void* a, const void* b)
+{
+    return strcmp(((const SampleLoadJob*)a)->name, ((const SampleLoadJob*)b)->name);
+}
+
+// the name without its extension, cut to fit
+static void sample_name_set(Sample* sample, const char* fileName)
+{
+    size_t length = strlen(fileName);
+    size_t stem = length > 4 ? length - 4 : length;
+    if (stem > sizeof(sample->name) - 1)
+        stem = sizeof(sample->name) - 1;
+    memcpy(sample->name, fileName, stem);
+    sample->name[stem] = '\0';
+}
+
+static void* sample_load_run(void* arg)
+{
+    SampleLoadThread* thread = arg;
+    SampleLoadQueue* queue = thread->queue;
+    uint32_t i;
+    while ((i = atomic_fetch_add_explicit(&queue->next, 1, memory_order_relaxed)) < queue->count)
+    {
+        SampleLoadJob* job = &queue->jobs[i];
+        job->sample = sample_F32_load(thread->arena, queue->bpm, job->path, i, queue->sampleRate, queue->channelCount, sample_source_bpm(job->path), queue->stretch, queue->cacheDirectory, queue->storage);
+        if (job->sample != NULL)
+            sample_name_set(job->sample, job->name);
+        atomic_fetch_add_explicit(&queue->done, 1, memory_order_relaxed);
+    }
+    return NULL;
+}
+
+// Loads every job over the threads, each into its own arena handed to the controller, while the calling
+// thread keeps the progress line up to date. Returns once every job is done
+static void sample_load_queue_run(SoundController* sc, SampleLoadQueue* queue)
+{
+    if (queue->count == 0)
+        return;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t threadCount = cores > 1 ? (uint32_t)cores : 1;
+    if (threadCount > LOAD_THREADS_MAX)
+        threadCount = LOAD_THREADS_MAX;
+    if (threadCount > queue->count)
+        threadCount = queue->count;
+
+    SampleLoadThread threads[LOAD_THREADS_MAX];
+    for (uint32_t i = 0; i < threadCount; ++i)
+    {
+        threads[i] = (SampleLoadThread){ .queue = queue, .arena = arena_init(ARENA_BLOCK_SIZE, 32, false) };
+        sc->loadArenas[sc->loadArenaCount++] = threads[i].arena;
+    }
+    printf(BOLD_CYAN "Loading %u samples over %u thread%s\n" RESET, queue->count, threadCount, threadCount > 1 ? "s" : "");
+
+    pthread_t handles[LOAD_THREADS_MAX];
+    uint32_t started = 0;
+    for (; started < threadCount; ++started)
+    {
+        if (pthread_create(&handles[started], NULL, sample_load_run, &threads[started]) != 0)
+            break;
+    }
+    // the jobs a thread that didn't start would have taken go to the ones that did, with none they're loaded here
+    if (started == 0)
+        sample_load_run(&threads[0]);
+
+    uint32_t shown = UINT32_MAX;
+    for (;;)
+    {
+        uint32_t done = atomic_load_explicit(&queue->done, memory_order_relaxed);
+        if (done != shown)
+        {
+            printf(CYAN "\r  %u/%u loaded" RESET, done, queue->count);
+            fflush(stdout);
+            shown = done;
+        }
+        if (done == queue->count)
+            break;
+        usleep(LOAD_PROGRESS_MICROSECONDS);
+    }
+    printf("\n");
+    for (uint32_t i = 0; i < started; ++i)
+        pthread_join(handles[i], NULL);
+}
+
+/* Lazy loading */
+
+// Reads what the listing needs out of the file without decoding it, a stretched sample gets the length
+// it will have once it's stretched and a long one its path so the streamer is made for it
+static Sample* sample_index(Arena* arena, float bpm, const char* filename, uint16_t sampleRate, uint8_t channelCount, float sourceBpm)
+{
+    ma_decoder decoder;
+    ma_decoder_config config = ma_decoder_config_init(ma_format_f32, channelCount, sampleRate);
+    if (ma_decoder_init_file(filename, &config, &decoder) != MA_SUCCESS)
+    {
+        printf("Failed to load file: %s\n", filename);
+        return NULL;
+    }
+    ma_uint64 total_frame_count;
+    ma_result result = ma_decoder_get_length_in_pcm_frames(&decoder, &total_frame_count);
+    ma_decoder_uninit(&decoder);
+    if (result != MA_SUCCESS || total_frame_count == 0)
+    {
+        printf("Failed to get length of file: %s\n", filename);
+        return NULL;
+    }
+
+    Sample* sample = arena_alloc(arena, sizeof(Sample), NULL);
+    memset(sample, 0, sizeof(Sample));
+    sample->channels = channelCount; // known once it has loaded
+    if (sample_stretched(sourceBpm, bpm))
+    {
+        sample->length = (uint32_t)llround((double)total_frame_count * sourceBpm / bpm);
+        sample->sourceBpm = sourceBpm;
+    }
+    else
+    {
+        sample->length = total_frame_count;
+        if (total_frame_count > (ma_uint64)STREAM_MIN_SECONDS * sampleRate)
+        {
+            sample->path = arena_alloc(arena, strlen(filename) + 1, NULL);
+            strcpy(sample->path, filename);
+        }
+    }
+    atomic_init(&sample->state, SAMPLE_INDEXED);
+    return sample;
+}
+
+// Loads requested samples until the loader is stopped. A sample is filled in place, the audio thread only
+// looks past its state once READY is stored
+static void* sample_loader_run(void* arg)
+{
+    SampleLoaderThread* thread = arg;
+    SampleLoader* loader = thread->loader;
+    SampleStretchJob job;
+    for (;;)
+    {
+        pthread_mutex_lock(&loader->mutex);
+        while (loader->head == loader->tail && !loader->stop)
+            pthread_cond_wait(&loader->cond, &loader->mutex);
+        if (loader->stop)
+        {
+            pthread_mutex_unlock(&loader->mutex);
+            break;
+        }
+        uint16_t index = loader->requests[loader->head++ % loader->sampleCount];
+        pthread_mutex_unlock(&loader->mutex);
+
+        Sample* sample = loader->samples[index];
+        atomic_store_explicit(&sample->state, SAMPLE_LOADING, memory_order_relaxed);
+        SampleStretchQueue stretch = { .jobs = &job };
+        atomic_init(&stretch.count, 0);
+        atomic_init(&stretch.next, 0);
+        strcpy(stretch.directory, loader->stretchDirectory);
+        const char* path = loader->paths[index];
+        pthread_mutex_lock(&thread->mutex);
+        Sample* loaded = sample_F32_load(thread->arena, loader->bpm, path, index, loader->sampleRate, loader->channelCount,
+                                         sample_source_bpm(path), &stretch, loader->cacheDirectory, loader->storage);
+        sample_stretch_queue_run(&stretch, loader->bpm);
+        if (loaded != NULL)
+        {
+            sample->buffer = loaded->buffer;
+            sample->length = loaded->length;
+            sample->sourceBpm = loaded->sourceBpm;
+            sample->path = loaded->path;
+            sample->mapped = loaded->mapped;
+            sample->format = loaded->format;
+            sample->channels = loaded->channels;
+        }
+        atomic_store_explicit(&sample->state, loaded != NULL ? SAMPLE_READY : SAMPLE_FAILED, memory_order_release);
+        size_t pageSize = atomic_load_explicit(&loader->prefaultPage, memory_order_acquire);
+        if (pageSize > 0)
+        {
+            arena_prefault(thread->arena, pageSize);
+            sample_cache_prefault(sample, pageSize);
+        }
+        pthread_mutex_unlock(&thread->mutex);
+    }
+    return NULL;
+}
+
+// Takes the paths of the gathered samples from the jobs and starts the loader threads, idle until asked
+static SampleLoader* sample_loader_init(SoundController* sc, SampleLoadQueue* queue, const char* stretchDirectory)
+{
+    Arena* arena = sc->arena;
+    SampleLoader* loader = arena_alloc(arena, sizeof(SampleLoader), NULL);
+    memset(loader, 0, sizeof(SampleLoader));
+    loader->samples = sc->samples;
+    loader->sampleCount = sc->sampleCount;
+    uint16_t slots = sc->sampleCount > 0 ? sc->sampleCount : 1;
+    loader->paths = arena_alloc(arena, sizeof(*loader->paths) * slots, NULL);
+    loader->requests = arena_alloc(arena, sizeof(uint16_t) * slots, NULL);
+    loader->reported = arena_alloc(arena, sizeof(uint8_t) * slots, NULL);
+    for (uint32_t i = 0, j = 0; i < queue->count; ++i)
+    {
+        if (queue->jobs[i].sample == NULL)
+            continue;
+        strcpy(loader->paths[j], queue->jobs[i].path);
+        loader->reported[j++] = SAMPLE_INDEXED;
+    }
+    loader->bpm = queue->bpm;
+    loader->sampleRate = queue->sampleRate;
+    loader->channelCount = queue->channelCount;
+    loader->storage = queue->storage;
+    strcpy(loader->cacheDirectory, queue->cacheDirectory);
+    strcpy(loader->stretchDirectory, stretchDirectory);
+    atomic_init(&loader->launchesDropped, 0);
+    atomic_init(&loader->prefaultPage, 0);
+    pthread_mutex_init(&loader->mutex, NULL);
+    pthread_cond_init(&loader->cond, NULL);
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t threadCount = cores > 1 ? (uint32_t)cores : 1;
+    if (threadCount > LOAD_THREADS_MAX)
+        threadCount = LOAD_THREADS_MAX;
+    for (uint32_t i = 0; i < threadCount; ++i)
+    {
+        SampleLoaderThread* thread = &loader->threadArgs[loader->threadCount];
+        *thread = (SampleLoaderThread){ .loader = loader, .arena = arena_init(ARENA_BLOCK_SIZE, 32, false) };
+        sc->loadArenas[sc->loadArenaCount++] = thread->arena;
+        pthread_mutex_init(&thread->mutex, NULL);
+        if (pthread_create(&loader->threads[loader->threadCount], NULL, sample_loader_run, thread) != 0)
+        {
+            pthread_mutex_destroy(&thread->mutex);
+            break;
+        }
+        loader->threadCount++;
+    }
+    assert(loader->threadCount > 0 && "ERROR no loader thread started");
+    return loader;
+}
+
+static void sample_loader_destroy(SampleLoader* loader)
+{
+    pthread_mutex_lock(&loader->mutex);
+    loader->stop = true;
+    pthread_cond_broadcast(&loader->cond);
+    pthread_mutex_unlock(&loader->mutex);
+    for (uint8_t i = 0; i < loader->threadCount; ++i)
+    {
+        pthread_join(loader->threads[i], NULL);
+        pthread_mutex_destroy(&loader->threadArgs[i].mutex);
+    }
+    pthread_cond_destroy(&loader->cond);
+    pthread_mutex_destroy(&loader->mutex);
+}
+
+static const char* sample_state_describe(const Sample* sample)
+{
+    switch (atomic_load_explicit(&sample->state, memory_order_acquire))
+    {
+    case SAMPLE_INDEXED:
+        return " [not loaded]";
+    case SAMPLE_QUEUED:
+    case SAMPLE_LOADING:
+        return " [loading]";
+    case SAMPLE_FAILED:
+        return " [failed]";
+    default:
+        return "";
+    }
+}
+
+void sample_request(SoundController* sc, uint16_t index)
+{
+    SampleLoader* loader = sc->loader;
+    if (loader == NULL || index >= sc->sampleCount)
+        return;
+    uint8_t expected = SAMPLE_INDEXED;
+    if (!atomic_compare_exchange_strong_explicit(&sc->samples[index]->state, &expected, SAMPLE_QUEUED, memory_order_relaxed, memory_order_relaxed))
+        return;
+    pthread_mutex_lock(&loader->mutex);
+    loader->requests[loader->tail++ % loader->sampleCount] = index;
+    pthread_cond_signal(&loader->cond);
+    pthread_mutex_unlock(&loader->mutex);
+    printf(CYAN "\t\tLoading %s in the background\n" RESET, sc->samples[index]->name);
+}
+
+bool sample_preload_list(SoundController* sc, const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+    {
+        printf(MAGENTA "\t\tWARNING: Couldn't read preload list %s\n" RESET, path);
+        return false;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        size_t length = strcspn(line, "\r\n");
+        while (length > 0 && isspace((unsigned char)line[length - 1]))
+            length--;
+        line[length] = '\0';
+        if (length == 0 || line[0] == '#')
+            continue;
+
+        // a sample number or a name as the listing shows it
+        uint32_t index = UINT32_MAX;
+        if (strspn(line, "0123456789") == length)
+            index = (uint32_t)atoi(line);
+        for (uint32_t i = 0; i < sc->sampleCount && index == UINT32_MAX; ++i)
+        {
+            if (strcmp(sc->samples[i]->name, line) == 0)
+                index = i;
+        }
+        if (index >= sc->sampleCount)
+        {
+            printf(MAGENTA "\t\tWARNING: Preload list names %s, no sample by that name\n" RESET, line);
+            continue;
+        }
+        sample_request(sc, (uint16_t)index);
+    }
+    fclose(file);
+    return true;
+}
+
+void sample_load_report(SoundController* sc)
+{
+    SampleLoader* loader = sc->loader;
+    if (loader == NULL)
+        return;
+    for (uint32_t i = 0; i < sc->sampleCount; ++i)
+    {
+        uint8_t state = atomic_load_explicit(&sc->samples[i]->state, memory_order_acquire);
+        if (state == loader->reported[i] || (state != SAMPLE_READY && state != SAMPLE_FAILED))
+            continue;
+        loader->reported[i] = state;
+        if (state == SAMPLE_READY)
+            printf(BOLD_GREEN "\t\tSample %u %s loaded\n" RESET, i, sc->samples[i]->name);
+        else
+            printf(MAGENTA "\t\tWARNING: Sample %u %s failed to load, launches of it are dropped\n" RESET, i, sc->samples[i]->name);
+    }
+    uint32_t dropped = atomic_exchange_explicit(&loader->launchesDropped, 0, memory_order_relaxed);
+    if (dropped > 0)
+        printf(MAGENTA "\t\tWARNING: %u launches dropped, too many waiting on samples still loading\n" RESET, dropped);
+}
+
+// Offline render only, holds the render until every requested sample is in so a lazy render matches an eager one
+static void sample_loads_wait(SoundController* sc)
+{
+    for (uint32_t i = 0; i < sc->sampleCount; ++i)
+    {
+        uint8_t state;
+        while ((state = atomic_load_explicit(&sc->samples[i]->state, memory_order_acquire)) == SAMPLE_QUEUED || state == SAMPLE_LOADING)
+            usleep(1000);
+    }
+}
+
+/* Disk streaming */
+
+// The stream decoders read through plain file descriptors so the kernel can be told the file is read
+// front to back and asked to have the next STREAM_READAHEAD_BYTES in the page cache before the decoder gets there
+typedef struct
+{
+    int fd;
+    off_t advised;  // read ahead asked for up to here
+} StreamFile;
+
+static ma_result stream_vfs_open(ma_vfs* pVFS, const char* pFilePath, ma_uint32 openMode, ma_vfs_file* pFile)
+{
+    (void)pVFS;
+    if (openMode & MA_OPEN_MODE_WRITE)
+        return MA_INVALID_OPERATION;
+    int fd = open(pFilePath, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return MA_DOES_NOT_EXIST;
+    StreamFile* file = malloc(sizeof(StreamFile));
+    if (file == NULL)
+    {
+        close(fd);
+        return MA_OUT_OF_MEMORY;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    posix_fadvise(fd, 0, STREAM_READAHEAD_BYTES, POSIX_FADV_WILLNEED);
+    file->fd = fd;
+    file->advised = STREAM_READAHEAD_BYTES;
+    *pFile = file;
+    return MA_SUCCESS;
+}
+
+static ma_result stream_vfs_close(ma_vfs* pVFS, ma_vfs_file pFile)
+{
+    (void)pVFS;
+    StreamFile* file = pFile;
+    close(file->fd);
+    free(file);
+    return MA_SUCCESS;
+}
+
+static ma_result stream_vfs_read(ma_vfs* pVFS, ma_vfs_file pFile, void* pDst, size_t sizeInBytes, size_t* pBytesRead)
+{
+    (void)pVFS;
+    StreamFile* file = pFile;
+    size_t done = 0;
+    while (done < sizeInBytes)
+    {
+        ssize_t got = read(file->fd, (char*)pDst + done, sizeInBytes - done);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            break;
+        done += (size_t)got;
+    }
+    if (pBytesRead != NULL)
+        *pBytesRead = done;
+
+    // topping the read ahead up once the decoder is half way through what was asked for
+    off_t position = lseek(file->fd, 0, SEEK_CUR);
+    if (position + STREAM_READAHEAD_BYTES / 2 > file->advised)
+    {
+        posix_fadvise(file->fd, position, STREAM_READAHEAD_BYTES, POSIX_FADV_WILLNEED);
+        file->advised = position + STREAM_READAHEAD_BYTES;
+    }
+    if (done == sizeInBytes)
+        return MA_SUCCESS;
+    return done == 0 ? MA_AT_END : MA_SUCCESS;
+}
+
+static ma_result stream_vfs_seek(ma_vfs* pVFS, ma_vfs_file pFile, ma_int64 offset, ma_seek_origin origin)
+{
+    (void)pVFS;
+    StreamFile* file = pFile;
+    int whence = origin == ma_seek_origin_start ? SEEK_SET : origin == ma_seek_origin_current ? SEEK_CUR : SEEK_END;
+    off_t position = lseek(file->fd, offset, whence);
+    if (position < 0)
+        return MA_BAD_SEEK;
+    // a seek back to the head starts the read ahead again from there
+    if (position + STREAM_READAHEAD_BYTES < file->advised)
+        file->advised = position;
+    return MA_SUCCESS;
+}
+
+static ma_result stream_vfs_tell(ma_vfs* pVFS, ma_vfs_file pFile, ma_int64* pCursor)
+{
+    (void)pVFS;
+    StreamFile* file = pFile;
+    off_t position = lseek(file->fd, 0, SEEK_CUR);
+    if (position < 0)
+        return MA_ERROR;
+    *pCursor = position;
+    return MA_SUCCESS;
+}
+
+static ma_result stream_vfs_info(ma_vfs* pVFS, ma_vfs_file pFile, ma_file_info* pInfo)
+{
+    (void)pVFS;
+    StreamFile* file = pFile;
+    struct stat info;
+    if (fstat(file->fd, &info) != 0)
+        return MA_ERROR;
+    pInfo->sizeInBytes = info.st_size;
+    return MA_SUCCESS;
+}
+
+static ma_vfs_callbacks streamVfs = {
+    .onOpen = stream_vfs_open,
+    .onOpenW = NULL,
+    .onClose = stream_vfs_close,
+    .onRead = stream_vfs_read,
+    .onWrite = NULL,
+    .onSeek = stream_vfs_seek,
+    .onTell = stream_vfs_tell,
+    .onInfo = stream_vfs_info,
+};
+
+/* Stream thread side. Fills one chunk of the ring, never past where the audio thread last said it had
+read to less the guard, and returns whether there was anything to do. A stream frame is the sample frame
+it wraps around to for a loop, and silence past the end for a one shot. The head is copied out of the
+sample rather than decoded, so the decoder only seeks on a loop wrap */
+static bool stream_ring_service(SampleStreamer* streamer, StreamRing* ring)
+{
+    uint32_t state = atomic_load_explicit(&ring->state, memory_order_acquire);
+    if (state == STREAM_RING_FREE)
+        return false;
+    if (state == STREAM_RING_RETIRED)
+    {
+        if (ring->decoderOpen)
+            ma_decoder_uninit(&ring->decoder);
+        ring->decoderOpen = false;
+        atomic_store_explicit(&ring->state, STREAM_RING_FREE, memory_order_release);
+        return true;
+    }
+
+    uint64_t written = atomic_load_explicit(&ring->written, memory_order_relaxed);
+    uint64_t target = atomic_load_explicit(&ring->read, memory_order_acquire) + STREAM_RING_FRAMES - STREAM_GUARD_FRAMES;
+    if (written >= target)
+        return false;
+
+    uint8_t channelCount = streamer->channelCount;
+    uint32_t at = written % STREAM_RING_FRAMES;
+    uint64_t frames = target - written;
+    if (frames > STREAM_CHUNK_FRAMES)
+        frames = STREAM_CHUNK_FRAMES;
+    if (frames > STREAM_RING_FRAMES - at)
+        frames = STREAM_RING_FRAMES - at;
+    float* out = ring->buffer + (size_t)at * channelCount;
+    uint64_t position = ring->oneShot ? written : written % ring->loopFrames;
+    if (position >= ring->loopFrames)
+        memset(out, 0, frames * channelCount * sizeof(float));
+    else
+    {
+        if (frames > ring->loopFrames - position)
+            frames = ring->loopFrames - position;
+        if (position < STREAM_HEAD_FRAMES)
+        {
+            if (frames > STREAM_HEAD_FRAMES - position)
+                frames = STREAM_HEAD_FRAMES - position;
+            memcpy(out, ring->sample->buffer + position * channelCount, frames * channelCount * sizeof(float));
+        }
+        else
+        {
+            ma_uint64 got = 0;
+            if (!ring->decoderOpen)
+            {
+                ma_decoder_config config = ma_decoder_config_init(ma_format_f32, channelCount, streamer->sampleRate);
+                ring->decoderOpen = ma_decoder_init_vfs((ma_vfs*)&streamVfs, ring->sample->path, &config, &ring->decoder) == MA_SUCCESS;
+                ring->decoderFrame = 0;
+                if (!ring->decoderOpen)
+                    atomic_fetch_add_explicit(&streamer->failures, 1, memory_order_relaxed);
+            }
+            if (ring->decoderOpen && ring->decoderFrame != position)
+            {
+                if (ma_decoder_seek_to_pcm_frame(&ring->decoder, position) == MA_SUCCESS)
+                    ring->decoderFrame = position;
+                else
+                    atomic_fetch_add_explicit(&streamer->failures, 1, memory_order_relaxed);
+            }
+            if (ring->decoderOpen && ring->decoderFrame == position)
+            {
+                ma_decoder_read_pcm_frames(&ring->decoder, out, frames, &got);
+                ring->decoderFrame += got;
+            }
+            // a file that's gone or shorter than it said plays silence rather than stalling the ring
+            if (got < frames)
+                memset(out + got * channelCount, 0, (frames - got) * channelCount * sizeof(float));
+        }
+    }
+    atomic_store_explicit(&ring->written, written + frames, memory_order_release);
+    return true;
+}
+
+// Each thread goes round its rings a chunk at a time, sleeping once none of them need anything
+static void* stream_thread_run(void* arg)
+{
+    StreamThread* thread = arg;
+    SampleStreamer* streamer = thread->streamer;
+    while (!atomic_load_explicit(&streamer->stop, memory_order_relaxed))
+    {
+        bool busy = false;
+        for (uint32_t i = thread->index; i < STREAM_RINGS; i += thread->stride)
+            busy |= stream_ring_service(streamer, &streamer->rings[i]);
+        if (!busy)
+            usleep(STREAM_POLL_MICROSECONDS);
+    }
+    return NULL;
+}
+
+static void stream_threads_stop(SampleStreamer* streamer)
+{
+    atomic_store_explicit(&streamer->stop, true, memory_order_relaxed);
+    for (uint8_t i = 0; i < streamer->threadCount; ++i)
+        pthread_join(streamer->threads[i], NULL);
+    streamer->threadCount = 0;
+}
+
+// Fills every ring as far as it will go on the calling thread, for when the threads aren't running
+static void stream_rings_fill(SampleStreamer* streamer)
+{
+    bool busy = true;
+    while (busy)
+    {
+        busy = false;
+        for (uint32_t i = 0; i < STREAM_RINGS; ++i)
+            busy |= stream_ring_service(streamer, &streamer->rings[i]);
+    }
+}
+
+static SampleStreamer* sample_streamer_init(Arena* arena, uint32_t sampleRate, uint8_t channelCount)
+{
+    SampleStreamer* streamer = arena_alloc(arena, sizeof(SampleStreamer), NULL);
+    memset(streamer, 0, sizeof(SampleStreamer));
+    streamer->sampleRate = sampleRate;
+    streamer->channelCount = channelCount;
+    for (uint32_t i = 0; i < STREAM_RINGS; ++i)
+    {
+        StreamRing* ring = &streamer->rings[i];
+        ring->buffer = arena_alloc(arena, sizeof(float) * STREAM_RING_FRAMES * channelCount, NULL);
+        assert(ring->buffer != NULL && "ERROR stream ring allocation failed");
+        atomic_init(&ring->state, STREAM_RING_FREE);
+        atomic_init(&ring->written, 0);
+        atomic_init(&ring->read, 0);
+    }
+    atomic_init(&streamer->stop, false);
+    atomic_init(&streamer->underruns, 0);
+    atomic_init(&streamer->ringsMissed, 0);
+    atomic_init(&streamer->failures, 0);
+    for (uint8_t i = 0; i < STREAM_THREADS; ++i)
+    {
+        streamer->threadArgs[i] = (StreamThread){ .streamer = streamer, .index = i, .stride = STREAM_THREADS };
+        if (pthread_create(&streamer->threads[i], NULL, stream_thread_run, &streamer->threadArgs[i]) != 0)
+            break;
+        streamer->threadCount = i + 1;
+    }
+    // the rings are split between the threads by index, short of threads one takes them all
+    if (streamer->threadCount < STREAM_THREADS)
+    {
+        stream_threads_stop(streamer);
+        atomic_store_explicit(&streamer->stop, false, memory_order_relaxed);
+        streamer->threadArgs[0] = (StreamThread){ .streamer = streamer, .index = 0, .stride = 1 };
+        if (pthread_create(&streamer->threads[0], NULL, stream_thread_run, &streamer->threadArgs[0]) == 0)
+            streamer->threadCount = 1;
+        else
+            printf(MAGENTA "\t\tWARNING: Couldn't start a stream thread, streamed samples won't play past their head\n" RESET);
+    }
+    return streamer;
+}
+
+static void sample_streamer_destroy(SampleStreamer* streamer)
+{
+    stream_threads_stop(streamer);
+    for (uint32_t i = 0; i < STREAM_RINGS; ++i)
+    {
+        if (streamer->rings[i].decoderOpen)
+            ma_decoder_uninit(&streamer->rings[i].decoder);
+        streamer->rings[i].decoderOpen = false;
+    }
+}
+
+/* Audio thread side */
+
+static void voice_stream_detach(VoicePool* pool, uint16_t voice)
+{
+    StreamRing* ring = pool->streams[voice];
+    if (ring == NULL)
+        return;
+    atomic_store_explicit(&ring->state, STREAM_RING_RETIRED, memory_order_release);
+    pool->streams[voice] = NULL;
+}
+
+// Run after voice_start. Points a voice on a streamed sample at a ring with the head already in it, with
+// no ring free the voice keeps to the resident head as a one shot, so it plays that much and stops
+static void voice_stream_attach(VoicePool* pool, uint16_t voice, uint8_t channelCount)
+{
+    voice_stream_detach(pool, voice);
+    Voice* v = &pool->voices[voice];
+    const Sample* sample = v->sample;
+    if (sample->path == NULL)
+        return;
+
+    SampleStreamer* streamer = pool->streamer;
+    StreamRing* ring = NULL;
+    for (uint32_t i = 0; i < STREAM_RINGS && ring == NULL; ++i)
+    {
+        if (atomic_load_explicit(&streamer->rings[i].state, memory_order_acquire) == STREAM_RING_FREE)
+            ring = &streamer->rings[i];
+    }
+    if (ring == NULL)
+    {
+        atomic_fetch_add_explicit(&streamer->ringsMissed, 1, memory_order_relaxed);
+        v->length = STREAM_HEAD_FRAMES;
+        v->oneShot = true;
+        return;
+    }
+
+    memcpy(ring->buffer, sample->buffer, sizeof(float) * STREAM_HEAD_FRAMES * channelCount);
+    ring->sample = sample;
+    ring->loopFrames = v->length;
+    ring->oneShot = v->oneShot;
+    ring->wraps = 0;
+    atomic_store_explicit(&ring->written, STREAM_HEAD_FRAMES, memory_order_relaxed);
+    atomic_store_explicit(&ring->read, 0, memory_order_relaxed);
+    atomic_store_explicit(&ring->state, STREAM_RING_STREAMING, memory_order_release);
+    pool->streams[voice] = ring;
+
+    // the ring is only ever played as a loop, the one shot ending is kept track of by stream_rings_update
+    v->buffer = ring->buffer;
+    v->length = STREAM_RING_FRAMES;
+    v->oneShot = false;
+}
+
+
+static void voice_pool_init(VoicePool* pool, Arena* arena, uint16_t capacity)
+{
+    // the arena only aligns to 32 bytes, lining the voices up with cache lines by hand
+    uintptr_t voices = (uintptr_t)arena_alloc(arena, sizeof(Voice) * capacity + 63, NULL);
+    pool->voices = (Voice*)((voices + 63) & ~(uintptr_t)63);
+    memset(pool->voices, 0, sizeof(Voice) * capacity);
+    pool->slots = arena_alloc(arena, sizeof(VoiceSlot) * capacity, NULL);
+    pool->stretch = arena_alloc(arena, sizeof(VoiceStretch) * capacity, NULL);
+    memset(pool->stretch, 0, sizeof(VoiceStretch) * capacity);
+    pool->streams = arena_alloc(arena, sizeof(StreamRing*) * capacity, NULL);
+    memset(pool->streams, 0, sizeof(StreamRing*) * capacity);
+    pool->streamer = NULL;
+    pool->live = arena_alloc(arena, sizeof(uint16_t) * capacity, NULL);
+    pool->capacity = capacity;
+    pool->liveCount = 0;
+    for (uint16_t i = 0; i < capacity; ++i)
+    {
+        memset(&pool->slots[i], 0, sizeof(VoiceSlot));
+        pool->slots[i].nextFree = i + 1 < capacity ? i + 1 : VOICE_NONE;
+    }
+    pool->freeHead = 0;
+    for (uint32_t i = 0; i < MAX_CHANNELS; ++i)
+        pool->channelVoice[i] = VOICE_NONE;
+}
+
+static void voice_sinc_table_init(void);
+SoundController* sound_controller_init(float bpm, const char* loadDirectory, uint8_t beatsPerBar, uint8_t barsPerLoop, uint16_t sampleRate, uint8_t channelCount, ma_format format, uint8_t synthMax, uint16_t voiceMax, MIDI_Controller* midiController, bool lazyLoad, Sample_Format storage)
+{
+    DIR *dir;
+    struct dirent *entry;
+
+    dir = opendir(loadDirectory);
+
+    // first counting how many samples
+    uint16_t sampleCount = 0;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (sample_file_listed(entry->d_name))
+            sampleCount++;
+    }
+    rewinddir(dir);
+
+    Arena* arena = arena_init(ARENA_BLOCK_SIZE, 32, false);
+    SoundController* sController = arena_alloc(arena, sizeof(SoundController), NULL);
+    memset(sController, 0, sizeof(SoundController));
+    sController->arena = arena;
+    sController->midiController = midiController == NULL ? NULL : midiController;
+    sController->sampleCount = sampleCount;
+    sController->bpm = bpm;
+    sController->loopFrameLength = 0;
+    sController->loadArenaCount = 0;
+    sController->globalCursor = 0;
+    sController->beatCount = 0;
+    sController->loopCount = 0;
+    sController->displayedBeat = 0;
+    atomic_init(&sController->transport, 0);
+    for (uint8_t i = 0; i < MAX_CHANNELS; ++i)
+    {
+        atomic_init(&sController->channels.sample[i], VOICE_NONE);
+        atomic_init(&sController->channels.volume[i], 0);
+        atomic_init(&sController->channels.rate[i], VOICE_RATE_ONE);
+    }
+    atomic_init(&sController->channels.oneShots, 0);
+    atomic_init(&sController->channels.live, 0);
+    memset(&sController->beatGrid, 0, sizeof(TransportGrid));
+    memset(&sController->tickGrid, 0, sizeof(TransportGrid));
+    sController->channelCount = channelCount;
+    sController->sampleRate = sampleRate;
+    sController->transportFrame = 0;
+    sController->tempo = (TempoState){ .bpm = bpm, .step = VOICE_TEMPO_ONE };
+    atomic_init(&sController->tempoBpm, bpm);
+    atomic_init(&sController->stretchNanoseconds, 0);
+    atomic_init(&sController->stretchFrames, 0);
+    atomic_init(&sController->stretchPeak, 0);
+    sController->stretchBlock = 0;
+    sController->timing = arena_alloc(arena, sizeof(CallbackTiming), NULL);
+    memset(sController->timing, 0, sizeof(CallbackTiming));
+    assert(voiceMax > 0 && voiceMax < VOICE_NONE && "ERROR voice max out of range");
+    voice_pool_init(&sController->voices, arena, voiceMax);
+    voice_sinc_table_init();
+    sController->voiceJobs = arena_alloc(arena, sizeof(VoiceJob) * voiceMax, NULL);
+    sController->stealPolicy = VOICE_STEAL_OLDEST;
+    sController->samples = arena_alloc(arena, sizeof(Sample*) * sampleCount, NULL);
+    sController->scheduler = arena_alloc(arena, sizeof(EventScheduler), NULL);
+    memset(sController->scheduler, 0, sizeof(EventScheduler));
+    atomic_init(&sController->commandsEarly, 0);
+    sController->commandBatch = arena_alloc(arena, sizeof(VoiceCommand) * MIX_SNAPSHOT_MAX_COMMANDS, NULL);
+    sController->commandBatchCount = 0;
+    sController->mixVersion = 0;
+    sController->mixLive = NULL;
+    atomic_init(&sController->mixPending, NULL);
+    for (uint32_t j = 0; j < MAX_CHANNELS; ++j)
+        sController->routing.channels[j] = (MixChannel){ .gain = 1.0f, .pan = 0.0f, .group = 0 };
+    for (uint32_t j = 0; j < MIX_GROUP_COUNT; ++j)
+        sController->routing.groupGain[j] = 1.0f;
+    sController->routing.masterGain = 1.0f;
+    sController->routing.limiterCeiling = LIMITER_CEILING_DEFAULT;
+    sController->routing.softClip = false;
+    sController->limiter.delay = arena_alloc(arena, sizeof(float) * 3 * LIMITER_BLOCK_FRAMES * channelCount, NULL);
+    memset(sController->limiter.delay, 0, sizeof(float) * 3 * LIMITER_BLOCK_FRAMES * channelCount);
+    sController->limiter.position = 0;
+    sController->limiter.block = 0;
+    sController->limiter.peak = 0.0f;
+    sController->limiter.required = 1.0f;
+    sController->limiter.gainStart = 1.0f;
+    sController->limiter.gainEnd = 1.0f;
+    sController->workers = NULL;
+    sController->realtime = (RealtimeConfig){ .enabled = false, .priority = 0, .cpu = -1 };
+    atomic_init(&sController->realtimeStatus, 0);
+    sController->realtimeFifoError = 0;
+    sController->realtimeAffinityError = 0;
+    sController->realtimeReported = false;
+    sController->limiter.release = 1.0f - expf(-(float)LIMITER_BLOCK_FRAMES / (LIMITER_RELEASE_TIME * sampleRate));
+    sController->busScratch = arena_alloc(arena, sizeof(float) * MIX_GROUP_COUNT * MIX_BUS_FRAMES * channelCount, NULL);
+    sController->mixPool = arena_alloc(arena, sizeof(MixSnapshot) * MIX_SNAPSHOT_POOL_SIZE, NULL);
+    for (uint32_t j = 0; j < MIX_SNAPSHOT_POOL_SIZE; ++j)
+    {
+        MixSnapshot* snapshot = &sController->mixPool[j];
+        atomic_init(&snapshot->state, MIX_SNAPSHOT_FREE);
+        snapshot->version = 0;
+        snapshot->commandCount = 0;
+        snapshot->synthCount = 0;
+        snapshot->synth = synthMax > 0 ? arena_alloc(arena, sizeof(Synth*) * synthMax, NULL) : NULL;
+        snapshot->synthVolume = synthMax > 0 ? arena_alloc(arena, sizeof(float) * synthMax, NULL) : NULL;
+    }
+
+    SampleStretchQueue* stretch = arena_alloc(arena, sizeof(SampleStretchQueue), NULL);
+    stretch->jobs = arena_alloc(arena, sizeof(SampleStretchJob) * (sampleCount > 0 ? sampleCount : 1), NULL);
+    atomic_init(&stretch->count, 0);
+    atomic_init(&stretch->next, 0);
+    snprintf(stretch->directory, sizeof(stretch->directory), "%s" STRETCH_CACHE_DIRECTORY, loadDirectory);
+    if (mkdir(stretch->directory, 0755) != 0 && errno != EEXIST)
+    {
+        printf(MAGENTA "\t\tWARNING: Couldn't make stretch cache %s, stretched samples won't be kept\n" RESET, stretch->directory);
+        stretch->directory[0] = '\0';
+    }
+    char cacheDirectory[512];
+    snprintf(cacheDirectory, sizeof(cacheDirectory), "%s" SAMPLE_CACHE_DIRECTORY, loadDirectory);
+    if (mkdir(cacheDirectory, 0755) != 0 && errno != EEXIST)
+    {
+        printf(MAGENTA "\t\tWARNING: Couldn't make sample cache %s, every start decodes the samples again\n" RESET, cacheDirectory);
+        cacheDirectory[0] = '\0';
+    }
+
+    sController->loopFrameLength = calculate_loop_frames(bpm, sampleRate, beatsPerBar, barsPerLoop);
+    SampleLoadQueue load = { .count = 0, .stretch = stretch, .cacheDirectory = cacheDirectory, .bpm = bpm, .sampleRate = sampleRate, .channelCount = channelCount, .storage = storage };
+    atomic_init(&load.next, 0);
+    atomic_init(&load.done, 0);
+    load.jobs = malloc(sizeof(SampleLoadJob) * (sampleCount > 0 ? sampleCount : 1));
+    assert(load.jobs != NULL && "ERROR load job allocation failed");
+    while ((entry = readdir(dir)) != NULL && load.count < sampleCount)
+    {
+        if (sample_file_listed(entry->d_name))
+        {
+            SampleLoadJob* job = &load.jobs[load.count++];
+            snprintf(job->path, sizeof(job->path), "%s%s", loadDirectory, entry->d_name);
+            snprintf(job->name, sizeof(job->name), "%s", entry->d_name);
+            job->sample = NULL;
+        }
+    }
+    // sorted by name so a sample keeps its number from one load to the next
+    qsort(load.jobs, load.count, sizeof(SampleLoadJob), sample_load_job_compare);
+    switch(format)
+    {
+    case 5:
+        if (!lazyLoad)
+        {
+            sample_load_queue_run(sController, &load);
+            break;
+        }
+        printf(BOLD_CYAN "Indexing %u samples, each loads the first time it's asked for\n" RESET, load.count);
+        for (uint32_t j = 0; j < load.count; ++j)
+        {
+            SampleLoadJob* job = &load.jobs[j];
+            job->sample = sample_index(arena, bpm, job->path, sampleRate, channelCount, sample_source_bpm(job->path));
+            if (job->sample != NULL)
+                sample_name_set(job->sample, job->name);
+        }
+        break;
+    default:
+        assert(false && "given format invalid\n");
+    }
+    // gathered in name order, files that failed to load are left out
+    sController->sampleCount = 0;
+    for (uint32_t j = 0; j < load.count; ++j)
+    {
+        if (load.jobs[j].sample == NULL)
+            continue;
+        load.jobs[j].sample->index = sController->sampleCount;
+        sController->samples[sController->sampleCount++] = load.jobs[j].sample;
+    }
+    if (lazyLoad)
+        sController->loader = sample_loader_init(sController, &load, stretch->directory);
+    free(load.jobs);
+
+    sample_stretch_queue_run(stretch, bpm);
+    for (uint32_t j = 0; j < sController->sampleCount && sController->voices.streamer == NULL; ++j)
+    {
+        if (sController->samples[j]->path != NULL)
+            sController->voices.streamer = sample_streamer_init(arena, sampleRate, channelCount);
+    }
+    sController->tempo.baseLoopFrameLength = sController->loopFrameLength;
+
+    char formatStr[48];
+    switch(format)
+    {
+    case 5:
+        strcpy(formatStr, "32-bit float");
+        break;
+    default:
+        assert(false && "given format invalid\n");
+    }
+    if (storage == SAMPLE_FORMAT_S16)
+        strcat(formatStr, ", kept as 16-bit int");
+    else if (storage == SAMPLE_FORMAT_F16)
+        strcat(formatStr, ", kept as 16-bit half");
+
+    if (synthMax > 0)
+    {
+        sController->synth = arena_alloc(arena, sizeof(Synth*) * synthMax, NULL);
+        sController->synthMax = synthMax;
+        sController->synthCount = 0;
+    }
+    else
+    {
+        sController->synth = NULL;
+        sController->synthMax = 0;
+        sController->synthCount = 0;
+    }
+
+    printf(BOLD_CYAN "\nSuccessfully loading of session at %s - Sample rate: %u, Channels: %u, Format: %s, BPM: %0.2f, Beats per loop: %u (frames: %u)\n\n" RESET BOLD_MAGENTA "Memory for %u Synths\n\n"RESET BOLD_YELLOW "Samples:\n" RESET,
+           loadDirectory, sampleRate, channelCount, formatStr, sController->bpm, (beatsPerBar * barsPerLoop) /2, sController->loopFrameLength, synthMax);
+    for (uint32_t j = 0; j < sController->sampleCount; ++j)
+    {
+        printf(YELLOW "  %s (%u Sample Count - %u length in sec)" RESET, sController->samples[j]->name, sController->samples[j]->length,
+               sController->samples[j]->length / sampleRate);
+        if (sController->samples[j]->sourceBpm != 0.0f)
+            printf(YELLOW " stretched from %0.2f BPM" RESET, sController->samples[j]->sourceBpm);
+        if (sController->samples[j]->path != NULL)
+            printf(YELLOW " streamed from disk" RESET);
+        if (sController->samples[j]->channels < channelCount)
+            printf(YELLOW " kept as mono" RESET);
+        printf(YELLOW "%s\n" RESET, sample_state_describe(sController->samples[j]));
+    }
+    if (sController->voices.streamer != NULL)
+        printf(BOLD_CYAN "\nStreaming long samples through %u rings from %u threads, %u KiB read ahead\n" RESET, STREAM_RINGS,
+               sController->voices.streamer->threadCount, STREAM_READAHEAD_BYTES / 1024);
+    printf(BOLD_CYAN "\nMaster limiter lookahead: %u frames (%0.2f ms)\n" RESET, LIMITER_LATENCY_FRAMES, LIMITER_LATENCY_FRAMES * 1000.0f / sampleRate);
+    if (midiController != NULL)
+    {
+        printf(BOLD_GREEN "\nMidi Interface successfully attached. With Connection to channals:" RESET);
+        for(uint8_t i = 0; i < MIDI_MAX_CHANNELS; ++i)
+        {
+            if (midiController->active_channels & (1<<i))
+                printf(BOLD_GREEN " %u" RESET, i +1);
+        }
+        printf("\n\n");
+    }
+    closedir(dir);
+    // the callback always has a snapshot to read, even before the first command
+    mix_publish(sController);
+
+    return sController;
+}
+
+
+
+static void voice_workers_stop(VoiceWorkerPool* pool);
+void sound_controller_destroy(SoundController* sc)
+{
+    if (sc->workers != NULL)
+        voice_workers_stop(sc->workers);
+    if (sc->loader != NULL)
+        sample_loader_destroy(sc->loader);
+    if (sc->voices.streamer != NULL)
+        sample_streamer_destroy(sc->voices.streamer);
+    for (uint32_t i = 0; i < sc->sampleCount; ++i)
+        sample_cache_unmap(sc->samples[i]);
+    for (uint8_t i = 0; i < sc->loadArenaCount; ++i)
+        arena_destroy(sc->loadArenas[i]);
+    if (sc->midiController != NULL)
+        midi_controller_destrory(sc->midiController);
+    arena_destroy(sc->arena);
+}
+
+/* Mix snapshot */
+
+// Called from the control thread. Returns false if the batch is full, publish more often
+bool voice_command_push(SoundController* sc, VoiceCommand command)
+{
+    if (sc->commandBatchCount >= MIX_SNAPSHOT_MAX_COMMANDS)
+    {
+        printf(MAGENTA "\t\tWARNING: Voice command batch full, command dropped\n" RESET);
+        return false;
+    }
+
+    sc->commandBatch[sc->commandBatchCount++] = command;
+    // a lazily loaded sample starts loading as soon as something launches it
+    if (command.type == VOICE_COMMAND_LAUNCH || command.type == VOICE_COMMAND_ONE_SHOT)
+        sample_request(sc, command.sampleIndex);
+    return true;
+}
+
+// Control thread only. A snapshot the audio thread hasn't taken yet is pulled back and its commands
+// carried into the new one, so nothing is lost however often this is called
+void mix_publish(SoundController* sc)
+{
+    MixSnapshot* next = NULL;
+    for (uint32_t i = 0; i < MIX_SNAPSHOT_POOL_SIZE; ++i)
+    {
+        MixSnapshot* snapshot = &sc->mixPool[i];
+        uint32_t state = atomic_load_explicit(&snapshot->state, memory_order_acquire);
+        if (state == MIX_SNAPSHOT_RETIRED)
+        {
+            atomic_store_explicit(&snapshot->state, MIX_SNAPSHOT_FREE, memory_order_relaxed);
+            state = MIX_SNAPSHOT_FREE;
+        }
+        if (state == MIX_SNAPSHOT_FREE && next == NULL)
+            next = snapshot;
+    }
+    assert(next != NULL && "ERROR no free mix snapshot");
+
+    next->version = ++sc->mixVersion;
+    next->synthCount = sc->synthCount;
+    for (uint8_t i = 0; i < sc->synthCount; ++i)
+    {
+        next->synth[i] = sc->synth[i];
+        next->synthVolume[i] = sc->synth[i]->volume;
+    }
+    next->routing = sc->routing;
+    next->stealPolicy = sc->stealPolicy;
+
+    next->commandCount = 0;
+    MixSnapshot* pending = atomic_exchange_explicit(&sc->mixPending, NULL, memory_order_acquire);
+    if (pending != NULL)
+    {
+        memcpy(next->commands, pending->commands, sizeof(VoiceCommand) * pending->commandCount);
+        next->commandCount = pending->commandCount;
+        atomic_store_explicit(&pending->state, MIX_SNAPSHOT_FREE, memory_order_relaxed);
+    }
+    uint32_t count = sc->commandBatchCount;
+    if (next->commandCount + count > MIX_SNAPSHOT_MAX_COMMANDS)
+    {
+        printf(MAGENTA "\t\tWARNING: Mix snapshot full, %u commands dropped\n" RESET, next->commandCount + count - MIX_SNAPSHOT_MAX_COMMANDS);
+        count = MIX_SNAPSHOT_MAX_COMMANDS - next->commandCount;
+    }
+    memcpy(next->commands + next->commandCount, sc->commandBatch, sizeof(VoiceCommand) * count);
+    next->commandCount += count;
+    sc->commandBatchCount = 0;
+
+    atomic_store_explicit(&next->state, MIX_SNAPSHOT_PUBLISHED, memory_order_relaxed);
+    atomic_store_explicit(&sc->mixPending, next, memory_order_release);
+}
+
+/* Voice pool */
+
+// The voice's current level through its channel, ramps count at whichever end is louder
+static float voice_loudness(SoundController* s, uint16_t voice)
+{
+    Voice* v = &s->voices.voices[voice];
+    float volume = v->volume;
+    if (v->rampRemaining > 0 && v->rampTarget > volume)
+        volume = v->rampTarget;
+    uint8_t channel = s->voices.slots[voice].channel;
+    if (channel != VOICE_ONE_SHOT_CHANNEL && s->mixLive != NULL)
+        volume *= s->mixLive->routing.channels[channel].gain;
+    return volume;
+}
+
+static void voice_release(VoicePool* pool, uint16_t voice)
+{
+    VoiceSlot* slot = &pool->slots[voice];
+    if (slot->channel != VOICE_ONE_SHOT_CHANNEL)
+        pool->channelVoice[slot->channel] = VOICE_NONE;
+
+    // the last live voice fills the hole
+    uint16_t moved = pool->live[--pool->liveCount];
+    pool->live[slot->live] = moved;
+    pool->slots[moved].live = slot->live;
+
+    voice_stream_detach(pool, voice);
+    pool->voices[voice].sample = NULL;
+    slot->nextFree = pool->freeHead;
+    pool->freeHead = voice;
+}
+
+// Only walks the live voices when there is nothing free to take
+static uint16_t voice_steal_pick(SoundController* s)
+{
+    VoicePool* pool = &s->voices;
+    Voice_Steal_Policy policy = s->mixLive != NULL ? s->mixLive->stealPolicy : VOICE_STEAL_OLDEST;
+    uint16_t pick = pool->live[0];
+    float pickLoudness = voice_loudness(s, pick);
+    for (uint16_t i = 1; i < pool->liveCount; ++i)
+    {
+        uint16_t voice = pool->live[i];
+        VoiceSlot* slot = &pool->slots[voice];
+        VoiceSlot* picked = &pool->slots[pick];
+        bool older = slot->startFrame < picked->startFrame;
+        switch (policy)
+        {
+        case VOICE_STEAL_QUIETEST:
+        {
+            float loudness = voice_loudness(s, voice);
+            if (loudness < pickLoudness || (loudness == pickLoudness && older))
+            {
+                pick = voice;
+                pickLoudness = loudness;
+            }
+            break;
+        }
+        case VOICE_STEAL_PRIORITY:
+            if (slot->priority < picked->priority || (slot->priority == picked->priority && older))
+                pick = voice;
+            break;
+        case VOICE_STEAL_OLDEST:
+        default:
+            if (older)
+                pick = voice;
+            break;
+        }
+    }
+    return pick;
+}
+
+/* Starts the sample from the top on a voice at its own speed. The voice only points at the samples
+buffer. The transport counts a loop as length + 1 output samples, the voice plays the whole frames of
+that so a wrap never lands part way through a frame */
+static void voice_start(Voice* v, const Sample* sample, bool oneShot, uint8_t channelCount)
+{
+    v->buffer = sample->buffer;
+    v->sample = sample;
+    v->length = (sample->length + 1) / channelCount;
+    v->cursor = 0;
+    v->phase = 0;
+    v->volume = 1.0f;
+    v->rampRemaining = 0;
+    v->rate = VOICE_RATE_ONE;
+    v->rateRemaining = 0;
+    v->interpolation = VOICE_INTERPOLATION_LINEAR;
+    v->oneShot = oneShot;
+}
+
+static uint16_t voice_take(SoundController* s, const Sample* sample, uint8_t channel, uint8_t priority)
+{
+    VoicePool* pool = &s->voices;
+    if (pool->freeHead == VOICE_NONE)
+        voice_release(pool, voice_steal_pick(s));
+
+    uint16_t voice = pool->freeHead;
+    VoiceSlot* slot = &pool->slots[voice];
+    pool->freeHead = slot->nextFree;
+    slot->startFrame = s->transportFrame;
+    slot->channel = channel;
+    slot->priority = priority;
+    slot->live = pool->liveCount;
+    pool->live[pool->liveCount++] = voice;
+    if (channel != VOICE_ONE_SHOT_CHANNEL)
+        pool->channelVoice[channel] = voice;
+    voice_start(&pool->voices[voice], sample, channel == VOICE_ONE_SHOT_CHANNEL, s->channelCount);
+    voice_stream_attach(pool, voice, s->channelCount);
+    pool->stretch[voice].engaged = false;
+    return voice;
+}
+
+// Audio thread only, the pool changes under any other reader. Commands read the channel feed instead
+static Voice* voice_channel(VoicePool* pool, uint8_t channel)
+{
+    uint16_t voice = pool->channelVoice[channel];
+    return voice == VOICE_NONE ? NULL : &pool->voices[voice];
+}
+
+// Ramps are counted in output samples (frames * channels) as that is what the mixer steps through
+static void voice_ramp_start(SoundController* s, Voice* v, float target, uint32_t frames, Volume_Ramp_Type type)
+{
+    uint32_t samples = frames * s->channelCount;
+    if (samples == 0)
+    {
+        v->volume = target;
+        v->rampRemaining = 0;
+        return;
+    }
+
+    v->rampTarget = target;
+    v->rampType = type;
+    v->rampRemaining = samples;
+    if (type == VOLUME_RAMP_EXPONENTIAL)
+    {
+        // an exponential ramp can't start or end on silence, so it runs from/to the floor and snaps to the target at the end
+        float from = v->volume > VOLUME_RAMP_FLOOR ? v->volume : VOLUME_RAMP_FLOOR;
+        float to = target > VOLUME_RAMP_FLOOR ? target : VOLUME_RAMP_FLOOR;
+        v->volume = from;
+        v->rampStep = (float)pow(to / from, 1.0 / samples);
+    }
+    else
+        v->rampStep = (target - v->volume) / samples;
+}
+
+// Glides are counted in frames, the rate steps once per frame
+static void voice_rate_start(Voice* v, float rate, uint32_t frames)
+{
+    uint32_t target = (uint32_t)(rate * (double)VOICE_RATE_ONE + 0.5);
+    if (frames == 0)
+    {
+        v->rate = target;
+        v->rateRemaining = 0;
+        return;
+    }
+
+    v->rateTarget = target;
+    v->rateStep = (int32_t)(((int64_t)target - v->rate) / frames);
+    v->rateRemaining = frames;
+}
+
+// Applied on the frame the launch was quantized to, an occupied channel swaps over on the same frame.
+// The channel keeps its volume and interpolation across a swap unless the launch sets the volume, the
+// rate goes back to the new samples own speed
+static void voice_launch(SoundController* s, VoiceCommand* command)
+{
+    const Sample* sample = s->samples[command->sampleIndex];
+    uint8_t priority = command->priority != 0 ? command->priority : VOICE_PRIORITY_LOOP;
+    uint16_t voice = s->voices.channelVoice[command->channel];
+    Voice* v;
+    if (voice == VOICE_NONE)
+        v = &s->voices.voices[voice_take(s, sample, command->channel, priority)];
+    else
+    {
+        VoiceSlot* slot = &s->voices.slots[voice];
+        slot->startFrame = s->transportFrame;
+        slot->priority = priority;
+        v = &s->voices.voices[voice];
+        float volume = v->volume;
+        uint8_t interpolation = v->interpolation;
+        voice_start(v, sample, false, s->channelCount);
+        voice_stream_attach(&s->voices, voice, s->channelCount);
+        v->volume = volume;
+        v->interpolation = interpolation;
+        s->voices.stretch[voice].engaged = false;
+    }
+
+    if (command->volume != VOICE_VOLUME_UNCHANGED)
+        v->volume = command->volume;
+    if (command->rampFrames > 0)
+        voice_ramp_start(s, v, command->rampTarget, command->rampFrames, command->rampType);
+}
+
+static void voice_one_shot(SoundController* s, VoiceCommand* command)
+{
+    voice_take(s, s->samples[command->sampleIndex], VOICE_ONE_SHOT_CHANNEL, command->priority != 0 ? command->priority : VOICE_PRIORITY_ONE_SHOT);
+}
+
+static void voice_kill(SoundController* s, uint8_t channel)
+{
+    if (s->voices.channelVoice[channel] != VOICE_NONE)
+        voice_release(&s->voices, s->voices.channelVoice[channel]);
+}
+
+// Loops only, one shots play out
+static void voice_kill_all(SoundController* s)
+{
+    for (uint32_t i = 0; i < MAX_CHANNELS; ++i)
+        voice_kill(s, i);
+}
+
+static void tempo_start(SoundController* s, float bpm, uint32_t bars);
+// A launch of a sample that hasn't loaded yet waits in the scheduler's parked list instead, in the order it came
+static bool voice_command_park(SoundController* s, VoiceCommand* command)
+{
+    if (atomic_load_explicit(&s->samples[command->sampleIndex]->state, memory_order_acquire) == SAMPLE_READY)
+        return false;
+    EventScheduler* scheduler = s->scheduler;
+    if (scheduler->waitingCount < SCHEDULED_WAITING_MAX)
+        scheduler->waiting[scheduler->waitingCount++] = *command;
+    else if (s->loader != NULL)
+        atomic_fetch_add_explicit(&s->loader->launchesDropped, 1, memory_order_relaxed);
+    return true;
+}
+
+static void voice_command_apply(SoundController* s, VoiceCommand* command)
+{
+    ++s->timing->events;
+    switch (command->type)
+    {
+    case VOICE_COMMAND_LAUNCH:
+        if (!voice_command_park(s, command))
+            voice_launch(s, command);
+        break;
+    case VOICE_COMMAND_ONE_SHOT:
+        if (!voice_command_park(s, command))
+            voice_one_shot(s, command);
+        break;
+    case VOICE_COMMAND_KILL:
+        voice_kill(s, command->channel);
+        break;
+    case VOICE_COMMAND_KILL_ALL:
+        voice_kill_all(s);
+        break;
+    case VOICE_COMMAND_VOLUME:
+    {
+        Voice* v = voice_channel(&s->voices, command->channel);
+        if (v != NULL)
+        {
+            v->volume = command->volume;
+            v->rampRemaining = 0;
+        }
+        break;
+    }
+    case VOICE_COMMAND_RAMP:
+    {
+        Voice* v = voice_channel(&s->voices, command->channel);
+        if (v != NULL)
+            voice_ramp_start(s, v, command->rampTarget, command->rampFrames, command->rampType);
+        break;
+    }
+    case VOICE_COMMAND_RATE:
+    {
+        Voice* v = voice_channel(&s->voices, command->channel);
+        if (v != NULL)
+            voice_rate_start(v, command->rampTarget, command->rampFrames);
+        break;
+    }
+    case VOICE_COMMAND_INTERPOLATION:
+    {
+        Voice* v = voice_channel(&s->voices, command->channel);
+        if (v != NULL)
+            v->interpolation = command->interpolation;
+        break;
+    }
+    case VOICE_COMMAND_TEMPO:
+        tempo_start(s, command->rampTarget, command->rampFrames);
+        break;
+    }
+}
+
+static bool voice_finished(const Voice* v)
+{
+    return v->oneShot && (v->cursor >> 32) >= v->length;
+}
+
+// Run by the audio thread at the end of each period, releasing one shots that have played out
+static void one_shot_retire(SoundController* s)
+{
+    VoicePool* pool = &s->voices;
+    // walking backwards as releasing moves the last live voice into the hole
+    for (uint16_t i = pool->liveCount; i-- > 0;)
+    {
+        if (voice_finished(&pool->voices[pool->live[i]]))
+            voice_release(pool, pool->live[i]);
+    }
+}
+
+/* Run by the audio thread at the end of each period. Publishes how far into its stream each streamed voice
+has got for the stream threads to fill up to, counts the periods the cursor got near frames that weren't
+decoded yet and releases one shots that have played out */
+static void stream_rings_update(SoundController* s)
+{
+    VoicePool* pool = &s->voices;
+    if (pool->streamer == NULL)
+        return;
+    for (uint16_t i = pool->liveCount; i-- > 0;)
+    {
+        uint16_t voice = pool->live[i];
+        StreamRing* ring = pool->streams[voice];
+        if (ring == NULL)
+            continue;
+        // a period moves the cursor less than a ring, so it has wrapped when it's behind where it was
+        uint64_t read = ring->wraps * STREAM_RING_FRAMES + (pool->voices[voice].cursor >> 32);
+        if (read < atomic_load_explicit(&ring->read, memory_order_relaxed))
+        {
+            ++ring->wraps;
+            read += STREAM_RING_FRAMES;
+        }
+        atomic_store_explicit(&ring->read, read, memory_order_release);
+        if (read + STREAM_LOOKAHEAD_FRAMES > atomic_load_explicit(&ring->written, memory_order_acquire))
+            atomic_fetch_add_explicit(&pool->streamer->underruns, 1, memory_order_relaxed);
+        if (ring->oneShot && read >= ring->loopFrames)
+            voice_release(pool, voice);
+    }
+}
+
+/* Event scheduler */
+
+static bool scheduled_event_before(ScheduledEvent* a, ScheduledEvent* b)
+{
+    return a->frame < b->frame || (a->frame == b->frame && a->sequence < b->sequence);
+}
+
+// min-heap on frame, the sequence keeping commands for the same frame in the order they were sent
+static bool event_scheduler_push(EventScheduler* scheduler, uint64_t frame, VoiceCommand* command)
+{
+    if (scheduler->count >= SCHEDULED_EVENT_MAX)
+        return false;
+
+    uint32_t i = scheduler->count++;
+    ScheduledEvent event = { frame, scheduler->sequence++, *command };
+    while (i > 0)
+    {
+        uint32_t parent = (i -1) / 2;
+        if (!scheduled_event_before(&event, &scheduler->events[parent]))
+            break;
+        scheduler->events[i] = scheduler->events[parent];
+        i = parent;
+    }
+    scheduler->events[i] = event;
+    return true;
+}
+
+static void event_scheduler_pop(EventScheduler* scheduler, ScheduledEvent* event)
+{
+    *event = scheduler->events[0];
+    ScheduledEvent last = scheduler->events[--scheduler->count];
+    uint32_t i = 0;
+    while (true)
+    {
+        uint32_t child = i * 2 + 1;
+        if (child >= scheduler->count)
+            break;
+        if (child + 1 < scheduler->count && scheduled_event_before(&scheduler->events[child + 1], &scheduler->events[child]))
+            ++child;
+        if (!scheduled_event_before(&scheduler->events[child], &last))
+            break;
+        scheduler->events[i] = scheduler->events[child];
+        i = child;
+    }
+    scheduler->events[i] = last;
+}
+
+// Turning a quantize setting into the transport frame it lands on, a boundary falling on the current frame counts as now
+static uint64_t quantize_resolve(SoundController* s, Quantize quantize)
+{
+    uint64_t now = s->transportFrame;
+    uint32_t loopEnd = s->loopFrameLength + 1;
+    switch (quantize.type)
+    {
+    case QUANTIZE_BEAT:
+        if (s->globalCursor == 0)
+            return now;
+        return now + (s->beatGrid.next - s->globalCursor);
+    case QUANTIZE_BARS:
+    {
+        // bars are counted from 1, lining up every 'bars' bars with the first bar
+        uint32_t bars = quantize.bars == 0 ? 1 : quantize.bars;
+        uint64_t distance = s->globalCursor == 0 ? 0 : loopEnd - s->globalCursor;
+        uint32_t bar = s->loopCount + 1;
+        return now + distance + (uint64_t)((bars - (bar -1) % bars) % bars) * loopEnd;
+    }
+    case QUANTIZE_IMMEDIATE:
+    default:
+        return now;
+    }
+}
+
+// A command due now is applied straight away, otherwise it waits in the scheduler for its frame. If the
+// scheduler is full the command is applied now rather than lost, and counted for event_scheduler_report
+static void voice_command_schedule(SoundController* s, VoiceCommand* command)
+{
+    uint64_t frame = quantize_resolve(s, command->quantize);
+    if (frame <= s->transportFrame)
+        voice_command_apply(s, command);
+    else if (!event_scheduler_push(s->scheduler, frame, command))
+    {
+        atomic_fetch_add_explicit(&s->commandsEarly, 1, memory_order_relaxed);
+        voice_command_apply(s, command);
+    }
+}
+
+// Ran by the audio thread when it takes a new snapshot
+static void voice_commands_schedule(SoundController* s, MixSnapshot* snapshot)
+{
+    for (uint32_t i = 0; i < snapshot->commandCount; ++i)
+        voice_command_schedule(s, &snapshot->commands[i]);
+}
+
+// Audio thread, start of each period. Parked launches whose sample has loaded are quantized again from now,
+// so they come in on the next boundary, and ones whose sample failed to load are dropped
+static void voice_commands_unpark(SoundController* s)
+{
+    EventScheduler* scheduler = s->scheduler;
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < scheduler->waitingCount; ++i)
+    {
+        VoiceCommand command = scheduler->waiting[i];
+        uint8_t state = atomic_load_explicit(&s->samples[command.sampleIndex]->state, memory_order_acquire);
+        if (state == SAMPLE_FAILED)
+            continue;
+        if (state != SAMPLE_READY)
+        {
+            scheduler->waiting[kept++] = command;
+            continue;
+        }
+        voice_command_schedule(s, &command);
+    }
+    scheduler->waitingCount = kept;
+}
+
+void event_scheduler_report(SoundController* sc)
+{
+    uint32_t early = atomic_exchange_explicit(&sc->commandsEarly, 0, memory_order_relaxed);
+    if (early > 0)
+        printf(MAGENTA "\t\tWARNING: %u quantized commands applied early, too many were waiting on their frame\n" RESET, early);
+}
+
+// Audio thread, start of each period. The snapshot it was using is retired once the new one is taken,
+// from here on the callback reads nothing the control thread writes
+static MixSnapshot* mix_snapshot_acquire(SoundController* s)
+{
+    MixSnapshot* next = atomic_exchange_explicit(&s->mixPending, NULL, memory_order_acquire);
+    if (next == NULL)
+        return s->mixLive;
+
+    if (s->mixLive != NULL)
+        atomic_store_explicit(&s->mixLive->state, MIX_SNAPSHOT_RETIRED, memory_order_release);
+    atomic_store_explicit(&next->state, MIX_SNAPSHOT_LIVE, memory_order_relaxed);
+    s->mixLive = next;
+    voice_commands_schedule(s, next);
+    return next;
+}
+
+/* Transport position feed */
+
+// packed into one 64 bit word so the audio thread can publish it with a single wait-free store
+static uint64_t transport_pack(uint32_t frame, uint8_t beat, uint32_t loopCount)
+{
+    return (uint64_t)frame | ((uint64_t)beat << 32) | ((uint64_t)(loopCount & 0xFFFFFF) << 40);
+}
+
+// Starting the grid at the loop start. The loop is split into whole steps with the remainder
+// carried between steps, so the points never drift from the loop however long it plays
+static void transport_grid_reset(TransportGrid* grid, uint32_t loopEnd, uint32_t divisions)
+{
+    grid->divisions = divisions;
+    grid->step = loopEnd / divisions;
+    grid->remainder = loopEnd % divisions;
+    grid->error = 0;
+    grid->index = 0;
+    grid->next = 0;
+}
+
+static void transport_grid_advance(TransportGrid* grid, uint32_t loopEnd)
+{
+    if (++grid->index >= grid->divisions)
+    {
+        grid->next = loopEnd; // no more points until the loop comes round again
+        return;
+    }
+    grid->next += grid->step;
+    grid->error += grid->remainder;
+    if (grid->error >= grid->divisions)
+    {
+        grid->error -= grid->divisions;
+        ++grid->next;
+    }
+}
+
+// Moves the transport on by count output samples, jumping from event to event (loop start, beat, MIDI tick)
+static void transport_advance(SoundController* s, uint32_t count)
+{
+    uint32_t loopEnd = s->loopFrameLength + 1;
+    uint32_t pushed = 0;
+    while (pushed < count)
+    {
+        if (s->globalCursor == 0)
+        {
+            ++s->loopCount;
+            transport_grid_reset(&s->beatGrid, loopEnd, 4);
+            transport_grid_reset(&s->tickGrid, loopEnd, MIDI_TICKS_PER_BAR);
+        }
+        if (s->globalCursor == s->beatGrid.next)
+        {
+            s->beatCount = s->beatGrid.index + 1;
+            transport_grid_advance(&s->beatGrid, loopEnd);
+        }
+        //for MIDI_Clock
+        while (s->globalCursor == s->tickGrid.next)
+        {
+            if (s->midiController != NULL)
+            {
+                midi_command_clock(s->midiController);
+                ++s->timing->midiClocks;
+            }
+            transport_grid_advance(&s->tickGrid, loopEnd);
+        }
+
+        uint32_t nextEvent = s->beatGrid.next < s->tickGrid.next ? s->beatGrid.next : s->tickGrid.next;
+        uint32_t run = nextEvent - s->globalCursor;
+        if (count - pushed < run)
+            run = count - pushed;
+        pushed += run;
+        s->globalCursor += run;
+        if (s->globalCursor >= loopEnd)
+            s->globalCursor = 0;
+    }
+    s->transportFrame += count;
+}
+
+/* Tempo */
+
+// Loops the transport has started, the count only goes up once the loop start has been played
+static uint32_t transport_loops_started(const SoundController* s)
+{
+    return s->loopCount + (s->globalCursor == 0 ? 1 : 0);
+}
+
+// Keeps the grids place (the index of its next point) over a new loop length
+static void transport_grid_rescale(TransportGrid* grid, uint32_t loopEnd)
+{
+    if (grid->divisions == 0)
+        return;
+    grid->step = loopEnd / grid->divisions;
+    grid->remainder = loopEnd % grid->divisions;
+    if (grid->index >= grid->divisions)
+    {
+        grid->next = loopEnd;
+        return;
+    }
+    grid->next = (uint32_t)((uint64_t)grid->index * loopEnd / grid->divisions);
+    grid->error = (uint32_t)((uint64_t)grid->index * grid->remainder % grid->divisions);
+}
+
+/* Each waiting event is put back at the same place in whichever loop it falls in, so an event
+quantized to a bar still lands on the bar. The mapping can bring two events onto the same frame out of
+sequence, so the heap is rebuilt, a sorted array being a heap */
+static void event_scheduler_rescale(SoundController* s, uint32_t oldEnd, uint32_t loopEnd, uint32_t oldCursor)
+{
+    EventScheduler* scheduler = s->scheduler;
+    for (uint32_t i = 0; i < scheduler->count; ++i)
+    {
+        uint64_t at = oldCursor + (scheduler->events[i].frame - s->transportFrame);
+        uint64_t rescaled = at / oldEnd * loopEnd + at % oldEnd * loopEnd / oldEnd;
+        if (rescaled < s->globalCursor)
+            rescaled = s->globalCursor;
+        scheduler->events[i].frame = s->transportFrame + (rescaled - s->globalCursor);
+    }
+    for (uint32_t i = 1; i < scheduler->count; ++i)
+    {
+        ScheduledEvent event = scheduler->events[i];
+        uint32_t j = i;
+        for (; j > 0 && scheduled_event_before(&event, &scheduler->events[j - 1]); --j)
+            scheduler->events[j] = scheduler->events[j - 1];
+        scheduler->events[j] = event;
+    }
+}
+
+// Changes the tempo on the current frame, the transport keeps the same place in the loop
+static void transport_tempo_set(SoundController* s, float bpm)
+{
+    TempoState* tempo = &s->tempo;
+    uint32_t oldEnd = s->loopFrameLength + 1;
+    tempo->bpm = bpm;
+    s->loopFrameLength = (uint32_t)((double)tempo->baseLoopFrameLength * s->bpm / bpm);
+    uint32_t loopEnd = s->loopFrameLength + 1;
+    tempo->step = ((uint64_t)(tempo->baseLoopFrameLength + 1) << 32) / loopEnd;
+    if (loopEnd == oldEnd)
+        return;
+
+    // the fraction of a sample the cursor lands between is carried, so a long ramp doesn't drift from the voices
+    uint32_t oldCursor = s->globalCursor;
+    if (s->globalCursor != 0)
+    {
+        unsigned __int128 exact = ((unsigned __int128)s->globalCursor << 32 | tempo->cursorFraction) * loopEnd / oldEnd;
+        s->globalCursor = (uint32_t)(exact >> 32);
+        tempo->cursorFraction = (uint32_t)exact;
+        if (s->globalCursor == 0)
+            s->globalCursor = 1; // 0 would start the loop again
+    }
+    transport_grid_rescale(&s->beatGrid, loopEnd);
+    transport_grid_rescale(&s->tickGrid, loopEnd);
+    event_scheduler_rescale(s, oldEnd, loopEnd, oldCursor);
+}
+
+static void tempo_start(SoundController* s, float bpm, uint32_t bars)
+{
+    TempoState* tempo = &s->tempo;
+    if (bars == 0)
+    {
+        tempo->rampBars = 0;
+        transport_tempo_set(s, bpm);
+        return;
+    }
+    tempo->rampFrom = tempo->bpm;
+    tempo->rampTo = bpm;
+    tempo->rampBars = bars;
+    tempo->rampStartLoop = transport_loops_started(s);
+    tempo->rampStartPhase = (float)s->globalCursor / (s->loopFrameLength + 1);
+    tempo->rampNext = s->transportFrame;
+}
+
+/* Ran by the callback on rampNext, the tempo follows how far through the ramps bars the transport is.
+The last step is shortened to land on the ramps end, the tempo holding still between steps */
+static void tempo_ramp_step(SoundController* s)
+{
+    TempoState* tempo = &s->tempo;
+    double progress = (double)(transport_loops_started(s) - tempo->rampStartLoop) +
+                      (double)s->globalCursor / (s->loopFrameLength + 1) - tempo->rampStartPhase;
+    double remaining = (tempo->rampBars - progress) * (s->loopFrameLength + 1); // output samples at this tempo
+    if (remaining < 0.5)
+    {
+        tempo->rampBars = 0;
+        transport_tempo_set(s, tempo->rampTo);
+        return;
+    }
+    transport_tempo_set(s, tempo->rampFrom + (tempo->rampTo - tempo->rampFrom) * (float)(progress / tempo->rampBars));
+    remaining = (tempo->rampBars - progress) * (s->loopFrameLength + 1);
+    uint32_t step = TEMPO_RAMP_STEP_FRAMES * s->channelCount;
+    tempo->rampNext = s->transportFrame + (remaining < step ? (uint64_t)ceil(remaining - 0.5) : step);
+}
+
+void transport_position_read(SoundController* sc, TransportPosition* position)
+{
+    uint64_t packed = atomic_load_explicit(&sc->transport, memory_order_acquire);
+    position->frame = (uint32_t)packed;
+    position->beat = (uint8_t)(packed >> 32);
+    position->loopCount = (uint32_t)(packed >> 40);
+}
+
+void transport_display(SoundController* sc)
+{
+    TransportPosition position;
+    transport_position_read(sc, &position);
+    if (position.beat == 0 || position.beat == sc->displayedBeat)
+        return;
+
+    sc->displayedBeat = position.beat;
+    printf("\r    Loop %u/%u        ", position.beat, 4);
+    fflush(stdout);
+}
+
+/* Channel feed */
+
+// Audio thread, end of each period once the voices have settled
+static void channel_feed_publish(SoundController* s)
+{
+    VoicePool* pool = &s->voices;
+    ChannelFeed* feed = &s->channels;
+    for (uint8_t i = 0; i < MAX_CHANNELS; ++i)
+    {
+        uint16_t voice = pool->channelVoice[i];
+        if (voice == VOICE_NONE)
+        {
+            atomic_store_explicit(&feed->sample[i], VOICE_NONE, memory_order_relaxed);
+            continue;
+        }
+        const Voice* v = &pool->voices[voice];
+        uint32_t volume;
+        memcpy(&volume, &v->volume, sizeof(volume));
+        atomic_store_explicit(&feed->volume[i], volume, memory_order_relaxed);
+        atomic_store_explicit(&feed->rate[i], v->rate, memory_order_relaxed);
+        atomic_store_explicit(&feed->sample[i], v->sample->index, memory_order_relaxed);
+    }
+    uint16_t oneShots = 0;
+    for (uint16_t i = 0; i < pool->liveCount; ++i)
+        oneShots += pool->voices[pool->live[i]].oneShot;
+    atomic_store_explicit(&feed->oneShots, oneShots, memory_order_relaxed);
+    atomic_store_explicit(&feed->live, pool->liveCount, memory_order_relaxed);
+}
+
+// Main thread, the sample on the channel as of the last period, NULL when it's empty
+static const Sample* channel_feed_sample(SoundController* sc, uint8_t channel)
+{
+    uint16_t index = atomic_load_explicit(&sc->channels.sample[channel], memory_order_relaxed);
+    return index == VOICE_NONE ? NULL : sc->samples[index];
+}
+
+// Main thread, the channel the sample is on as of the last period, VOICE_ONE_SHOT_CHANNEL when it's on none
+static uint8_t channel_feed_find(SoundController* sc, uint16_t sampleIndex)
+{
+    for (uint8_t i = 0; i < MAX_CHANNELS; ++i)
+        if (atomic_load_explicit(&sc->channels.sample[i], memory_order_relaxed) == sampleIndex)
+            return i;
+    return VOICE_ONE_SHOT_CHANNEL;
+}
+
+/* Real-time mode */
+
+static bool denormals_flush(void)
+{
+#if defined(__SSE__)
+    _MM_SET_FLUSH_ZERO_MODE(_MM_FLUSH_ZERO_ON);
+    _MM_SET_DENORMALS_ZERO_MODE(_MM_DENORMALS_ZERO_ON);
+    return (_mm_getcsr() & 0x8040) == 0x8040;
+#else
+    return false;
+#endif
+}
+
+void realtime_setup(SoundController* sc, RealtimeConfig config)
+{
+    sc->realtime = config;
+    printf(BOLD_CYAN "Real-time mode: SCHED_FIFO priority %d, audio thread on %s%d\n" RESET, config.priority,
+           config.cpu < 0 ? "any core" : "core ", config.cpu < 0 ? 0 : config.cpu);
+
+    // the synths are generated on this thread so it gets FTZ/DAZ as well
+    if (denormals_flush())
+        printf(BOLD_GREEN "\tFTZ/DAZ set on the main thread\n" RESET);
+    else
+        printf(MAGENTA "\t\tWARNING: FTZ/DAZ not available, denormals stay on\n" RESET);
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0)
+        printf(BOLD_GREEN "\tMemory locked\n" RESET);
+    else
+        printf(MAGENTA "\t\tWARNING: mlockall failed (%s), memory can still be paged out\n" RESET, strerror(errno));
+
+    // every page the callback can reach is touched now so none of them fault on first touch there
+    long pageSize = sysconf(_SC_PAGESIZE);
+    if (pageSize <= 0)
+        pageSize = 4096;
+    size_t arenaBytes = arena_prefault(sc->arena, (size_t)pageSize);
+    SampleLoader* loader = sc->loader;
+    for (uint8_t i = 0; i < sc->loadArenaCount; ++i)
+    {
+        bool lazy = false;
+        for (uint8_t j = 0; loader != NULL && j < loader->threadCount; ++j)
+            lazy |= loader->threadArgs[j].arena == sc->loadArenas[i];
+        if (!lazy)
+            arenaBytes += arena_prefault(sc->loadArenas[i], (size_t)pageSize);
+    }
+    if (loader != NULL)
+    {
+        // the loader threads grow their arenas while loading, so each one is walked between loads. A load
+        // finishing after its walk sees the page size and prefaults its own arena and cache pages
+        atomic_store_explicit(&loader->prefaultPage, (size_t)pageSize, memory_order_release);
+        for (uint8_t i = 0; i < loader->threadCount; ++i)
+        {
+            pthread_mutex_lock(&loader->threadArgs[i].mutex);
+            arenaBytes += arena_prefault(loader->threadArgs[i].arena, (size_t)pageSize);
+            pthread_mutex_unlock(&loader->threadArgs[i].mutex);
+        }
+    }
+    size_t mappedBytes = 0;
+    for (uint16_t i = 0; i < sc->sampleCount; ++i)
+    {
+        if (atomic_load_explicit(&sc->samples[i]->state, memory_order_acquire) == SAMPLE_READY)
+            mappedBytes += sample_cache_prefault(sc->samples[i], (size_t)pageSize);
+    }
+    printf(BOLD_GREEN "\tPrefaulted %zu KB of arenas and %zu KB of mapped samples\n" RESET, arenaBytes / 1024, mappedBytes / 1024);
+    if (loader != NULL)
+        printf(BOLD_GREEN "\tSamples loaded from here on are prefaulted by the loader threads\n" RESET);
+}
+
+// audio thread, first callback only. Nothing printed here, realtime_report does that
+static void realtime_audio_thread_setup(SoundController* s)
+{
+    uint32_t status = REALTIME_STATUS_DONE;
+    if (denormals_flush())
+        status |= REALTIME_STATUS_FTZ_DAZ;
+
+    struct sched_param param = { .sched_priority = s->realtime.priority };
+    s->realtimeFifoError = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (s->realtimeFifoError == 0)
+        status |= REALTIME_STATUS_FIFO;
+
+    if (s->realtime.cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(s->realtime.cpu, &set);
+        s->realtimeAffinityError = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set);
+        if (s->realtimeAffinityError == 0)
+            status |= REALTIME_STATUS_AFFINITY;
+    }
+    atomic_store_explicit(&s->realtimeStatus, status, memory_order_release);
+}
+
+void realtime_report(SoundController* sc)
+{
+    if (!sc->realtime.enabled || sc->realtimeReported)
+        return;
+    uint32_t status = atomic_load_explicit(&sc->realtimeStatus, memory_order_acquire);
+    if (!(status & REALTIME_STATUS_DONE))
+        return;
+
+    sc->realtimeReported = true;
+    if (status & REALTIME_STATUS_FTZ_DAZ)
+        printf(BOLD_GREEN "\tFTZ/DAZ set on the audio thread\n" RESET);
+    else
+        printf(MAGENTA "\t\tWARNING: FTZ/DAZ not available on the audio thread\n" RESET);
+    if (status & REALTIME_STATUS_FIFO)
+        printf(BOLD_GREEN "\tAudio thread running SCHED_FIFO at priority %d\n" RESET, sc->realtime.priority);
+    else
+        printf(MAGENTA "\t\tWARNING: SCHED_FIFO failed (%s), audio thread left at normal priority\n" RESET, strerror(sc->realtimeFifoError));
+    if (sc->realtime.cpu >= 0)
+    {
+        if (status & REALTIME_STATUS_AFFINITY)
+            printf(BOLD_GREEN "\tAudio thread pinned to core %d\n" RESET, sc->realtime.cpu);
+        else
+            printf(MAGENTA "\t\tWARNING: Pinning the audio thread to core %d failed (%s)\n" RESET, sc->realtime.cpu, strerror(sc->realtimeAffinityError));
+    }
+}
+
+/* Mixer implmentation */
+
+// out[i] += in[i] * volume over a contiguous block. The multiply and add are kept as seperate
+// instructions (no fma) so the block mixer stays bit-compatible with summing sample by sample
+static void mix_block_f32(float* out, const float* in, uint32_t count, float volume)
+{
+    uint32_t i = 0;
+#if defined(__AVX__)
+    __m256 volume8 = _mm256_set1_ps(volume);
+    for (; i + 8 <= count; i += 8)
+        _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_loadu_ps(out + i), _mm256_mul_ps(_mm256_loadu_ps(in + i), volume8)));
+#endif
+#if defined(__SSE__)
+    __m128 volume4 = _mm_set1_ps(volume);
+    for (; i + 4 <= count; i += 4)
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(_mm_loadu_ps(in + i), volume4)));
+#endif
+    for (; i < count; ++i)
+        out[i] += in[i] * volume;
+}
+
+// Same as mix_block_f32 with gainEven on even samples and gainOdd on odd ones, the left and right gains
+// for stereo. Still one multiply and one add per sample
+static void mix_block_pair_f32(float* out, const float* in, uint32_t count, float gainEven, float gainOdd)
+{
+    uint32_t i = 0;
+#if defined(__AVX__)
+    __m256 gain8 = _mm256_setr_ps(gainEven, gainOdd, gainEven, gainOdd, gainEven, gainOdd, gainEven, gainOdd);
+    for (; i + 8 <= count; i += 8)
+        _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_loadu_ps(out + i), _mm256_mul_ps(_mm256_loadu_ps(in + i), gain8)));
+#endif
+#if defined(__SSE__)
+    __m128 gain4 = _mm_setr_ps(gainEven, gainOdd, gainEven, gainOdd);
+    for (; i + 4 <= count; i += 4)
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(_mm_loadu_ps(in + i), gain4)));
+#endif
+    for (; i < count; ++i)
+        out[i] += in[i] * ((i & 1) ? gainOdd : gainEven);
+}
+
+// Same as mix_block_pair_f32 straight from a packed buffer, from first, each sample converted as it loads
+static void mix_block_pair_packed(float* out, const void* in, size_t first, uint32_t count, uint8_t format, float gainEven, float gainOdd)
+{
+    uint32_t i = 0;
+#if defined(__AVX2__)
+    __m256 gain8 = _mm256_setr_ps(gainEven, gainOdd, gainEven, gainOdd, gainEven, gainOdd, gainEven, gainOdd);
+    for (; i + 8 <= count; i += 8)
+        _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_loadu_ps(out + i), _mm256_mul_ps(sample_load8_f32(in, first + i, format), gain8)));
+#endif
+    for (; i < count; ++i)
+        out[i] += sample_read(in, first + i, format) * ((i & 1) ? gainOdd : gainEven);
+}
+
+#if defined(__AVX2__)
+// Whole mono frames from sample i on, 4 a vector widened to both sides. Written out per format by the caller
+// so the format isn't switched on for every load
+static inline uint32_t mix_block_mono_frames(float* out, const void* in, size_t first, uint32_t i, uint32_t count, uint8_t format, __m256 gain8)
+{
+    __m256i widen = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 frames = _mm256_permutevar8x32_ps(_mm256_castps128_ps256(sample_load4_f32(in, (first + i) / 2, format)), widen);
+        _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_loadu_ps(out + i), _mm256_mul_ps(frames, gain8)));
+    }
+    return i;
+}
+#endif
+
+/* Same as mix_block_pair_packed from a mono buffer played as stereo, sample first + i of the stereo stream
+is mono frame (first + i) / 2. Each frame is read once and widened to both sides, then takes the gains */
+static void mix_block_mono_pair(float* out, const void* in, size_t first, uint32_t count, uint8_t format, float gainEven, float gainOdd)
+{
+    uint32_t i = 0;
+    if ((first & 1) && count > 0)
+    {
+        // starts on the right side of a frame
+        out[0] += sample_read(in, first / 2, format) * gainEven;
+        i = 1;
+    }
+#if defined(__AVX2__)
+    __m256 gain8 = i == 0 ? _mm256_setr_ps(gainEven, gainOdd, gainEven, gainOdd, gainEven, gainOdd, gainEven, gainOdd)
+                          : _mm256_setr_ps(gainOdd, gainEven, gainOdd, gainEven, gainOdd, gainEven, gainOdd, gainEven);
+    switch (format)
+    {
+    case SAMPLE_FORMAT_S16:
+        i = mix_block_mono_frames(out, in, first, i, count, SAMPLE_FORMAT_S16, gain8);
+        break;
+    case SAMPLE_FORMAT_F16:
+        i = mix_block_mono_frames(out, in, first, i, count, SAMPLE_FORMAT_F16, gain8);
+        break;
+    default:
+        i = mix_block_mono_frames(out, in, first, i, count, SAMPLE_FORMAT_F32, gain8);
+        break;
+    }
+#endif
+    for (; i < count; ++i)
+        out[i] += sample_read(in, (first + i) / 2, format) * ((i & 1) ? gainOdd : gainEven);
+}
+
+// Same as mix_block_pair_f32 with the gain moving each sample, adding step (linear) or multiplying by it
+// (exponential). The pan gains are applied on top of the ramp. Returns the gain for the sample after the block
+static float mix_block_ramp_f32(float* out, const float* in, uint32_t count, float gain, float step, Volume_Ramp_Type type, float panEven, float panOdd)
+{
+    bool exponential = type == VOLUME_RAMP_EXPONENTIAL;
+    uint32_t i = 0;
+#if defined(__AVX__)
+    if (count >= 8)
+    {
+        float lanes[8];
+        float stride = exponential ? 1.0f : 0.0f;
+        for (uint32_t j = 0; j < 8; ++j)
+        {
+            lanes[j] = exponential ? gain * stride : gain + stride;
+            stride = exponential ? stride * step : stride + step;
+        }
+        __m256 gain8 = _mm256_loadu_ps(lanes);
+        __m256 stride8 = _mm256_set1_ps(stride); // 8 steps
+        __m256 pan8 = _mm256_setr_ps(panEven, panOdd, panEven, panOdd, panEven, panOdd, panEven, panOdd);
+        for (; i + 8 <= count; i += 8)
+        {
+            _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_loadu_ps(out + i), _mm256_mul_ps(_mm256_loadu_ps(in + i), _mm256_mul_ps(gain8, pan8))));
+            gain8 = exponential ? _mm256_mul_ps(gain8, stride8) : _mm256_add_ps(gain8, stride8);
+        }
+        _mm256_storeu_ps(lanes, gain8);
+        gain = lanes[0];
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        out[i] += in[i] * (gain * ((i & 1) ? panOdd : panEven));
+        gain = exponential ? gain * step : gain + step;
+    }
+    return gain;
+}
+
+/* Varispeed */
+
+static float voiceSincTable[(VOICE_SINC_PHASES + 1) * VOICE_SINC_TAPS];
+
+// Row p holds the taps for a fraction of p / VOICE_SINC_PHASES, tap k weighting the frame k - 3 from the
+// cursor. Each row is normalised to sum to 1 so a constant comes through unchanged
+static void voice_sinc_table_init(void)
+{
+    const int half = VOICE_SINC_TAPS / 2;
+    for (int p = 0; p <= VOICE_SINC_PHASES; ++p)
+    {
+        float* row = voiceSincTable + p * VOICE_SINC_TAPS;
+        double fraction = (double)p / VOICE_SINC_PHASES;
+        double sum = 0.0;
+        for (int k = 0; k < VOICE_SINC_TAPS; ++k)
+        {
+            double x = (k - (half - 1)) - fraction;
+            double sinc = x == 0.0 ? 1.0 : sin(M_PI * x) / (M_PI * x);
+            double window = 0.42 + 0.5 * cos(M_PI * x / half) + 0.08 * cos(2.0 * M_PI * x / half);
+            row[k] = (float)(sinc * window);
+            sum += row[k];
+        }
+        for (int k = 0; k < VOICE_SINC_TAPS; ++k)
+            row[k] = (float)(row[k] / sum);
+    }
+}
+
+static float voice_fraction(uint64_t cursor)
+{
+    return (float)((uint32_t)cursor >> 8) * (1.0f / VOICE_RATE_ONE);
+}
+
+// Frame from the cursor with the rate glide stepped, the wrap is left to voice_wrap
+static void voice_advance(Voice* v)
+{
+    v->cursor += (uint64_t)v->rate << 8;
+    if (v->rateRemaining > 0)
+        v->rate = --v->rateRemaining == 0 ? v->rateTarget : v->rate + (uint32_t)v->rateStep;
+}
+
+static void voice_wrap(Voice* v)
+{
+    if (v->oneShot)
+        return;
+    while ((v->cursor >> 32) >= v->length)
+        v->cursor -= (uint64_t)v->length << 32;
+}
+
+// One channel of a frame either side of the loop, loops wrap and one shots are silent outside the sample
+static float voice_tap(const Voice* v, int64_t frame, uint8_t channel, uint8_t channelCount)
+{
+    if (frame < 0 || frame >= v->length)
+    {
+        if (v->oneShot)
+            return 0.0f;
+        frame %= v->length;
+        if (frame < 0)
+            frame += v->length;
+    }
+    // a mono sample is the same on every channel
+    size_t at = v->sample->channels == 1 ? (size_t)frame : (size_t)frame * channelCount + channel;
+    return sample_read(v->buffer, at, v->sample->format);
+}
+
+static float voice_interpolate(const Voice* v, uint8_t channel, uint8_t channelCount)
+{
+    int64_t frame = (int64_t)(v->cursor >> 32);
+    float t = voice_fraction(v->cursor);
+    switch (v->interpolation)
+    {
+    case VOICE_INTERPOLATION_HERMITE:
+    {
+        float xm1 = voice_tap(v, frame - 1, channel, channelCount);
+        float x0 = voice_tap(v, frame, channel, channelCount);
+        float x1 = voice_tap(v, frame + 1, channel, channelCount);
+        float x2 = voice_tap(v, frame + 2, channel, channelCount);
+        float c1 = 0.5f * (x1 - xm1);
+        float c2 = xm1 - 2.5f * x0 + 2.0f * x1 - 0.5f * x2;
+        float c3 = 0.5f * (x2 - xm1) + 1.5f * (x0 - x1);
+        return ((c3 * t + c2) * t + c1) * t + x0;
+    }
+    case VOICE_INTERPOLATION_SINC:
+    {
+        float position = t * VOICE_SINC_PHASES;
+        int p = (int)position;
+        float f = position - p;
+        const float* row = voiceSincTable + p * VOICE_SINC_TAPS;
+        float sum = 0.0f;
+        for (int k = 0; k < VOICE_SINC_TAPS; ++k)
+        {
+            float tap = row[k] + (row[k + VOICE_SINC_TAPS] - row[k]) * f;
+            sum += voice_tap(v, frame + k - (VOICE_SINC_TAPS / 2 - 1), channel, channelCount) * tap;
+        }
+        return sum;
+    }
+    case VOICE_INTERPOLATION_LINEAR:
+    default:
+    {
+        float x0 = voice_tap(v, frame, channel, channelCount);
+        float x1 = voice_tap(v, frame + 1, channel, channelCount);
+        return x0 + (x1 - x0) * t;
+    }
+    }
+}
+
+// Frames from the cursor at a steady rate with every tap, before to after frames around it, inside the sample
+static uint32_t voice_inside_frames(const Voice* v, uint32_t frames, int64_t before, int64_t after)
+{
+    if ((int64_t)(v->cursor >> 32) < before || v->length <= after)
+        return 0;
+    uint64_t limit = (uint64_t)(v->length - after) << 32; // first cursor with a tap past the end
+    if (v->cursor >= limit)
+        return 0;
+    if (v->rate > 0)
+    {
+        uint64_t inside = (limit - 1 - v->cursor) / ((uint64_t)v->rate << 8) + 1;
+        if (inside < frames)
+            return (uint32_t)inside;
+    }
+    return frames;
+}
+
+#if defined(__AVX2__)
+/* Stereo kernels, 4 frames (8 output samples) a vector. A stereo frame and the one after it are one
+4 wide load, so the taps are loaded in pairs rather than gathered */
+
+// Taps offset frames from 4 cursors a step apart and the frame after, each as 8 wide vectors in frame order
+static inline void voice_stereo_taps_f32(const void* buffer, uint8_t format, uint64_t cursor, uint64_t step, int64_t offset, __m256* first, __m256* second)
+{
+    __m128 a = sample_load4_f32(buffer, (offset + (int64_t)(cursor >> 32)) * 2, format);
+    __m128 b = sample_load4_f32(buffer, (offset + (int64_t)((cursor + step) >> 32)) * 2, format);
+    __m128 c = sample_load4_f32(buffer, (offset + (int64_t)((cursor + 2 * step) >> 32)) * 2, format);
+    __m128 d = sample_load4_f32(buffer, (offset + (int64_t)((cursor + 3 * step) >> 32)) * 2, format);
+    __m256d ac = _mm256_castps_pd(_mm256_insertf128_ps(_mm256_castps128_ps256(a), c, 1));
+    __m256d bd = _mm256_castps_pd(_mm256_insertf128_ps(_mm256_castps128_ps256(b), d, 1));
+    *first = _mm256_castpd_ps(_mm256_unpacklo_pd(ac, bd));
+    *second = _mm256_castpd_ps(_mm256_unpackhi_pd(ac, bd));
+}
+
+// Same taps from a mono sample, each frame read once and widened to both channels
+static inline void voice_mono_taps_f32(const void* buffer, uint8_t format, uint64_t cursor, uint64_t step, int64_t offset, __m256* first, __m256* second)
+{
+    __m128 a = sample_load2_f32(buffer, offset + (int64_t)(cursor >> 32), format);
+    __m128 b = sample_load2_f32(buffer, offset + (int64_t)((cursor + step) >> 32), format);
+    __m128 c = sample_load2_f32(buffer, offset + (int64_t)((cursor + 2 * step) >> 32), format);
+    __m128 d = sample_load2_f32(buffer, offset + (int64_t)((cursor + 3 * step) >> 32), format);
+    __m128 ab = _mm_unpacklo_ps(a, b);
+    __m128 cd = _mm_unpacklo_ps(c, d);
+    __m256i widen = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+    *first = _mm256_permutevar8x32_ps(_mm256_castps128_ps256(_mm_movelh_ps(ab, cd)), widen);
+    *second = _mm256_permutevar8x32_ps(_mm256_castps128_ps256(_mm_movehl_ps(cd, ab)), widen);
+}
+
+static inline void voice_pair_taps_f32(const void* buffer, uint8_t format, bool mono, uint64_t cursor, uint64_t step, int64_t offset, __m256* first, __m256* second)
+{
+    if (mono)
+        voice_mono_taps_f32(buffer, format, cursor, step, offset, first, second);
+    else
+        voice_stereo_taps_f32(buffer, format, cursor, step, offset, first, second);
+}
+
+/* The fractional halves of 4 cursors a step apart, each on both channels of its frame. Adding the low
+half of the step carries out of the fraction for free, so they are stepped without the whole cursor */
+static __m256i voice_stereo_fractions_start(uint64_t cursor, uint64_t step)
+{
+    uint32_t a = (uint32_t)cursor;
+    uint32_t b = (uint32_t)(cursor + step);
+    uint32_t c = (uint32_t)(cursor + 2 * step);
+    uint32_t d = (uint32_t)(cursor + 3 * step);
+    return _mm256_setr_epi32(a, a, b, b, c, c, d, d);
+}
+
+// Same as voice_fraction
+static inline __m256 voice_stereo_fractions_f32(__m256i fraction8)
+{
+    return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(fraction8, 8)), _mm256_set1_ps(1.0f / VOICE_RATE_ONE));
+}
+
+// One frame through the sinc table, the 8 taps of both channels are two loads. Left and right in the low half
+static inline __m128 voice_sinc_stereo_frame_f32(const void* buffer, uint8_t format, uint64_t cursor)
+{
+    float position = voice_fraction(cursor) * VOICE_SINC_PHASES;
+    int p = (int)position;
+    __m256 f = _mm256_set1_ps(position - p);
+    __m256 row = _mm256_loadu_ps(voiceSincTable + p * VOICE_SINC_TAPS);
+    __m256 next = _mm256_loadu_ps(voiceSincTable + (p + 1) * VOICE_SINC_TAPS);
+    __m256 taps = _mm256_add_ps(row, _mm256_mul_ps(_mm256_sub_ps(next, row), f));
+
+    int64_t at = ((int64_t)(cursor >> 32) - (VOICE_SINC_TAPS / 2 - 1)) * 2;
+    __m256 low = _mm256_mul_ps(sample_load8_f32(buffer, at, format), _mm256_permutevar8x32_ps(taps, _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3)));
+    __m256 high = _mm256_mul_ps(sample_load8_f32(buffer, at + 8, format), _mm256_permutevar8x32_ps(taps, _mm256_setr_epi32(4, 4, 5, 5, 6, 6, 7, 7)));
+    __m256 sum = _mm256_add_ps(low, high);
+    __m128 sum4 = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+    return _mm_add_ps(sum4, _mm_movehl_ps(sum4, sum4));
+}
+
+// Same from a mono sample, the 8 taps are one load and the result is on both channels. Summed in the same
+// order as the stereo frame so a mono sample plays exactly as it would have kept as stereo
+static inline __m128 voice_sinc_mono_frame_f32(const void* buffer, uint8_t format, uint64_t cursor)
+{
+    float position = voice_fraction(cursor) * VOICE_SINC_PHASES;
+    int p = (int)position;
+    __m256 f = _mm256_set1_ps(position - p);
+    __m256 row = _mm256_loadu_ps(voiceSincTable + p * VOICE_SINC_TAPS);
+    __m256 next = _mm256_loadu_ps(voiceSincTable + (p + 1) * VOICE_SINC_TAPS);
+    __m256 taps = _mm256_add_ps(row, _mm256_mul_ps(_mm256_sub_ps(next, row), f));
+
+    __m256 product = _mm256_mul_ps(sample_load8_f32(buffer, (int64_t)(cursor >> 32) - (VOICE_SINC_TAPS / 2 - 1), format), taps);
+    __m128 sum4 = _mm_add_ps(_mm256_castps256_ps128(product), _mm256_extractf128_ps(product, 1));
+    __m128 sum2 = _mm_add_ps(sum4, _mm_movehl_ps(sum4, sum4));
+    __m128 sum = _mm_add_ss(sum2, _mm_shuffle_ps(sum2, sum2, 1));
+    return _mm_shuffle_ps(sum, sum, 0);
+}
+
+static inline __m128 voice_sinc_pair_frame_f32(const void* buffer, uint8_t format, bool mono, uint64_t cursor)
+{
+    return mono ? voice_sinc_mono_frame_f32(buffer, format, cursor) : voice_sinc_stereo_frame_f32(buffer, format, cursor);
+}
+
+static inline __m256 voice_stereo_interpolate_f32(const Voice* v, uint8_t format, bool mono, uint64_t cursor, uint64_t step, __m256i fraction8)
+{
+    __m256 x0, x1;
+    switch (v->interpolation)
+    {
+    case VOICE_INTERPOLATION_HERMITE:
+    {
+        __m256 xm1, x2;
+        voice_pair_taps_f32(v->buffer, format, mono, cursor, step, -1, &xm1, &x0);
+        voice_pair_taps_f32(v->buffer, format, mono, cursor, step, 1, &x1, &x2);
+        __m256 t = voice_stereo_fractions_f32(fraction8);
+        __m256 half = _mm256_set1_ps(0.5f);
+        __m256 c1 = _mm256_mul_ps(half, _mm256_sub_ps(x1, xm1));
+        __m256 c2 = _mm256_sub_ps(_mm256_add_ps(_mm256_sub_ps(xm1, _mm256_mul_ps(_mm256_set1_ps(2.5f), x0)), _mm256_mul_ps(_mm256_set1_ps(2.0f), x1)),
+                                  _mm256_mul_ps(half, x2));
+        __m256 c3 = _mm256_add_ps(_mm256_mul_ps(half, _mm256_sub_ps(x2, xm1)), _mm256_mul_ps(_mm256_set1_ps(1.5f), _mm256_sub_ps(x0, x1)));
+        __m256 y = _mm256_add_ps(_mm256_mul_ps(c3, t), c2);
+        y = _mm256_add_ps(_mm256_mul_ps(y, t), c1);
+        return _mm256_add_ps(_mm256_mul_ps(y, t), x0);
+    }
+    case VOICE_INTERPOLATION_SINC:
+    {
+        __m128 ab = _mm_movelh_ps(voice_sinc_pair_frame_f32(v->buffer, format, mono, cursor), voice_sinc_pair_frame_f32(v->buffer, format, mono, cursor + step));
+        __m128 cd = _mm_movelh_ps(voice_sinc_pair_frame_f32(v->buffer, format, mono, cursor + 2 * step),
+                                  voice_sinc_pair_frame_f32(v->buffer, format, mono, cursor + 3 * step));
+        return _mm256_insertf128_ps(_mm256_castps128_ps256(ab), cd, 1);
+    }
+    case VOICE_INTERPOLATION_LINEAR:
+    default:
+        voice_pair_taps_f32(v->buffer, format, mono, cursor, step, 0, &x0, &x1);
+        return _mm256_add_ps(x0, _mm256_mul_ps(_mm256_sub_ps(x1, x0), voice_stereo_fractions_f32(fraction8)));
+    }
+}
+
+// Resamples frames (a multiple of 4) of a steady stereo voice with every tap inside the sample
+static void voice_stereo_resample_f32(Voice* v, float* out, uint32_t frames)
+{
+    uint64_t step = (uint64_t)v->rate << 8;
+    uint64_t cursor = v->cursor;
+    __m256i fraction8 = voice_stereo_fractions_start(cursor, step);
+    __m256i step8 = _mm256_set1_epi32((uint32_t)(4 * step));
+    uint8_t format = v->sample->format;
+    bool mono = v->sample->channels == 1;
+    for (uint32_t i = 0; i < frames; i += 4)
+    {
+        _mm256_storeu_ps(out + i * 2, voice_stereo_interpolate_f32(v, format, mono, cursor, step, fraction8));
+        cursor += 4 * step;
+        fraction8 = _mm256_add_epi32(fraction8, step8);
+    }
+    v->cursor = cursor;
+    voice_wrap(v);
+}
+
+/* Frames a steady linear stereo voice can mix straight into the output out of a run, a multiple of 4.
+0 when gliding, ramping or part way through a frame, those go through the scratch block */
+static uint32_t voice_linear_stereo_frames(const Voice* v, uint32_t sampleCount, uint8_t channelCount)
+{
+    if (channelCount != 2 || v->interpolation != VOICE_INTERPOLATION_LINEAR || v->phase != 0 || v->rampRemaining > 0 ||
+        v->rateRemaining > 0)
+        return 0;
+    return voice_inside_frames(v, sampleCount / 2, 0, 1) & ~3u;
+}
+
+// The cheap path, linear stereo mixed into out with the gains as it is resampled. Same operations as
+// resampling then mixing so both ways give the same output
+static void voice_linear_stereo_mix_f32(Voice* v, float* out, uint32_t frames, float gainEven, float gainOdd)
+{
+    uint64_t step = (uint64_t)v->rate << 8;
+    uint64_t cursor = v->cursor;
+    __m256i fraction8 = voice_stereo_fractions_start(cursor, step);
+    __m256i step8 = _mm256_set1_epi32((uint32_t)(4 * step));
+    __m256 gain8 = _mm256_setr_ps(gainEven, gainOdd, gainEven, gainOdd, gainEven, gainOdd, gainEven, gainOdd);
+    const void* buffer = v->buffer;
+    uint8_t format = v->sample->format;
+    bool mono = v->sample->channels == 1;
+    for (uint32_t i = 0; i < frames; i += 4)
+    {
+        __m256 x0, x1;
+        voice_pair_taps_f32(buffer, format, mono, cursor, step, 0, &x0, &x1);
+        __m256 y = _mm256_add_ps(x0, _mm256_mul_ps(_mm256_sub_ps(x1, x0), voice_stereo_fractions_f32(fraction8)));
+        _mm256_storeu_ps(out + i * 2, _mm256_add_ps(_mm256_loadu_ps(out + i * 2), _mm256_mul_ps(y, gain8)));
+        cursor += 4 * step;
+        fraction8 = _mm256_add_epi32(fraction8, step8);
+    }
+    v->cursor = cursor;
+    voice_wrap(v);
+}
+#endif
+
+#if defined(__AVX2__)
+// Any other layout, lane j is channel j % channelCount of frame j / channelCount and the taps are gathered.
+// f32 only, the gathers can't read packed samples
+static __m256 voice_interpolate_8_f32(const Voice* v, const uint64_t* cursors, uint8_t channelCount)
+{
+    int32_t index[8];
+    float fraction[8];
+    for (uint32_t i = 0, j = 0; j < 8; ++i)
+    {
+        int32_t frame = (int32_t)(cursors[i] >> 32) * channelCount;
+        float t = voice_fraction(cursors[i]);
+        for (uint8_t c = 0; c < channelCount; ++c, ++j)
+        {
+            index[j] = frame + c;
+            fraction[j] = t;
+        }
+    }
+    __m256i index8 = _mm256_loadu_si256((const __m256i*)index);
+    __m256 t = _mm256_loadu_ps(fraction);
+    __m256i stride = _mm256_set1_epi32(channelCount);
+
+    if (v->interpolation == VOICE_INTERPOLATION_HERMITE)
+    {
+        __m256 xm1 = _mm256_i32gather_ps(v->buffer, _mm256_sub_epi32(index8, stride), 4);
+        __m256 x0 = _mm256_i32gather_ps(v->buffer, index8, 4);
+        __m256 x1 = _mm256_i32gather_ps(v->buffer, _mm256_add_epi32(index8, stride), 4);
+        __m256 x2 = _mm256_i32gather_ps(v->buffer, _mm256_add_epi32(index8, _mm256_add_epi32(stride, stride)), 4);
+        __m256 half = _mm256_set1_ps(0.5f);
+        __m256 c1 = _mm256_mul_ps(half, _mm256_sub_ps(x1, xm1));
+        __m256 c2 = _mm256_sub_ps(_mm256_add_ps(_mm256_sub_ps(xm1, _mm256_mul_ps(_mm256_set1_ps(2.5f), x0)), _mm256_mul_ps(_mm256_set1_ps(2.0f), x1)),
+                                  _mm256_mul_ps(half, x2));
+        __m256 c3 = _mm256_add_ps(_mm256_mul_ps(half, _mm256_sub_ps(x2, xm1)), _mm256_mul_ps(_mm256_set1_ps(1.5f), _mm256_sub_ps(x0, x1)));
+        __m256 y = _mm256_add_ps(_mm256_mul_ps(c3, t), c2);
+        y = _mm256_add_ps(_mm256_mul_ps(y, t), c1);
+        return _mm256_add_ps(_mm256_mul_ps(y, t), x0);
+    }
+    if (v->interpolation == VOICE_INTERPOLATION_SINC)
+    {
+        __m256 position = _mm256_mul_ps(t, _mm256_set1_ps(VOICE_SINC_PHASES));
+        __m256i p = _mm256_cvttps_epi32(position);
+        __m256 f = _mm256_sub_ps(position, _mm256_cvtepi32_ps(p));
+        __m256i row = _mm256_mullo_epi32(p, _mm256_set1_epi32(VOICE_SINC_TAPS));
+        __m256i next = _mm256_add_epi32(row, _mm256_set1_epi32(VOICE_SINC_TAPS));
+        __m256i at = _mm256_sub_epi32(index8, _mm256_mullo_epi32(stride, _mm256_set1_epi32(VOICE_SINC_TAPS / 2 - 1)));
+        __m256 sum = _mm256_setzero_ps();
+        for (int k = 0; k < VOICE_SINC_TAPS; ++k)
+        {
+            __m256i tapIndex = _mm256_set1_epi32(k);
+            __m256 a = _mm256_i32gather_ps(voiceSincTable, _mm256_add_epi32(row, tapIndex), 4);
+            __m256 b = _mm256_i32gather_ps(voiceSincTable, _mm256_add_epi32(next, tapIndex), 4);
+            __m256 tap = _mm256_add_ps(a, _mm256_mul_ps(_mm256_sub_ps(b, a), f));
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_i32gather_ps(v->buffer, at, 4), tap));
+            at = _mm256_add_epi32(at, stride);
+        }
+        return sum;
+    }
+    __m256 x0 = _mm256_i32gather_ps(v->buffer, index8, 4);
+    __m256 x1 = _mm256_i32gather_ps(v->buffer, _mm256_add_epi32(index8, stride), 4);
+    return _mm256_add_ps(x0, _mm256_mul_ps(_mm256_sub_ps(x1, x0), t));
+}
+#endif
+
+/* Resamples whole frames. Frames are taken a batch at a time when every tap of the batch is inside the
+sample, around the loop point and the ends of a one shot they go one at a time through voice_tap.
+Returns the frames written, fewer only when a one shot runs out */
+static uint32_t voice_resample_frames(Voice* v, float* out, uint32_t frames, uint8_t channelCount)
+{
+    int64_t before = 0;
+    int64_t after = 1;
+    if (v->interpolation == VOICE_INTERPOLATION_HERMITE)
+    {
+        before = 1;
+        after = 2;
+    }
+    else if (v->interpolation == VOICE_INTERPOLATION_SINC)
+    {
+        before = VOICE_SINC_TAPS / 2 - 1;
+        after = VOICE_SINC_TAPS / 2;
+    }
+
+    uint32_t done = 0;
+    while (done < frames)
+    {
+        if (voice_finished(v))
+            break;
+#if defined(__AVX2__)
+        uint32_t batch = 8 % channelCount == 0 ? 8 / channelCount : 0;
+        uint32_t inside = batch > 0 && v->rateRemaining == 0 ? voice_inside_frames(v, frames - done, before, after) / batch * batch : 0;
+        if (inside > 0 && channelCount == 2)
+        {
+            voice_stereo_resample_f32(v, out + done * 2, inside);
+            done += inside;
+            continue;
+        }
+        // packed and mono samples of other layouts, and gliding ones, go through voice_tap
+        if (v->sample->format != SAMPLE_FORMAT_F32 || v->sample->channels != channelCount)
+            batch = 0;
+        if (inside > 0 && batch > 0)
+        {
+            uint64_t step = (uint64_t)v->rate << 8;
+            uint64_t cursors[8];
+            for (uint32_t i = 0; i < inside; i += batch)
+            {
+                for (uint32_t k = 0; k < batch; ++k)
+                    cursors[k] = v->cursor + k * step;
+                _mm256_storeu_ps(out + (done + i) * channelCount, voice_interpolate_8_f32(v, cursors, channelCount));
+                v->cursor += batch * step;
+            }
+            voice_wrap(v);
+            done += inside;
+            continue;
+        }
+        if (batch > 0 && v->rateRemaining > 0 && frames - done >= batch)
+        {
+            // gliding, the rate steps every frame so the batch is stepped out on a copy first
+            uint64_t cursors[8];
+            Voice next = *v;
+            for (uint32_t i = 0; i < batch; ++i)
+            {
+                cursors[i] = next.cursor;
+                voice_advance(&next);
+            }
+            if ((int64_t)(cursors[0] >> 32) - before >= 0 && (int64_t)(cursors[batch - 1] >> 32) + after < v->length)
+            {
+                _mm256_storeu_ps(out + done * channelCount, voice_interpolate_8_f32(v, cursors, channelCount));
+                v->cursor = next.cursor;
+                v->rate = next.rate;
+                v->rateRemaining = next.rateRemaining;
+                voice_wrap(v);
+                done += batch;
+                continue;
+            }
+        }
+#endif
+
+        for (uint8_t c = 0; c < channelCount; ++c)
+            out[done * channelCount + c] = voice_interpolate(v, c, channelCount);
+        voice_advance(v);
+        voice_wrap(v);
+        ++done;
+    }
+    return done;
+}
+
+// Fills out with count samples of the voice at its rate, a frame split between calls is carried in
+// phase. Returns fewer than count only when a one shot runs out
+static uint32_t voice_resample(Voice* v, float* out, uint32_t count, uint8_t channelCount)
+{
+    uint32_t written = 0;
+    while (written < count && !voice_finished(v))
+    {
+        if (v->phase == 0 && count - written >= channelCount)
+        {
+            written += voice_resample_frames(v, out + written, (count - written) / channelCount, channelCount) * channelCount;
+            continue;
+        }
+        out[written++] = voice_interpolate(v, v->phase, channelCount);
+        if (++v->phase == channelCount)
+        {
+            v->phase = 0;
+            voice_advance(v);
+            voice_wrap(v);
+        }
+    }
+    return written;
+}
+
+// At unity with no fraction the samples are mixed straight from the buffer
+static bool voice_unity(const Voice* v)
+{
+    return v->rate == VOICE_RATE_ONE && v->rateRemaining == 0 && (uint32_t)v->cursor == 0;
+}
+
+/* Tempo stretch */
+
+// What a loop voices cursor steps a frame, its rate scaled by the tempo
+static uint64_t voice_tempo_step(uint32_t rate, uint64_t tempo)
+{
+    return (uint64_t)(((unsigned __int128)rate * tempo) >> 24);
+}
+
+// Moves the cursor on frames at the voices rate over the tempo, stepping any rate glide as it goes
+static void voice_stretch_phase(Voice* v, uint32_t frames, uint64_t tempo)
+{
+    if (v->rateRemaining == 0)
+        v->cursor += voice_tempo_step(v->rate, tempo) * frames;
+    else
+    {
+        for (uint32_t i = 0; i < frames; ++i)
+        {
+            v->cursor += voice_tempo_step(v->rate, tempo);
+            if (v->rateRemaining > 0)
+                v->rate = --v->rateRemaining == 0 ? v->rateTarget : v->rate + (uint32_t)v->rateStep;
+        }
+    }
+    voice_wrap(v);
+}
+
+// The voice reading from another cursor, a copy so the grains share its rate, glide and interpolation
+static Voice voice_grain(const Voice* v, uint64_t cursor)
+{
+    Voice grain = *v;
+    grain.cursor = cursor;
+    return grain;
+}
+
+/* Starts the next grain at the cursor, the one playing fades out. When searching the start is moved to
+where the new grain best matches what the playing one would have gone on to play over the fade, both
+summed to mono and compared every VOICE_STRETCH_SEEK_STRIDE frames */
+static void voice_stretch_grain(Voice* v, VoiceStretch* stretch, uint8_t channelCount, bool search)
+{
+    enum { POINTS = VOICE_STRETCH_FADE_FRAMES / VOICE_STRETCH_SEEK_STRIDE, SPAN = 2 * VOICE_STRETCH_SEEK_FRAMES + VOICE_STRETCH_FADE_FRAMES };
+    int64_t start = (int64_t)(v->cursor >> 32);
+    int64_t offset = 0;
+    if (search)
+    {
+        float playing[POINTS];
+        float candidates[SPAN];
+        int64_t from = (int64_t)(stretch->grain >> 32);
+        for (uint32_t n = 0; n < POINTS; ++n)
+        {
+            playing[n] = 0.0f;
+            for (uint8_t c = 0; c < channelCount; ++c)
+                playing[n] += voice_tap(v, from + n * VOICE_STRETCH_SEEK_STRIDE, c, channelCount);
+        }
+        for (uint32_t n = 0; n < SPAN; ++n)
+        {
+            candidates[n] = 0.0f;
+            for (uint8_t c = 0; c < channelCount; ++c)
+                candidates[n] += voice_tap(v, start - VOICE_STRETCH_SEEK_FRAMES + n, c, channelCount);
+        }
+        float best = -INFINITY;
+        for (uint32_t d = 0; d <= 2 * VOICE_STRETCH_SEEK_FRAMES; ++d)
+        {
+            float similarity = 0.0f;
+            for (uint32_t n = 0; n < POINTS; ++n)
+                similarity += playing[n] * candidates[d + n * VOICE_STRETCH_SEEK_STRIDE];
+            if (similarity > best)
+            {
+                best = similarity;
+                offset = (int64_t)d - VOICE_STRETCH_SEEK_FRAMES;
+            }
+        }
+    }
+    int64_t frame = (start + offset) % v->length;
+    if (frame < 0)
+        frame += v->length;
+    stretch->fading = stretch->grain;
+    stretch->fadeRemaining = VOICE_STRETCH_FADE_FRAMES;
+    stretch->grain = (uint64_t)frame << 32 | (uint32_t)v->cursor;
+    stretch->hopRemaining = VOICE_STRETCH_HOP_FRAMES;
+}
+
+// One channel of the current frame, the grain crossfaded over the one fading out
+static float voice_stretch_sample(const Voice* v, const VoiceStretch* stretch, uint8_t channel, uint8_t channelCount)
+{
+    Voice grain = voice_grain(v, stretch->grain);
+    float in = voice_interpolate(&grain, channel, channelCount);
+    if (stretch->fadeRemaining == 0)
+        return in;
+    Voice fade = voice_grain(v, stretch->fading);
+    float out = voice_interpolate(&fade, channel, channelCount);
+    return out + (in - out) * ((VOICE_STRETCH_FADE_FRAMES - stretch->fadeRemaining) * (1.0f / VOICE_STRETCH_FADE_FRAMES));
+}
+
+static void voice_stretch_step(Voice* v, VoiceStretch* stretch, uint64_t tempo)
+{
+    Voice grain = voice_grain(v, stretch->grain);
+    voice_advance(&grain);
+    voice_wrap(&grain);
+    stretch->grain = grain.cursor;
+    if (stretch->fadeRemaining > 0)
+    {
+        Voice fade = voice_grain(v, stretch->fading);
+        voice_advance(&fade);
+        voice_wrap(&fade);
+        stretch->fading = fade.cursor;
+        --stretch->fadeRemaining;
+    }
+    voice_stretch_phase(v, 1, tempo);
+    --stretch->hopRemaining;
+}
+
+// Whole frames, each grain resampled a hop at a time through the voices own kernels. frames * channelCount
+// is at most VOICE_RESAMPLE_BLOCK
+static void voice_stretch_frames(Voice* v, VoiceStretch* stretch, uint64_t tempo, float* out, uint32_t frames, uint8_t channelCount)
+{
+    float fading[VOICE_RESAMPLE_BLOCK];
+    uint32_t done = 0;
+    while (done < frames)
+    {
+        if (stretch->hopRemaining == 0)
+            voice_stretch_grain(v, stretch, channelCount, tempo != VOICE_TEMPO_ONE);
+        uint32_t run = frames - done;
+        if (run > stretch->hopRemaining)
+            run = stretch->hopRemaining;
+
+        float* at = out + done * channelCount;
+        Voice grain = voice_grain(v, stretch->grain);
+        voice_resample_frames(&grain, at, run, channelCount);
+        stretch->grain = grain.cursor;
+        if (stretch->fadeRemaining > 0)
+        {
+            uint32_t faded = run < stretch->fadeRemaining ? run : stretch->fadeRemaining;
+            Voice fade = voice_grain(v, stretch->fading);
+            voice_resample_frames(&fade, fading, faded, channelCount);
+            stretch->fading = fade.cursor;
+            float mix = (VOICE_STRETCH_FADE_FRAMES - stretch->fadeRemaining) * (1.0f / VOICE_STRETCH_FADE_FRAMES);
+            for (uint32_t i = 0; i < faded; ++i)
+            {
+                for (uint8_t c = 0; c < channelCount; ++c)
+                {
+                    float* sample = at + i * channelCount + c;
+                    *sample = fading[i * channelCount + c] + (*sample - fading[i * channelCount + c]) * mix;
+                }
+                mix += 1.0f / VOICE_STRETCH_FADE_FRAMES;
+            }
+            stretch->fadeRemaining -= faded;
+        }
+        voice_stretch_phase(v, run, tempo);
+        stretch->hopRemaining -= run;
+        done += run;
+    }
+}
+
+/* Fills out with count samples of a loop voice held to the tempo, a frame split between calls is
+carried in phase as voice_resample does. Back at the session tempo the grains start on the cursor with
+no search, once the last fade is over the grain is the cursor and the voice drops back to plain playback */
+static uint32_t voice_stretch(Voice* v, VoiceStretch* stretch, uint64_t tempo, float* out, uint32_t count, uint8_t channelCount)
+{
+    if (!stretch->engaged)
+    {
+        stretch->engaged = true;
+        stretch->grain = v->cursor;
+        stretch->fadeRemaining = 0;
+        stretch->hopRemaining = VOICE_STRETCH_HOP_FRAMES;
+    }
+    uint32_t written = 0;
+    while (written < count)
+    {
+        if (v->phase == 0 && count - written >= channelCount)
+        {
+            uint32_t frames = (count - written) / channelCount;
+            voice_stretch_frames(v, stretch, tempo, out + written, frames, channelCount);
+            written += frames * channelCount;
+            continue;
+        }
+        if (v->phase == 0 && stretch->hopRemaining == 0)
+            voice_stretch_grain(v, stretch, channelCount, tempo != VOICE_TEMPO_ONE);
+        out[written++] = voice_stretch_sample(v, stretch, v->phase, channelCount);
+        if (++v->phase == channelCount)
+        {
+            v->phase = 0;
+            voice_stretch_step(v, stretch, tempo);
+        }
+    }
+    if (tempo == VOICE_TEMPO_ONE && stretch->fadeRemaining == 0 && stretch->grain == v->cursor && v->phase == 0)
+        stretch->engaged = false;
+    return written;
+}
+
+/* Renders one voice as contiguous runs, the run only gets split where the cursor wraps, a volume ramp
+ends or a resample block fills, so the cursor is checked once per run instead of once per sample */
+static void voice_render_block(Voice* v, VoiceStretch* stretch, uint64_t tempo, float* out, uint32_t sampleCount, uint8_t channelCount, float gainEven, float gainOdd)
+{
+    float scratch[VOICE_RESAMPLE_BLOCK] __attribute__((aligned(32)));
+    uint8_t format = v->sample->format;
+    bool mono = v->sample->channels != channelCount;
+    uint32_t pushed = 0;
+    while (pushed < sampleCount)
+    {
+        if (voice_finished(v))
+            break;
+        // runs can be an odd length, keeping the gains on the right output channel
+        float gainA = (pushed & 1) ? gainOdd : gainEven;
+        float gainB = (pushed & 1) ? gainEven : gainOdd;
+
+        uint32_t run = sampleCount - pushed;
+        if (v->rampRemaining > 0 && v->rampRemaining < run)
+            run = v->rampRemaining;
+
+        const float* in = NULL; // left NULL when mixed straight from a packed or mono buffer
+        bool unity = stretch == NULL && voice_unity(v);
+        uint32_t at = (uint32_t)(v->cursor >> 32) * channelCount + v->phase;
+        if (unity)
+        {
+            uint32_t untilEnd = v->length * channelCount - at;
+            if (untilEnd < run)
+                run = untilEnd;
+            if (format == SAMPLE_FORMAT_F32 && !mono)
+                in = v->buffer + at;
+            else if (v->rampRemaining > 0)
+            {
+                if (run > VOICE_RESAMPLE_BLOCK)
+                    run = VOICE_RESAMPLE_BLOCK;
+                if (mono)
+                    sample_unpack_mono(scratch, v->buffer, at, run, format);
+                else
+                    sample_unpack(scratch, v->buffer, at, run, format);
+                in = scratch;
+            }
+        }
+        else
+        {
+#if defined(__AVX2__)
+            uint32_t frames = stretch == NULL ? voice_linear_stereo_frames(v, run, channelCount) : 0;
+            if (frames > 0)
+            {
+                voice_linear_stereo_mix_f32(v, out + pushed, frames, v->volume * gainA, v->volume * gainB);
+                pushed += frames * 2;
+                continue;
+            }
+#endif
+            if (run > VOICE_RESAMPLE_BLOCK)
+                run = VOICE_RESAMPLE_BLOCK;
+            if (stretch != NULL)
+                run = voice_stretch(v, stretch, tempo, scratch, run, channelCount);
+            else
+                run = voice_resample(v, scratch, run, channelCount);
+            in = scratch;
+        }
+
+        if (v->rampRemaining > 0)
+        {
+            v->volume = mix_block_ramp_f32(out + pushed, in, run, v->volume, v->rampStep, v->rampType, gainA, gainB);
+            v->rampRemaining -= run;
+            if (v->rampRemaining == 0)
+                v->volume = v->rampTarget;
+        }
+        else if (in == NULL && mono)
+            mix_block_mono_pair(out + pushed, v->buffer, at, run, format, v->volume * gainA, v->volume * gainB);
+        else if (in == NULL)
+            mix_block_pair_packed(out + pushed, v->buffer, at, run, format, v->volume * gainA, v->volume * gainB);
+        else
+            mix_block_pair_f32(out + pushed, in, run, v->volume * gainA, v->volume * gainB);
+        pushed += run;
+
+        if (unity)
+        {
+            at += run;
+            v->cursor = (uint64_t)(at / channelCount) << 32;
+            v->phase = at % channelCount;
+            voice_wrap(v);
+        }
+    }
+}
+
+// Channel gain and pan as left and right gains, pan is ignored for anything but stereo
+static void mix_channel_gains(const MixChannel* channel, uint8_t channelCount, float* left, float* right)
+{
+    *left = channel->gain;
+    *right = channel->gain;
+    if (channelCount != 2)
+        return;
+    if (channel->pan > 0.0f)
+        *left *= 1.0f - channel->pan;
+    else
+        *right *= 1.0f + channel->pan;
+}
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+// Sums jobs [first, last) into their group buses, returns the groups written to. Stretched voices are only
+// timed when the block is, one in VOICE_STRETCH_TIMED_BLOCKS, keeping the clock reads off most blocks
+static uint8_t voice_jobs_render(const VoiceJob* jobs, uint32_t first, uint32_t last, float* buses, uint32_t busSamples, uint32_t count, bool odd, bool timed)
+{
+    uint8_t groupsUsed = 0;
+    for (uint32_t i = first; i < last; ++i)
+    {
+        const VoiceJob* job = &jobs[i];
+        float* bus = buses + job->group * busSamples;
+        if (!(groupsUsed & (1 << job->group)))
+        {
+            memset(bus, 0, sizeof(float) * count);
+            groupsUsed |= 1 << job->group;
+        }
+        if (job->stretch == NULL || !timed)
+        {
+            voice_render_block(job->voice, job->stretch, job->stretch != NULL ? job->tempo : VOICE_TEMPO_ONE, bus, count, job->channelCount,
+                               odd ? job->right : job->left, odd ? job->left : job->right);
+            continue;
+        }
+        // stretched voices are timed, so the ts command can say how many a core keeps up with
+        uint64_t start = monotonic_ns();
+        voice_render_block(job->voice, job->stretch, job->tempo, bus, count, job->channelCount, odd ? job->right : job->left, odd ? job->left : job->right);
+        uint64_t nanoseconds = monotonic_ns() - start;
+        uint32_t frames = count / job->channelCount;
+        job->stretch->nanoseconds += nanoseconds;
+        job->stretch->frames += frames;
+        if (frames > 0 && nanoseconds / frames > job->stretch->peak)
+            job->stretch->peak = (uint32_t)(nanoseconds / frames);
+    }
+    return groupsUsed;
+}
+
+/* Voice worker pool */
+
+// Takes the next partition of the generation, or returns false once there are none left. The claim only goes
+// through while the generation matches, so a worker that wakes late can't take a partition of the next block
+static bool voice_partition_claim(VoiceWorkerPool* pool, uint32_t generation, uint64_t* work)
+{
+    *work = atomic_load_explicit(&pool->work, memory_order_acquire);
+    while ((uint32_t)(*work >> 32) == generation && (uint16_t)*work < pool->partitionCount)
+    {
+        if (atomic_compare_exchange_weak_explicit(&pool->work, work, *work + 1, memory_order_seq_cst, memory_order_acquire))
+            return true;
+    }
+    return false;
+}
+
+// Renders the partitions claimed on the copy of the block in the slot. The slot is marked held before the
+// claim so the audio thread can't reuse it under the worker, and the result only counts if the partition
+// is still pending when it's done
+static void voice_worker_claim(VoiceWorkerPool* pool, uint8_t index, uint32_t generation)
+{
+    for (;;)
+    {
+        uint64_t work = atomic_load_explicit(&pool->work, memory_order_acquire);
+        if ((uint32_t)(work >> 32) != generation || (uint16_t)work >= pool->partitionCount)
+            break;
+        atomic_store_explicit(&pool->holding[index], (uint8_t)(work >> 16) + 1, memory_order_seq_cst);
+        if (!atomic_compare_exchange_weak_explicit(&pool->work, &work, work + 1, memory_order_seq_cst, memory_order_relaxed))
+            continue;
+
+        uint32_t partition = (uint16_t)work;
+        VoiceBlockSlot* slot = &pool->slots[(uint8_t)(work >> 16)];
+        uint32_t first = partition * slot->jobCount / pool->partitionCount;
+        uint32_t last = (partition + 1) * slot->jobCount / pool->partitionCount;
+        float* buses = slot->buses + partition * MIX_GROUP_COUNT * pool->busSamples;
+        slot->groupsUsed[partition] = voice_jobs_render(slot->jobs, first, last, buses, pool->busSamples, slot->count, slot->odd, slot->timed);
+        uint64_t pending = (uint64_t)generation << 32 | VOICE_PARTITION_PENDING;
+        atomic_compare_exchange_strong_explicit(&pool->partitions[partition], &pending, (uint64_t)generation << 32 | VOICE_PARTITION_DONE,
+                                                memory_order_release, memory_order_relaxed); // fails when taken, the result is dropped
+    }
+    atomic_store_explicit(&pool->holding[index], 0, memory_order_release);
+}
+
+// Sleeps until the wake word moves on from ticket, returns straight away if it already has
+static void voice_workers_wait(VoiceWorkerPool* pool, uint32_t ticket)
+{
+    syscall(SYS_futex, &pool->wake, FUTEX_WAIT_PRIVATE, ticket, NULL, NULL, 0);
+}
+
+static void voice_workers_wake(VoiceWorkerPool* pool)
+{
+    atomic_fetch_add_explicit(&pool->wake, 1, memory_order_release);
+    syscall(SYS_futex, &pool->wake, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+static void* voice_worker_run(void* arg)
+{
+    VoiceWorkerThread* thread = arg;
+    VoiceWorkerPool* pool = thread->pool;
+    if (pool->realtime.enabled)
+        denormals_flush();
+
+    uint32_t seen = (uint32_t)(atomic_load_explicit(&pool->work, memory_order_acquire) >> 32);
+    uint32_t spins = 0;
+    while (atomic_load_explicit(&pool->running, memory_order_relaxed))
+    {
+        uint32_t generation = (uint32_t)(atomic_load_explicit(&pool->work, memory_order_acquire) >> 32);
+        if (generation == seen && ++spins < VOICE_WORKERS_SPINS)
+        {
+            _mm_pause();
+            continue;
+        }
+        if (generation == seen)
+        {
+            // counted as a sleeper before the work is looked at again, so either this sees the new block or
+            // the audio thread sees the sleeper and wakes it
+            uint32_t ticket = atomic_load_explicit(&pool->wake, memory_order_acquire);
+            atomic_fetch_add_explicit(&pool->sleepers, 1, memory_order_seq_cst);
+            if ((uint32_t)(atomic_load_explicit(&pool->work, memory_order_seq_cst) >> 32) == seen &&
+                atomic_load_explicit(&pool->running, memory_order_relaxed))
+                voice_workers_wait(pool, ticket);
+            atomic_fetch_sub_explicit(&pool->sleepers, 1, memory_order_relaxed);
+            spins = 0;
+            continue;
+        }
+        seen = generation;
+        spins = 0;
+        voice_worker_claim(pool, thread->index, generation);
+    }
+    return NULL;
+}
+
+// Real-time workers go SCHED_FIFO only when the audio thread is pinned, each on a core past the audio threads.
+// A FIFO worker free to land on the audio core would spin the callback off it. Returns the core, -1 when left as is
+static int voice_worker_realtime(VoiceWorkerPool* pool, uint8_t index)
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (pool->realtime.cpu < 0 || cores < 2)
+        return -1;
+    int cpu = (int)((pool->realtime.cpu + 1 + index % (cores - 1)) % cores);
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pool->threads[index], sizeof(cpu_set_t), &set) != 0)
+        return -1;
+    struct sched_param param = { .sched_priority = pool->realtime.priority };
+    if (pthread_setschedparam(pool->threads[index], SCHED_FIFO, &param) != 0)
+        return -1;
+    return cpu;
+}
+
+bool voice_workers_start(SoundController* sc, uint8_t workerCount)
+{
+    if (workerCount == 0)
+        return true;
+    if (workerCount > VOICE_WORKERS_MAX)
+    {
+        printf(MAGENTA "\t\tWARNING: %u voice workers asked for, limited to %u\n" RESET, workerCount, VOICE_WORKERS_MAX);
+        workerCount = VOICE_WORKERS_MAX;
+    }
+
+    VoiceWorkerPool* pool = arena_alloc(sc->arena, sizeof(VoiceWorkerPool), NULL);
+    memset(pool, 0, sizeof(VoiceWorkerPool));
+    atomic_init(&pool->work, 0);
+    atomic_init(&pool->running, true);
+    atomic_init(&pool->taken, 0);
+    atomic_init(&pool->wake, 0);
+    atomic_init(&pool->sleepers, 0);
+    for (uint8_t p = 0; p <= VOICE_WORKERS_MAX; ++p)
+        atomic_init(&pool->partitions[p], 0);
+    for (uint8_t i = 0; i < VOICE_WORKERS_MAX; ++i)
+        atomic_init(&pool->holding[i], 0);
+    pool->partitionCount = workerCount + 1;
+    pool->slotCount = pool->partitionCount;
+    pool->channelCount = sc->channelCount;
+    pool->sampleRate = sc->sampleRate;
+    pool->busSamples = MIX_BUS_FRAMES * sc->channelCount;
+    pool->realtime = sc->realtime;
+    // everything is faulted in here, not in the callback
+    size_t busBytes = sizeof(float) * pool->partitionCount * MIX_GROUP_COUNT * pool->busSamples;
+    pool->buses = arena_alloc(sc->arena, busBytes, NULL);
+    memset(pool->buses, 0, busBytes);
+    uint16_t capacity = sc->voices.capacity;
+    for (uint8_t i = 0; i < pool->slotCount; ++i)
+    {
+        VoiceBlockSlot* slot = &pool->slots[i];
+        slot->jobs = arena_alloc(sc->arena, sizeof(VoiceJob) * capacity, NULL);
+        memset(slot->jobs, 0, sizeof(VoiceJob) * capacity);
+        uintptr_t voices = (uintptr_t)arena_alloc(sc->arena, sizeof(Voice) * capacity + 63, NULL);
+        slot->voices = (Voice*)((voices + 63) & ~(uintptr_t)63);
+        memset(slot->voices, 0, sizeof(Voice) * capacity);
+        slot->stretch = arena_alloc(sc->arena, sizeof(VoiceStretch) * capacity, NULL);
+        memset(slot->stretch, 0, sizeof(VoiceStretch) * capacity);
+        slot->buses = arena_alloc(sc->arena, busBytes, NULL);
+        memset(slot->buses, 0, busBytes);
+    }
+    sc->workers = pool;
+
+    for (uint8_t i = 0; i < workerCount; ++i)
+    {
+        pool->threadArgs[i] = (VoiceWorkerThread){ .pool = pool, .index = i };
+        if (pthread_create(&pool->threads[i], NULL, voice_worker_run, &pool->threadArgs[i]) != 0)
+        {
+            printf(MAGENTA "\t\tWARNING: Voice worker %u failed to start, running with %u\n" RESET, i, i);
+            break;
+        }
+        ++pool->workerCount;
+    }
+    if (pool->workerCount == 0)
+    {
+        sc->workers = NULL;
+        return false;
+    }
+    for (uint8_t i = 0; i < pool->workerCount && pool->realtime.enabled; ++i)
+    {
+        int cpu = voice_worker_realtime(pool, i);
+        if (cpu >= 0)
+            printf(BOLD_GREEN "\tVoice worker %u on core %d at SCHED_FIFO priority %d\n" RESET, i, cpu, pool->realtime.priority);
+        else
+            printf(MAGENTA "\t\tWARNING: Voice worker %u left at SCHED_OTHER, it only goes SCHED_FIFO pinned off the audio core\n" RESET, i);
+    }
+    // partitions stay at workers + 1 even if some failed, the audio thread renders what isn't claimed
+    printf(BOLD_CYAN "Voice rendering split over %u workers and the audio thread\n" RESET, pool->workerCount);
+    return true;
+}
+
+static void voice_workers_stop(VoiceWorkerPool* pool)
+{
+    atomic_store_explicit(&pool->running, false, memory_order_relaxed);
+    voice_workers_wake(pool);
+    for (uint8_t i = 0; i < pool->workerCount; ++i)
+        pthread_join(pool->threads[i], NULL);
+}
+
+void voice_workers_report(SoundController* sc)
+{
+    if (sc->workers == NULL)
+        return;
+    uint32_t taken = atomic_exchange_explicit(&sc->workers->taken, 0, memory_order_relaxed);
+    if (taken > 0)
+        printf(MAGENTA "\t\tWARNING: %u voice partitions taken back from late workers\n" RESET, taken);
+}
+
+// A slot no worker holds, there is always one as each worker holds at most one
+static uint8_t voice_block_slot_free(VoiceWorkerPool* pool)
+{
+    for (uint8_t i = 0; i < pool->slotCount; ++i)
+    {
+        bool held = false;
+        for (uint8_t w = 0; w < pool->workerCount && !held; ++w)
+            held = atomic_load_explicit(&pool->holding[w], memory_order_seq_cst) == i + 1;
+        if (!held)
+            return i;
+    }
+    assert(false && "ERROR every block slot is held by a worker");
+    return 0;
+}
+
+/* Hands the block to the workers, renders whatever partitions are left itself then sums the partitions in order.
+A partition a worker has claimed is waited on until the deadline, after that the audio thread takes it and renders
+it from the pool. Voices a worker rendered are taken back from the slot */
+static void voice_jobs_render_parallel(VoiceWorkerPool* pool, const VoiceJob* jobs, uint32_t jobCount, uint32_t count, bool odd, bool timed,
+                                       const MixRouting* routing, float* out)
+{
+    uint64_t published = atomic_load_explicit(&pool->work, memory_order_relaxed);
+    uint8_t slotIndex = voice_block_slot_free(pool);
+    VoiceBlockSlot* slot = &pool->slots[slotIndex];
+    for (uint32_t i = 0; i < jobCount; ++i)
+    {
+        slot->jobs[i] = jobs[i];
+        slot->voices[i] = *jobs[i].voice;
+        slot->jobs[i].voice = &slot->voices[i];
+        if (jobs[i].stretch != NULL)
+        {
+            slot->stretch[i] = *jobs[i].stretch;
+            slot->jobs[i].stretch = &slot->stretch[i];
+        }
+    }
+    slot->jobCount = jobCount;
+    slot->count = count;
+    slot->odd = odd;
+    slot->timed = timed;
+    uint32_t generation = (uint32_t)(published >> 32) + 1;
+    for (uint8_t p = 0; p < pool->partitionCount; ++p)
+        atomic_store_explicit(&pool->partitions[p], (uint64_t)generation << 32 | VOICE_PARTITION_PENDING, memory_order_relaxed);
+    uint64_t start = monotonic_ns();
+    atomic_store_explicit(&pool->work, (uint64_t)generation << 32 | (uint64_t)slotIndex << 16, memory_order_seq_cst);
+    if (atomic_load_explicit(&pool->sleepers, memory_order_seq_cst) > 0)
+        voice_workers_wake(pool);
+
+    uint32_t partitionSamples = MIX_GROUP_COUNT * pool->busSamples;
+    uint32_t own = 0; // partitions rendered here, from the pool into pool->buses
+    uint64_t work;
+    while (voice_partition_claim(pool, generation, &work))
+    {
+        uint32_t p = (uint16_t)work;
+        pool->groupsUsed[p] = voice_jobs_render(jobs, p * jobCount / pool->partitionCount, (p + 1) * jobCount / pool->partitionCount,
+                                                pool->buses + p * partitionSamples, pool->busSamples, count, odd, timed);
+        own |= 1u << p;
+    }
+
+    uint64_t deadline = start + (uint64_t)(VOICE_WORKERS_DEADLINE * 1e9 * (count / pool->channelCount) / pool->sampleRate);
+    for (uint8_t p = 0; p < pool->partitionCount; ++p)
+    {
+        if (own & (1u << p))
+            continue;
+        uint64_t pending = (uint64_t)generation << 32 | VOICE_PARTITION_PENDING;
+        uint32_t spins = 0;
+        while (atomic_load_explicit(&pool->partitions[p], memory_order_acquire) == pending)
+        {
+            _mm_pause();
+            if (++spins % 64 != 0 || monotonic_ns() < deadline)
+                continue;
+            if (atomic_compare_exchange_strong_explicit(&pool->partitions[p], &pending, (uint64_t)generation << 32 | VOICE_PARTITION_TAKEN,
+                                                        memory_order_acquire, memory_order_acquire))
+            {
+                pool->groupsUsed[p] = voice_jobs_render(jobs, p * jobCount / pool->partitionCount, (p + 1) * jobCount / pool->partitionCount,
+                                                        pool->buses + p * partitionSamples, pool->busSamples, count, odd, timed);
+                own |= 1u << p;
+                atomic_fetch_add_explicit(&pool->taken, 1, memory_order_relaxed);
+            }
+            break;
+        }
+        if (own & (1u << p))
+            continue;
+        for (uint32_t i = p * jobCount / pool->partitionCount; i < (p + 1) * jobCount / pool->partitionCount; ++i)
+        {
+            *jobs[i].voice = slot->voices[i];
+            if (jobs[i].stretch != NULL)
+                *jobs[i].stretch = slot->stretch[i];
+        }
+    }
+
+    for (uint8_t g = 0; g < MIX_GROUP_COUNT; ++g)
+    {
+        float* sum = NULL;
+        for (uint8_t p = 0; p < pool->partitionCount; ++p)
+        {
+            bool here = own & (1u << p);
+            if (!((here ? pool->groupsUsed[p] : slot->groupsUsed[p]) & (1 << g)))
+                continue;
+            float* bus = (here ? pool->buses : slot->buses) + p * partitionSamples + g * pool->busSamples;
+            if (sum == NULL)
+                sum = bus;
+            else
+                mix_block_f32(sum, bus, count, 1.0f);
+        }
+        if (sum != NULL)
+            mix_block_f32(out, sum, count, routing->groupGain[g] * routing->masterGain);
+    }
+}
+
+/* Mixes every active voice into a segment of the period where the voice table doesn't change. Voices
+are summed into their group bus a block at a time, then each group bus is added to the output with the
+group and master gain. oddStart is set when the segment starts on a right channel sample */
+static void voices_render_segment(SoundController* s, const MixRouting* routing, float* out, uint32_t sampleCount, bool oddStart)
+{
+    VoiceJob* jobs = s->voiceJobs;
+    uint32_t jobCount = s->voices.liveCount;
+    for (uint16_t i = 0; i < jobCount; ++i)
+    {
+        VoiceSlot* slot = &s->voices.slots[s->voices.live[i]];
+        VoiceJob* job = &jobs[i];
+        job->voice = &s->voices.voices[s->voices.live[i]];
+        job->channelCount = s->channelCount;
+        job->stretch = NULL;
+        job->tempo = s->tempo.step;
+        if (slot->channel == VOICE_ONE_SHOT_CHANNEL)
+        {
+            job->group = 0;
+            job->left = 1.0f;
+            job->right = 1.0f;
+            continue;
+        }
+        // one shots play at their own speed, loops are held to the tempo
+        VoiceStretch* stretch = &s->voices.stretch[s->voices.live[i]];
+        if (s->tempo.step != VOICE_TEMPO_ONE || stretch->engaged)
+            job->stretch = stretch;
+        const MixChannel* channel = &routing->channels[slot->channel];
+        job->group = channel->group;
+        mix_channel_gains(channel, s->channelCount, &job->left, &job->right);
+    }
+
+    uint32_t busSamples = MIX_BUS_FRAMES * s->channelCount;
+    uint32_t pushed = 0;
+    while (pushed < sampleCount)
+    {
+        uint32_t count = sampleCount - pushed;
+        if (count > busSamples)
+            count = busSamples;
+        bool odd = oddStart ^ (pushed & 1);
+        bool timed = s->stretchBlock++ % VOICE_STRETCH_TIMED_BLOCKS == 0;
+
+        if (s->workers != NULL && jobCount > 1)
+            voice_jobs_render_parallel(s->workers, jobs, jobCount, count, odd, timed, routing, out + pushed);
+        else
+        {
+            uint8_t groupsUsed = voice_jobs_render(jobs, 0, jobCount, s->busScratch, busSamples, count, odd, timed);
+            for (uint8_t g = 0; g < MIX_GROUP_COUNT; ++g)
+                if (groupsUsed & (1 << g))
+                    mix_block_f32(out + pushed, s->busScratch + g * busSamples, count, routing->groupGain[g] * routing->masterGain);
+        }
+        pushed += count;
+    }
+}
+
+/* Master limiter */
+
+static float limiter_peak_f32(const float* in, uint32_t count, float peak)
+{
+    uint32_t i = 0;
+#if defined(__AVX__)
+    if (count >= 8)
+    {
+        __m256 sign8 = _mm256_set1_ps(-0.0f);
+        __m256 peak8 = _mm256_set1_ps(peak);
+        for (; i + 8 <= count; i += 8)
+            peak8 = _mm256_max_ps(peak8, _mm256_andnot_ps(sign8, _mm256_loadu_ps(in + i)));
+        float lanes[8];
+        _mm256_storeu_ps(lanes, peak8);
+        for (uint32_t j = 0; j < 8; ++j)
+            peak = lanes[j] > peak ? lanes[j] : peak;
+    }
+#endif
+    for (; i < count; ++i)
+        peak = fabsf(in[i]) > peak ? fabsf(in[i]) : peak;
+    return peak;
+}
+
+// out[i] = in[i] * gain with the gain stepping by slope each frame
+static void limiter_gain_f32(float* out, const float* in, uint32_t frameCount, uint8_t channelCount, float gain, float slope)
+{
+    uint32_t frame = 0;
+#if defined(__AVX__)
+    if (channelCount == 2)
+    {
+        __m256 offset8 = _mm256_mul_ps(_mm256_setr_ps(0, 0, 1, 1, 2, 2, 3, 3), _mm256_set1_ps(slope));
+        for (; frame + 4 <= frameCount; frame += 4)
+        {
+            __m256 gain8 = _mm256_add_ps(_mm256_set1_ps(gain + slope * frame), offset8);
+            _mm256_storeu_ps(out + frame * 2, _mm256_mul_ps(_mm256_loadu_ps(in + frame * 2), gain8));
+        }
     }
+#endif
+    for (; frame < frameCount; ++frame)
+        for (uint8_t c = 0; c < channelCount; ++c)
+            out[frame * channelCount + c] = in[frame * channelCount + c] * (gain + slope * frame);
+}
 
-    // Get total length in frames
-    ma_result result = ma_decoder_get_length_in_pcm_frames(&decoder, &total_frame_count);
-    if (result != MA_SUCCESS)
+// Rational approximation of tanh, x(27 + x^2) / (27 + 9x^2). Clamped to +-3 where it reaches +-1
+static void soft_clip_f32(float* buffer, uint32_t count)
+{
+    uint32_t i = 0;
+#if defined(__AVX__)
+    __m256 max8 = _mm256_set1_ps(3.0f);
+    __m256 min8 = _mm256_set1_ps(-3.0f);
+    __m256 c27 = _mm256_set1_ps(27.0f);
+    __m256 c9 = _mm256_set1_ps(9.0f);
+    for (; i + 8 <= count; i += 8)
     {
-        printf("Failed to get length of file: %s\n", filename);
-        ma_decoder_uninit(&decoder);
-        return NULL;
+        __m256 x = _mm256_max_ps(min8, _mm256_min_ps(max8, _mm256_loadu_ps(buffer + i)));
+        __m256 x2 = _mm256_mul_ps(x, x);
+        __m256 num = _mm256_mul_ps(x, _mm256_add_ps(c27, x2));
+        __m256 den = _mm256_add_ps(c27, _mm256_mul_ps(c9, x2));
+        _mm256_storeu_ps(buffer + i, _mm256_div_ps(num, den));
     }
-
-    Sample* sample = arena_alloc(soundController->arena, sizeof(Sample), NULL);
-    memset(sample, 0, sizeof(Sample));
-
-    size_t t = 0;
-    sample->length = total_frame_count;
-    sample->cursor = 0;
-    sample->volume = 1.0f;
-    sample->nextSample = -1;
-    sample->newSample = true;
-    sample->oneShot = false;
-    sample->index = index;
-    if (soundController->loopFrameLength == 0)
-        soundController->loopFrameLength = calculate_loop_frames(soundController->bpm, sampleRate, beatsPerBar, barsPerLoop);
-    // Allocate buffer
-    sample->buffer = arena_alloc(soundController->arena, total_frame_count * channelCount * sizeof(float), &t);
-    //printf("arena alloc %zu        \n", t);
-
-    if (sample->buffer == NULL)
+#endif
+    for (; i < count; ++i)
     {
-        printf("ERROR - Failed to allocate memory\n");
-        ma_decoder_uninit(&decoder);
-        return NULL;
+        float x = buffer[i] > 3.0f ? 3.0f : (buffer[i] < -3.0f ? -3.0f : buffer[i]);
+        buffer[i] = x * (27.0f + x * x) / (27.0f + 9.0f * x * x);
     }
+}
 
-    ma_uint64 frames_read = 0;
-    result = ma_decoder_read_pcm_frames(&decoder, sample->buffer, total_frame_count, &frames_read);
+/* Runs the period through the limiter in place. The output lags by LIMITER_LATENCY_FRAMES. The block leaving
+the delay was filled two blocks ago, its ramp ends at or under the gain both it and the block after it need.
+As the ramp starts at the end of the last one (under this blocks need too) every sample leaving is under the
+ceiling. A ceiling of 0 still runs the delay at unity so turning the limiter on and off doesn't jump */
+static void master_limiter_process(MasterLimiter* limiter, float* buffer, uint32_t frameCount, uint8_t channelCount, float ceiling)
+{
+    uint32_t frames = 0;
+    while (frames < frameCount)
+    {
+        uint32_t run = LIMITER_BLOCK_FRAMES - limiter->position;
+        if (frameCount - frames < run)
+            run = frameCount - frames;
+        float* in = buffer + frames * channelCount;
+        float* fill = limiter->delay + (limiter->block * LIMITER_BLOCK_FRAMES + limiter->position) * channelCount;
+        float* leaving = limiter->delay + (((limiter->block + 1) % 3) * LIMITER_BLOCK_FRAMES + limiter->position) * channelCount;
+
+        limiter->peak = limiter_peak_f32(in, run * channelCount, limiter->peak);
+        memcpy(fill, in, sizeof(float) * run * channelCount);
+        float slope = (limiter->gainEnd - limiter->gainStart) / LIMITER_BLOCK_FRAMES;
+        limiter_gain_f32(in, leaving, run, channelCount, limiter->gainStart + slope * limiter->position, slope);
+        limiter->position += run;
+        frames += run;
+
+        if (limiter->position == LIMITER_BLOCK_FRAMES)
+        {
+            float required = ceiling > 0.0f && limiter->peak > ceiling ? ceiling / limiter->peak : 1.0f;
+            float gain = limiter->gainEnd + (1.0f - limiter->gainEnd) * limiter->release;
+            if (limiter->required < gain)
+                gain = limiter->required;
+            if (required < gain)
+                gain = required;
+            limiter->gainStart = limiter->gainEnd;
+            limiter->gainEnd = gain;
+            limiter->required = required;
+            limiter->peak = 0.0f;
+            limiter->position = 0;
+            limiter->block = (limiter->block + 1) % 3;
+        }
+    }
+}
 
-    if (result != MA_SUCCESS || frames_read != total_frame_count)
-        printf("WARNING: Only read %llu of %llu frames\n", frames_read, total_frame_count);
+// Moves what stretching each voice cost this period over to the totals the ts command reads
+static void stretch_cost_collect(SoundController* s)
+{
+    VoicePool* pool = &s->voices;
+    uint64_t nanoseconds = 0;
+    uint64_t frames = 0;
+    uint32_t peak = 0;
+    for (uint16_t i = 0; i < pool->liveCount; ++i)
+    {
+        VoiceStretch* stretch = &pool->stretch[pool->live[i]];
+        if (stretch->frames == 0)
+            continue;
+        nanoseconds += stretch->nanoseconds;
+        frames += stretch->frames;
+        peak = stretch->peak > peak ? stretch->peak : peak;
+        stretch->nanoseconds = 0;
+        stretch->frames = 0;
+        stretch->peak = 0;
+    }
+    if (frames == 0)
+        return;
+    atomic_fetch_add_explicit(&s->stretchNanoseconds, nanoseconds, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s->stretchFrames, frames, memory_order_relaxed);
+    if (peak > atomic_load_explicit(&s->stretchPeak, memory_order_relaxed))
+        atomic_store_explicit(&s->stretchPeak, peak, memory_order_relaxed);
+}
 
-    ma_decoder_uninit(&decoder);
+/* Callback timing */
 
-    return sample;
+static uint32_t callback_histogram_bucket(uint64_t nanoseconds)
+{
+    if (nanoseconds < (1ull << CALLBACK_HISTOGRAM_MIN_SHIFT))
+        return 0;
+    uint32_t octave = 63 - __builtin_clzll(nanoseconds);
+    uint32_t sub = (nanoseconds >> (octave - CALLBACK_HISTOGRAM_SUB_BITS)) & ((1 << CALLBACK_HISTOGRAM_SUB_BITS) - 1);
+    uint32_t bucket = 1 + ((octave - CALLBACK_HISTOGRAM_MIN_SHIFT) << CALLBACK_HISTOGRAM_SUB_BITS) + sub;
+    return bucket < CALLBACK_HISTOGRAM_BUCKETS ? bucket : CALLBACK_HISTOGRAM_BUCKETS - 1;
 }
 
-
-SoundController* sound_controller_init(float bpm, const char* loadDirectory, uint8_t beatsPerBar, uint8_t barsPerLoop, uint16_t sampleRate, uint8_t channelCount, ma_format format, uint8_t synthMax, MIDI_Controller* midiController)
+// the longest duration counted into the bucket
+static uint64_t callback_histogram_upper(uint32_t bucket)
 {
-    DIR *dir;
-    struct dirent *entry;
+    if (bucket == 0)
+        return 1ull << CALLBACK_HISTOGRAM_MIN_SHIFT;
+    uint32_t octave = CALLBACK_HISTOGRAM_MIN_SHIFT + ((bucket - 1) >> CALLBACK_HISTOGRAM_SUB_BITS);
+    uint32_t sub = (bucket - 1) & ((1 << CALLBACK_HISTOGRAM_SUB_BITS) - 1);
+    return (uint64_t)((1 << CALLBACK_HISTOGRAM_SUB_BITS) + sub + 1) << (octave - CALLBACK_HISTOGRAM_SUB_BITS);
+}
 
-    dir = opendir(loadDirectory);
+// Audio thread, the last thing the callback does. The record is filled in before the count that publishes it
+static void callback_timing_record(SoundController* s, uint64_t entry, uint32_t frameCount, uint8_t synths)
+{
+    CallbackTiming* timing = s->timing;
+    uint64_t duration = monotonic_ns() - entry;
+    uint32_t budget = (uint32_t)((uint64_t)frameCount * 1000000000ull / s->sampleRate);
 
-    // first counting how many samples
-    uint16_t sampleCount = 0;
-    while ((entry = readdir(dir)) != NULL)
+    uint8_t flags = 0;
+    if (duration > budget * FLIGHT_RECORDER_THRESHOLD)
     {
-        if (entry->d_name[0] != '.')
-            sampleCount++;
+        flags |= CALLBACK_RECORD_OVERRUN;
+        atomic_fetch_add_explicit(&timing->overruns, 1, memory_order_relaxed);
     }
-    rewinddir(dir);
+    if (atomic_exchange_explicit(&timing->xrunPending, 0, memory_order_relaxed))
+        flags |= CALLBACK_RECORD_XRUN;
+
+    uint64_t count = atomic_load_explicit(&timing->recordCount, memory_order_relaxed);
+    CallbackRecord* record = &timing->records[count & (FLIGHT_RECORDER_RECORDS - 1)];
+    record->start = entry;
+    record->duration = duration > UINT32_MAX ? UINT32_MAX : (uint32_t)duration;
+    record->budget = budget;
+    record->frames = frameCount > UINT16_MAX ? UINT16_MAX : frameCount;
+    record->voices = s->voices.liveCount;
+    record->synths = synths;
+    record->midiClocks = timing->midiClocks;
+    record->events = timing->events;
+    record->flags = flags;
+    atomic_store_explicit(&timing->recordCount, count + 1, memory_order_release);
+    timing->midiClocks = 0;
+    timing->events = 0;
+
+    atomic_fetch_add_explicit(&timing->histogram[callback_histogram_bucket(duration)], 1, memory_order_relaxed);
+    uint64_t max = atomic_load_explicit(&timing->maxDuration, memory_order_relaxed);
+    while (duration > max && !atomic_compare_exchange_weak_explicit(&timing->maxDuration, &max, duration, memory_order_relaxed, memory_order_relaxed))
+        ;
+    atomic_store_explicit(&timing->budget, budget, memory_order_relaxed);
+    if (flags != 0 && atomic_load_explicit(&timing->dumpRequest, memory_order_relaxed) == 0)
+        atomic_store_explicit(&timing->dumpRequest, count + 1, memory_order_release);
+}
 
-    Arena* arena = arena_init(ARENA_BLOCK_SIZE, 32, false);
-    SoundController* sController = arena_alloc(arena, sizeof(SoundController), NULL);
-    memset(sController, 0, sizeof(SoundController));
-    sController->arena = arena;
-    sController->midiController = midiController == NULL ? NULL : midiController;
-    sController->sampleCount = sampleCount;
-    sController->bpm = bpm;
-    sController->activeCount = 0;
-    sController->loopFrameLength = 0;
-    sController->globalCursor = 0;
-    sController->beatCount = 0;
-    sController->oneShotCount = 0;
-    sController->channelCount = channelCount;
-    sController->newQueued = false;
-    for(uint32_t i = 0; i < MAX_ACTIVE_SAMPLES; ++i)
-        sController->activeIndex[i] = NO_ACTIVE_SAMPLE;
-    sController->activeSamples = arena_alloc(arena, sizeof(Sample*) * MAX_ACTIVE_SAMPLES, NULL);
-    for(uint32_t i = 0; i < MAX_ACTIVE_SAMPLES; ++i)
-        sController->activeSamples[i] = NULL;
-    sController->oneShotActive = arena_alloc(arena, sizeof(Sample*) * MAX_ACTIVE_ONE_SHOT, NULL);
-    for(uint32_t i = 0; i < MAX_ACTIVE_ONE_SHOT; ++i)
-        sController->oneShotActive[i] = NULL;
-    sController->samples = arena_alloc(arena, sizeof(Sample*) * sampleCount, NULL);
+// Ran on whichever thread miniaudio logs from. Only the ALSA backend logs its underruns, as EPIPE
+static void callback_xrun_log(void* pUserData, ma_uint32 level, const char* pMessage)
+{
+    (void)level;
+    SoundController* sc = pUserData;
+    if (strstr(pMessage, "EPIPE (write)") == NULL && strstr(pMessage, "underrun") == NULL)
+        return;
+    atomic_fetch_add_explicit(&sc->timing->xruns, 1, memory_order_relaxed);
+    atomic_store_explicit(&sc->timing->xrunPending, 1, memory_order_relaxed);
+}
 
-    uint16_t i = 0;
-    while ((entry = readdir(dir)) != NULL)
-    {
-        if (entry->d_name[0] != '.')
-        {
-            char buffer[strlen(entry->d_name) + strlen(loadDirectory) + 1];
-            memcpy(buffer, loadDirectory, strlen(loadDirectory));
-            memcpy(buffer + strlen(loadDirectory), entry->d_name, strlen(entry->d_name) + 1);
-            switch(format)
-            {
-            case 5:
-                sController->samples[i] = sample_F32_load(sController, buffer, i, beatsPerBar, barsPerLoop, sampleRate, channelCount);
-                break;
-            default:
-                assert(false && "given format invalid\n");
-            }
-            strncpy(sController->samples[i++]->name, entry->d_name, strlen(entry->d_name) -4 < 32 ? strlen(entry->d_name) -4 : 31);
-        }
-    }
+void callback_xrun_log_attach(SoundController* sc, ma_log* log)
+{
+    if (ma_log_register_callback(log, ma_log_callback_init(callback_xrun_log, sc)) != MA_SUCCESS)
+        printf(MAGENTA "\t\tWARNING: Couldn't listen to miniaudio's log, xruns won't be reported\n" RESET);
+}
 
-    char formatStr[16];
-    switch(format)
+/* Writes the records still in the ring oldest first. They're copied out and the count read again after,
+anything the audio thread could have written over while copying is left out */
+static void flight_recorder_dump(SoundController* sc, uint64_t trigger)
+{
+    CallbackTiming* timing = sc->timing;
+    uint64_t end = atomic_load_explicit(&timing->recordCount, memory_order_acquire);
+    if (end == 0)
     {
-    case 5:
-        strcpy(formatStr, "32-bit float");
-        break;
-    default:
-        assert(false && "given format invalid\n");
+        printf(MAGENTA "\t\tWARNING: No callbacks recorded yet\n" RESET);
+        return;
     }
-
-    if (synthMax > 0)
+    CallbackRecord* records = malloc(sizeof(CallbackRecord) * FLIGHT_RECORDER_RECORDS);
+    if (records == NULL)
+        return;
+    uint64_t first = end > FLIGHT_RECORDER_RECORDS ? end - FLIGHT_RECORDER_RECORDS : 0;
+    for (uint64_t i = first; i < end; ++i)
+        records[i - first] = timing->records[i & (FLIGHT_RECORDER_RECORDS - 1)];
+    uint64_t written = atomic_load_explicit(&timing->recordCount, memory_order_acquire);
+    uint64_t from = written > FLIGHT_RECORDER_RECORDS && written - FLIGHT_RECORDER_RECORDS > first ? written - FLIGHT_RECORDER_RECORDS : first;
+    // the record that asked for the dump is the time everything is given against, the newest if it's been written over
+    CallbackRecord reason = trigger > from && trigger <= end ? records[trigger - 1 - first] : records[end - 1 - first];
+
+    char path[64];
+    snprintf(path, sizeof(path), FLIGHT_RECORDER_FILE, timing->dumpCount++);
+    FILE* file = fopen(path, "w");
+    if (file == NULL)
     {
-        sController->synth = arena_alloc(arena, sizeof(Synth*) * synthMax, NULL);
-        sController->synthMax = synthMax;
-        sController->synthCount = 0;
+        printf(MAGENTA "\t\tWARNING: Couldn't write the flight recorder to %s (%s)\n" RESET, path, strerror(errno));
+        free(records);
+        return;
     }
-    else
+    fprintf(file, "period,ms_from_trigger,since_last_us,duration_us,budget_us,load_percent,frames,voices,synths,midi_clocks,events,overrun,xrun\n");
+    for (uint64_t i = from; i < end; ++i)
     {
-        sController->synth = NULL;
-        sController->synthMax = 0;
-        sController->synthCount = 0;
+        const CallbackRecord* r = &records[i - first];
+        double sinceLast = i > from ? (r->start - records[i - 1 - first].start) / 1e3 : 0.0;
+        fprintf(file, "%llu,%.3f,%.1f,%.1f,%.1f,%.1f,%u,%u,%u,%u,%u,%u,%u\n", (unsigned long long)i,
+                ((double)r->start - (double)reason.start) / 1e6, sinceLast, r->duration / 1e3, r->budget / 1e3,
+                r->budget > 0 ? 100.0 * r->duration / r->budget : 0.0, r->frames, r->voices, r->synths, r->midiClocks, r->events,
+                (r->flags & CALLBACK_RECORD_OVERRUN) != 0, (r->flags & CALLBACK_RECORD_XRUN) != 0);
     }
+    fclose(file);
+    free(records);
+
+    if (reason.flags & CALLBACK_RECORD_XRUN)
+        printf(BOLD_MAGENTA "\t\tWARNING: miniaudio reported an xrun, the last %llu periods are in %s\n" RESET, (unsigned long long)(end - from), path);
+    else if (reason.flags & CALLBACK_RECORD_OVERRUN)
+        printf(BOLD_MAGENTA "\t\tWARNING: Audio callback took %0.3f ms of its %0.3f ms period, the last %llu periods are in %s\n" RESET,
+               reason.duration / 1e6, reason.budget / 1e6, (unsigned long long)(end - from), path);
+    else
+        printf(BOLD_GREEN "\t\tThe last %llu periods are in %s\n" RESET, (unsigned long long)(end - from), path);
+}
 
-    printf(BOLD_CYAN "\nSuccessfully loading of session at %s - Sample rate: %u, Channels: %u, Format: %s, BPM: %0.2f, Beats per loop: %u (frames: %u)\n\n" RESET BOLD_MAGENTA "Memory for %u Synths\n\n"RESET BOLD_YELLOW "Samples:\n" RESET,
-           loadDirectory, sampleRate, channelCount, formatStr, sController->bpm, (beatsPerBar * barsPerLoop) /2, sController->loopFrameLength, synthMax);
-    for (uint32_t j = 0; j < sController->sampleCount; ++j)
-        printf(YELLOW "  %s (%u Sample Count - %u length in sec)\n" RESET, sController->samples[j]->name, sController->samples[j]->length,
-               sController->samples[j]->length / sampleRate);
-    if (midiController != NULL)
+void callback_timing_report(SoundController* sc)
+{
+    CallbackTiming* timing = sc->timing;
+    uint64_t trigger = atomic_load_explicit(&timing->dumpRequest, memory_order_acquire);
+    if (trigger == 0)
+        return;
+
+    uint64_t now = monotonic_ns();
+    if (now >= timing->dumpAllowedAt)
     {
-        printf(BOLD_GREEN "\nMidi Interface successfully attached. With Connection to channals:" RESET);
-        for(uint8_t i = 0; i < MIDI_MAX_CHANNELS; ++i)
-        {
-            if (midiController->active_channels & (1<<i))
-                printf(BOLD_GREEN " %u" RESET, i +1);
-        }
-        printf("\n\n");
+        flight_recorder_dump(sc, trigger);
+        timing->dumpAllowedAt = now + FLIGHT_RECORDER_COOLDOWN_NS;
     }
-    closedir(dir);
-
-    return sController;
+    atomic_store_explicit(&timing->dumpRequest, 0, memory_order_release);
 }
 
+void stream_report(SoundController* sc)
+{
+    SampleStreamer* streamer = sc->voices.streamer;
+    if (streamer == NULL)
+        return;
+    uint32_t underruns = atomic_exchange_explicit(&streamer->underruns, 0, memory_order_relaxed);
+    uint32_t missed = atomic_exchange_explicit(&streamer->ringsMissed, 0, memory_order_relaxed);
+    uint32_t failures = atomic_exchange_explicit(&streamer->failures, 0, memory_order_relaxed);
+    if (underruns > 0)
+        printf(MAGENTA "\t\tWARNING: Disk streaming fell behind the cursor for %u periods\n" RESET, underruns);
+    if (missed > 0)
+        printf(MAGENTA "\t\tWARNING: No stream ring free for %u launches, only their first %u frames played\n" RESET, missed, STREAM_HEAD_FRAMES);
+    if (failures > 0)
+        printf(MAGENTA "\t\tWARNING: %u streamed file reads failed, played as silence\n" RESET, failures);
+}
 
-
-void sound_controller_destroy(SoundController* sc)
+#ifndef NDEBUG
+// Checked on the audio thread once the period's commands and retirements are done, the only time the pool holds still
+static uint32_t voice_pool_faults(const VoicePool* pool)
 {
-    if (sc->midiController != NULL)
-        midi_controller_destrory(sc->midiController);
-    arena_destroy(sc->arena);
+    uint32_t faults = 0;
+    for (uint16_t i = 0; i < pool->liveCount; ++i)
+    {
+        const VoiceSlot* slot = &pool->slots[pool->live[i]];
+        if (slot->live != i)
+            faults |= VOICE_POOL_LIVE_INDEX;
+        if (pool->voices[pool->live[i]].sample == NULL)
+            faults |= VOICE_POOL_NO_SAMPLE;
+        if (slot->channel != VOICE_ONE_SHOT_CHANNEL && pool->channelVoice[slot->channel] != pool->live[i])
+            faults |= VOICE_POOL_CHANNEL;
+    }
+    uint32_t freeCount = 0;
+    for (uint16_t voice = pool->freeHead; voice != VOICE_NONE && freeCount <= pool->capacity; voice = pool->slots[voice].nextFree)
+        ++freeCount;
+    if (freeCount + pool->liveCount != pool->capacity)
+        faults |= VOICE_POOL_LOST;
+    return faults;
 }
+#endif
 
 bool synth_buffer_being_read(Synth* synth);
 void synth_frames_read(Synth *synth);
 void data_callback_f32(ma_device* pDevice, void* pOutput, const void* pInput, ma_uint32 frameCount)
 {
+    uint64_t entry = monotonic_ns();
     //printf("FrameCount: %u\n", frameCount);
     SoundController* s = (SoundController*)pDevice->pUserData;
-    if (s->activeCount == 0 && s->oneShotCount == 0 && s->synthCount == 0) return;
-
-    uint8_t count = s->activeCount;
-    uint8_t oneShotCount = s->oneShotCount;
-    Sample* activeSamples[count + oneShotCount];
-    for (uint8_t i = 0; i < count; ++i)
-        activeSamples[i] = s->activeSamples[s->activeIndex[i]];
-    //One shot
-    for (uint8_t i = 0; i < oneShotCount; ++i)
-        activeSamples[count++] = s->oneShotActive[i];
-
+    if (s->realtime.enabled && !(atomic_load_explicit(&s->realtimeStatus, memory_order_relaxed) & REALTIME_STATUS_DONE))
+        realtime_audio_thread_setup(s);
+    MixSnapshot* mix = mix_snapshot_acquire(s);
+    assert(mix != NULL && "ERROR: no mix snapshot, sound_controller_init publishes the first");
+    if (s->scheduler->waitingCount > 0)
+        voice_commands_unpark(s);
 
     float* pOutputF32 = (float*)pOutput;
     uint32_t pushedFrames = 0;
 
     uint8_t channelCount = s->channelCount;
-
-    while(pushedFrames < frameCount * channelCount)
+    uint32_t sampleCount = frameCount * channelCount;
+
+    // the period is split at each scheduled event and tempo ramp step, so they land on their exact frame with
+    // nothing checked per sample. The transport moves on with each segment so a tempo change rescales it from there
+    uint64_t periodStart = s->transportFrame;
+    EventScheduler* scheduler = s->scheduler;
+    TempoState* tempo = &s->tempo;
+    while (pushedFrames < sampleCount)
     {
-        for(uint i = 0; i < count; ++i)
-        {
-            float volume = activeSamples[i]->volume;
-            if (!activeSamples[i]->oneShot)
-            {
-                if (!s->newQueued)
-                    pOutputF32[pushedFrames] += activeSamples[i]->buffer[activeSamples[i]->cursor++] * volume;
-                else
-                {
-                    if (!activeSamples[i]->newSample)
-                        pOutputF32[pushedFrames] += activeSamples[i]->buffer[activeSamples[i]->cursor++] * volume;
-                    else if (s->globalCursor == 0)
-                    {
-                        pOutputF32[pushedFrames] += activeSamples[i]->buffer[activeSamples[i]->cursor++] * volume;
-                        activeSamples[i]->newSample = false;
-                    }
-                }
-
-                if(activeSamples[i]->cursor > activeSamples[i]->length)
-                    activeSamples[i]->cursor = 0;
-                if (activeSamples[i]->nextSample >= 0 && activeSamples[i]->cursor % s->loopFrameLength == 0)// to swap in queued sample of start of the next bar
-                {
-                    uint16_t index = (uint16_t)activeSamples[i]->nextSample;    // current active sample will have the nextSample set at the index of the queued sample where it appears in s->**samples
-                    Sample* swap = s->samples[index];
-                    s->activeSamples[swap->nextSample] = swap;      // next sample of the incomping sample is loaded with the channel
-                    swap->nextSample = -1;                        // resetting next sample of the incoming sample
-                    activeSamples[i] = swap;
-                }
-            }
-            else //One Shot
-            {
-                if(activeSamples[i]->cursor > activeSamples[i]->length)
-                    continue;
-
-                if (!s->newQueued)
-                    pOutputF32[pushedFrames] += activeSamples[i]->buffer[activeSamples[i]->cursor++] * volume;
-                else
-                {
-                    if (!activeSamples[i]->newSample)
-                        pOutputF32[pushedFrames] += activeSamples[i]->buffer[activeSamples[i]->cursor++] * volume;
-                    else if (s->globalCursor == 0)
-                    {
-                        pOutputF32[pushedFrames] += activeSamples[i]->buffer[activeSamples[i]->cursor++] * volume;
-                        activeSamples[i]->newSample = false;
-                    }
-                }
-            }
-        }
-
-        ++pushedFrames;
-
-        if (s->globalCursor == 0)
-        {
-            s->newQueued = false;       //as all the queued samples would be playing due to loop around the bar, we can turn the flag off
-            s->beatCount = 1;
-            printf("\r    Loop 4/4        ");
-            fflush(stdout);
-        }
-        else if (s->globalCursor % (s->loopFrameLength /4)== 0)
-        {
-            printf("\r    Loop %u/%u        ", s->beatCount++, 4);
-            fflush(stdout);
-        }
-        else
-        {
-            printf("\r    Loop %u/%u        ", s->beatCount, 4);
-            fflush(stdout);
-        }
-
-        //for MIDI_Clock
-        if (s->globalCursor % (s->loopFrameLength / (MIDI_TICKS_PER_BAR)) == 0 && s->midiController != NULL)
+        while (scheduler->count > 0 && scheduler->events[0].frame <= periodStart + pushedFrames)
         {
-            midi_command_clock(s->midiController);
-            //printf("clock and command count: %u\n", s->midiController->command_count);
+            ScheduledEvent event;
+            event_scheduler_pop(scheduler, &event);
+            voice_command_apply(s, &event.command);
         }
-        ++s->globalCursor;
-        if (s->globalCursor > s->loopFrameLength)
-            s->globalCursor = 0;
+        if (tempo->rampBars > 0 && tempo->rampNext <= s->transportFrame)
+            tempo_ramp_step(s);
+
+        uint32_t segmentEnd = sampleCount;
+        if (scheduler->count > 0 && scheduler->events[0].frame < periodStart + sampleCount)
+            segmentEnd = (uint32_t)(scheduler->events[0].frame - periodStart);
+        if (tempo->rampBars > 0 && tempo->rampNext < periodStart + segmentEnd)
+            segmentEnd = (uint32_t)(tempo->rampNext - periodStart);
+        voices_render_segment(s, &mix->routing, pOutputF32 + pushedFrames, segmentEnd - pushedFrames, pushedFrames & 1);
+        transport_advance(s, segmentEnd - pushedFrames);
+        pushedFrames = segmentEnd;
     }
+    stream_rings_update(s);
+    one_shot_retire(s);
+    stretch_cost_collect(s);
+#ifndef NDEBUG
+    uint32_t poolFaults = voice_pool_faults(&s->voices);
+    if (poolFaults != 0)
+        atomic_fetch_or_explicit(&s->poolFaults, poolFaults, memory_order_relaxed);
+#endif
+
+    // publishing the position once per period, the main loop prints it (no stdio on the audio thread)
+    atomic_store_explicit(&s->transport, transport_pack(s->globalCursor, s->beatCount, s->loopCount), memory_order_release);
+    atomic_store_explicit(&s->tempoBpm, tempo->bpm, memory_order_relaxed);
+    channel_feed_publish(s);
+
     // Synth audio pushing
-    if (s->synthCount > 0)
+    for (uint8_t i = 0; i < mix->synthCount; ++i)
     {
-        for (uint8_t i = 0; i < s->synthCount; ++i)
-        {
-            Synth* synth = s->synth[i];
-            if(!synth_buffer_being_read(synth))
-                continue;
-            float volume = synth->volume;
-            pushedFrames = 0;
+        Synth* synth = mix->synth[i];
+        if(!synth_buffer_being_read(synth))
+            continue;
+        float volume = mix->synthVolume[i];
+        pushedFrames = 0;
 
-            while(pushedFrames < frameCount * channelCount)
+        while(pushedFrames < sampleCount)
+        {
+            uint32_t run = sampleCount - pushedFrames;
+            if (synth->bufferMax - synth->cursor < run)
+                run = synth->bufferMax - synth->cursor;
+            mix_block_f32(pOutputF32 + pushedFrames, synth->buffer + synth->cursor, run, volume);
+            pushedFrames += run;
+            synth->cursor += run;
+            if (synth->cursor >= synth->bufferMax)
             {
-                pOutputF32[pushedFrames++] += synth->buffer[synth->cursor++] * volume;
-                if (synth->cursor > synth->bufferMax)
-                {
-                    synth->cursor = 0;
-                    printf("WARNING - synth[%u] cursor wrapped around\n", i);
-                }
+                synth->cursor = 0;
+                synth->audio_thread_flags |= SYNTH_BUFFER_WRAPPED; // warning printed by the main thread
             }
-            synth_frames_read(synth);
         }
+        synth_frames_read(synth);
     }
 
+    master_limiter_process(&s->limiter, pOutputF32, frameCount, channelCount, mix->routing.limiterCeiling);
+    if (mix->routing.softClip)
+        soft_clip_f32(pOutputF32, sampleCount);
+
+    callback_timing_record(s, entry, frameCount, mix->synthCount);
     (void)pDevice;
     (void)pOutput;
 }
@@ -351,6 +4420,7 @@ int input_controller_init(InputController* ic, uint32_t inputDeviceIndex)
     char buffer[64];
     snprintf(buffer, sizeof(buffer), "/dev/input/event%u", inputDeviceIndex);
     printf("%s\n", buffer);
+    ic->launchQuantize = (Quantize){ QUANTIZE_BARS, 1 };
     ic->inputFile = open(buffer, O_RDONLY | O_NONBLOCK);
     if (ic->inputFile == -1)
     {
@@ -408,14 +4478,83 @@ void poll_keyboard(InputController* ic)
 }
 
 
+// "0" now, "b" next beat, "<bars>" next bar lined up to that many bars
+bool quantize_parse(const char* str, Quantize* quantize)
+{
+    if (strcmp(str, "b") == 0)
+    {
+        *quantize = (Quantize){ QUANTIZE_BEAT, 0 };
+        return true;
+    }
+    if (strlen(str) == 0 || strlen(str) > 3)
+        return false;
+    for (uint32_t i = 0; i < strlen(str); ++i)
+        if (!isdigit(str[i]))
+            return false;
+
+    uint16_t bars = atoi(str);
+    *quantize = bars == 0 ? (Quantize){ QUANTIZE_IMMEDIATE, 0 } : (Quantize){ QUANTIZE_BARS, bars };
+    return true;
+}
+
+const char* quantize_describe(Quantize quantize, char* buffer, size_t size)
+{
+    switch (quantize.type)
+    {
+    case QUANTIZE_IMMEDIATE:
+        snprintf(buffer, size, "now");
+        break;
+    case QUANTIZE_BEAT:
+        snprintf(buffer, size, "next beat");
+        break;
+    case QUANTIZE_BARS:
+        if (quantize.bars <= 1)
+            snprintf(buffer, size, "next bar");
+        else
+            snprintf(buffer, size, "next %u bars", quantize.bars);
+        break;
+    }
+    return buffer;
+}
+
+// Strips a quantize suffix (l3c2q4, k2qb) off the command. quantize is left as it is when there is no suffix
+bool command_quantize_suffix(InputController* ic, Quantize* quantize)
+{
+    char* suffix = strchr(ic->command +1, 'q');
+    if (suffix == NULL)
+        return true;
+
+    if (!quantize_parse(suffix +1, quantize))
+    {
+        printf(MAGENTA "\t\tWARNING: Invalid quantize (q0 - now | qb - next beat | q<bars> - next bars). Command: %s\n" RESET, ic->command);
+        return false;
+    }
+    *suffix = '\0';
+    ic->commandIndex = strlen(ic->command);
+    return true;
+}
+
+void command_quantize(InputController* ic)
+{
+    //q4 - launches default to the next 4 bars
+    char description[16];
+    if (!quantize_parse(ic->command +1, &ic->launchQuantize))
+    {
+        printf(MAGENTA "\t\tWARNING: Invalid quantize (q0 - now | qb - next beat | q<bars> - next bars). Command: %s\n" RESET, ic->command);
+        return;
+    }
+    printf(BOLD_GREEN "\t\tLaunches quantized to the %s\n" RESET, quantize_describe(ic->launchQuantize, description, sizeof(description)));
+}
+
 int command_quit(InputController* ic, SoundController* sc)
 {
     bool active = false;
-    for (uint32_t i = 0; i < MAX_ACTIVE_SAMPLES; ++i)
+    for (uint32_t i = 0; i < MAX_CHANNELS; ++i)
     {
-        if (sc->activeSamples[sc->activeIndex[i]] != NULL)
+        const Sample* sample = channel_feed_sample(sc, i);
+        if (sample != NULL)
         {
-            printf(BOLD_MAGENTA "\t\tWARNING: Stopping active sample on Channel %u (%s) before quitting\n" RESET, sc->activeIndex[i], sc->activeSamples[sc->activeIndex[i]]->name);
+            printf(BOLD_MAGENTA "\t\tWARNING: Stopping active sample on Channel %u (%s) before quitting\n" RESET, i, sample->name);
             active = true;
         }
     }
@@ -425,57 +4564,42 @@ int command_quit(InputController* ic, SoundController* sc)
         return END_MISSION;
 }
 
-void command_kill_all(SoundController* sc)
+void command_kill_all(SoundController* sc, Quantize quantize)
 {
-    if (sc->activeCount == 0)
+    bool active = false;
+    for (uint32_t i = 0; i < MAX_CHANNELS; ++i)
+    {
+        const Sample* sample = channel_feed_sample(sc, i);
+        if (sample != NULL)
+        {
+            printf(CYAN"\t\tKilling active sample on Channel %u (%s)\n" RESET, i, sample->name);
+            active = true;
+        }
+    }
+    if (!active)
     {
-        for (uint32_t i = 0; i < MAX_ACTIVE_SAMPLES; ++i)
-            if (sc->activeSamples[i] != NULL)
-                assert(false && "ERROR: active samples count is 0 but active index not cleared");
         printf(MAGENTA "\t\tCurrently no active samples\n" RESET);
         return;
     }
 
-    for (uint32_t i = 0; i < MAX_ACTIVE_SAMPLES; ++i)
-    {
-        if (sc->activeSamples[i] != NULL)
-        {
-            printf(CYAN"\t\tKilling active sample on Channel %u (%s)\n" RESET, i, sc->activeSamples[i]->name);
-            sc->activeSamples[i] = NULL;
-        }
-
-        sc->activeIndex[i] = NO_ACTIVE_SAMPLE;
-    }
-    printf(BOLD_CYAN "\t\tAll active samples killed\n" RESET);
-    sc->activeCount = 0;
+    if (voice_command_push(sc, (VoiceCommand){ .type = VOICE_COMMAND_KILL_ALL, .quantize = quantize }))
+        printf(BOLD_CYAN "\t\tAll active samples killed\n" RESET);
 }
 
-void active_channel_kill(SoundController* sc, uint8_t channel)
+void active_channel_kill(SoundController* sc, uint8_t channel, Quantize quantize)
 {
-    if (sc->activeSamples[channel] == NULL)
+    const Sample* sample = channel < MAX_CHANNELS ? channel_feed_sample(sc, channel) : NULL;
+    if (sample == NULL)
     {
         printf(MAGENTA "\t\tWARNING: Channel %u already inactive\n" RESET, channel);
         return;
     }
 
-    bool found = false;
-    for (uint16_t i = 0; i < sc->activeCount; i++)
-    {
-        if (sc->activeIndex[i] == channel)
-        {
-            found = true;
-            printf(BOLD_CYAN "\t\tKilling active sample on Channel %u (%s)\n" RESET, channel, sc->activeSamples[channel]->name);
-            sc->activeSamples[channel] = NULL;
-            for (uint16_t j = i; j < sc->sampleCount; ++j)
-                sc->activeIndex[j] = sc->activeIndex[j+1];
-            break;
-        }
-    }
-    assert(found && "ERROR: active sample to kill not found in active index");
-    sc->activeIndex[sc->activeCount--] = NO_ACTIVE_SAMPLE;
+    if (voice_command_push(sc, (VoiceCommand){ .type = VOICE_COMMAND_KILL, .channel = channel, .quantize = quantize }))
+        printf(BOLD_CYAN "\t\tKilling active sample on Channel %u (%s)\n" RESET, channel, sample->name);
 }
 
-void command_kill(InputController* ic, SoundController* sc)
+void command_kill(InputController* ic, SoundController* sc, Quantize quantize)
 {
     char buffer[MAX_COMMAND_LENGTH -1];
     strcpy(buffer, ic->command +1);
@@ -490,88 +4614,21 @@ void command_kill(InputController* ic, SoundController* sc)
         printf(MAGENTA "\t\tWARNING: Invalid channel\n" RESET);
         return;
     }
-    else if (strlen(buffer) == 1 &&!isdigit(buffer[0]))
-    {
-        printf(MAGENTA "\t\tWARNING: Invalid channel\n" RESET);
-        return;
-    }
-
-    int channel = atoi(buffer);
-    printf("buffer: %s, channel: %d", buffer, channel);
-    if (channel > 19 || channel < 0)
-    {
-        printf(MAGENTA "\t\tWARNING: %d is not a vaild channel\n" RESET, channel);
-        return;
-    }
-
-    switch (channel)
-    {
-    case 0:
-        active_channel_kill(sc, channel);
-        break;
-    case 1:
-        active_channel_kill(sc, channel);
-        break;
-    case 2:
-        active_channel_kill(sc, channel);
-        break;
-    case 3:
-        active_channel_kill(sc, channel);
-        break;
-    case 4:
-        active_channel_kill(sc, channel);
-        break;
-    case 5:
-        active_channel_kill(sc, channel);
-        break;
-    case 6:
-        active_channel_kill(sc, channel);
-        break;
-    case 7:
-        active_channel_kill(sc, channel);
-        break;
-    case 8:
-        active_channel_kill(sc, channel);
-        break;
-    case 9:
-        active_channel_kill(sc, channel);
-        break;
-    case 10:
-        active_channel_kill(sc, channel);
-        break;
-    case 11:
-        active_channel_kill(sc, channel);
-        break;
-    case 12:
-        active_channel_kill(sc, channel);
-        break;
-    case 13:
-        active_channel_kill(sc, channel);
-        break;
-    case 14:
-        active_channel_kill(sc, channel);
-        break;
-    case 15:
-        active_channel_kill(sc, channel);
-        break;
-    case 16:
-        active_channel_kill(sc, channel);
-        break;
-    case 17:
-        active_channel_kill(sc, channel);
-        break;
-    case 18:
-        active_channel_kill(sc, channel);
-        break;
-    case 19:
-        active_channel_kill(sc, channel);
-        break;
-    default:
-        assert(false && "ERROR: invalid channel in command_kill");
-        break;
-    }
+    else if (strlen(buffer) == 1 &&!isdigit(buffer[0]))
+    {
+        printf(MAGENTA "\t\tWARNING: Invalid channel\n" RESET);
+        return;
+    }
 
+    int channel = atoi(buffer);
+    printf("buffer: %s, channel: %d", buffer, channel);
+    if (channel >= MAX_CHANNELS || channel < 0)
+    {
+        printf(MAGENTA "\t\tWARNING: %d is not a vaild channel\n" RESET, channel);
+        return;
+    }
 
+    active_channel_kill(sc, (uint8_t)channel, quantize);
 }
 
 void print_synth_lfo_info(Synth* synth);
@@ -579,72 +4636,40 @@ void command_list(InputController* ic, SoundController* sc)
 {
     if (strcmp(ic->command, "la") == 0)
     {
-        for(uint8_t i = 0; i < MAX_ACTIVE_SAMPLES; ++i)
-            if (sc->activeSamples[i] != NULL)
-                printf(BOLD_GREEN "\t\tChannel: %u - %s, volume: %0.2f\n" RESET, i, sc->activeSamples[i]->name, sc->activeSamples[i]->volume);
-        for(uint8_t i = 0; i < sc->oneShotCount; ++i)
-            printf(GREEN "\t\tOne Shot: %u - %s, volume: %0.2f\n" RESET, i, sc->activeSamples[i]->name, sc->activeSamples[i]->volume);
+        ChannelFeed* feed = &sc->channels;
+        for(uint8_t i = 0; i < MAX_CHANNELS; ++i)
+        {
+            const Sample* sample = channel_feed_sample(sc, i);
+            if (sample == NULL)
+                continue;
+            uint32_t volumeBits = atomic_load_explicit(&feed->volume[i], memory_order_relaxed);
+            float volume;
+            memcpy(&volume, &volumeBits, sizeof(volume));
+            printf(BOLD_GREEN "\t\tChannel: %u - %s, volume: %0.2f, rate: %0.3f\n" RESET, i, sample->name, volume,
+                   (float)atomic_load_explicit(&feed->rate[i], memory_order_relaxed) / VOICE_RATE_ONE);
+        }
+        uint16_t oneShots = atomic_load_explicit(&feed->oneShots, memory_order_relaxed);
+        if (oneShots > 0)
+            printf(GREEN "\t\tOne Shots: %u sounding\n" RESET, oneShots);
+        printf(CYAN "\t\tVoices: %u of %u sounding\n" RESET, atomic_load_explicit(&feed->live, memory_order_relaxed), sc->voices.capacity);
     }
     else if (strcmp(ic->command, "ls") == 0)
     {
         for (uint16_t i = 0; i < sc->sampleCount; ++i)
         {
-            bool active = false;
-            bool oneShot = false;
-            uint8_t channel = 0;
-            for (uint8_t j = 0; j < MAX_ACTIVE_SAMPLES; ++j)
-            {
-                if (sc->samples[i] == sc->activeSamples[j])
-                {
-                    active = true;
-                    channel = j;
-                    break;
-                }
-            }
-            for (uint8_t j = 0; j < sc->oneShotCount; ++j)
-            {
-                if (sc->samples[i] == sc->oneShotActive[j])
-                {
-                    oneShot = true;
-                    break;
-                }
-            }
-
-            if (active)
+            uint8_t channel = channel_feed_find(sc, i);
+            if (channel != VOICE_ONE_SHOT_CHANNEL)
                 printf(BOLD_GREEN "\t\tChannel: %u %s (SampleID %u)\n" RESET, channel, sc->samples[i]->name, i);
-            else if (oneShot)
-                printf(GREEN "\t\tOne Shot active: %s (SampleID %u)\n" RESET, sc->samples[i]->name, i);
             else
-                printf(BOLD_YELLOW "\t\tSampleID: %u - %s\n" RESET, i, sc->samples[i]->name);
+                printf(BOLD_YELLOW "\t\tSampleID: %u - %s%s\n" RESET, i, sc->samples[i]->name, sample_state_describe(sc->samples[i]));
         }
     }
     else if (strcmp(ic->command, "li") == 0)
     {
         for (uint16_t i = 0; i < sc->sampleCount; ++i)
         {
-            bool active = false;
-            bool oneShot = false;
-            uint8_t channel = 0;
-            for (uint8_t j = 0; j < MAX_ACTIVE_SAMPLES; ++j)
-            {
-                if (sc->samples[i] == sc->activeSamples[j])
-                {
-                    active = true;
-                    channel = j;
-                    break;
-                }
-            }
-            for (uint8_t j = 0; j < sc->oneShotCount; ++j)
-            {
-                if (sc->samples[i] == sc->oneShotActive[j])
-                {
-                    oneShot = true;
-                    break;
-                }
-            }
-
-            if (!active && !oneShot)
-                printf(BOLD_YELLOW "\t\tSampleID: %u - %s\n" RESET, i, sc->samples[i]->name);
+            if (channel_feed_find(sc, i) == VOICE_ONE_SHOT_CHANNEL)
+                printf(BOLD_YELLOW "\t\tSampleID: %u - %s%s\n" RESET, i, sc->samples[i]->name, sample_state_describe(sc->samples[i]));
         }
     }
     else if (strcmp(ic->command, "ly_SYNTH_ONLY") == 0)
@@ -739,33 +4764,12 @@ void parse_sample_to_channel(const char* command, uint16_t* sampleIndex, uint8_t
 #define LAUNCH_OPTION_MUTE 'm'
 #define LAUNCH_OPTION_FADE 'f'
 #define LAUNCH_FADE_IN_TIME 12 // in sec
+#define LAUNCH_FADE_IN_VOLUME 0.95f
 
-void lauch_fade_in(InputController* ic, uint16_t index, uint8_t channel, uint8_t time)
-{
-    if(ic->sliderCount >= MAX_SLIDERS)
-    {
-        printf(MAGENTA "\t\tWARNING: Maximum number of volume sliders reached. Command: %s\n" RESET, ic->command);
-        return;
-    }
-    ic->slider[ic->sliderCount].channel = channel;
-    ic->slider[ic->sliderCount].targetVolume = 0.95f;
-    ic->slider[ic->sliderCount].framesLeft = time * 60; // assuming 60 frames per second
-    ic->slider[ic->sliderCount].active = false;
-    ic->slider[ic->sliderCount].index = index;
-    ic->sliderCount++;
-
-}
-
-void command_one_shot(InputController* ic, SoundController* sc)
+void command_one_shot(InputController* ic, SoundController* sc, Quantize quantize)
 {
     // o38;
     // o<sample index>;
-    if (sc->oneShotCount >= MAX_ACTIVE_ONE_SHOT)
-    {
-        printf(MAGENTA "\t\tWARNING: Maximum of shot shot samples currently active\n" RESET);
-        return;
-    }
-
     for (uint32_t i = 1; i < strlen(ic->command); ++i)
         if (!isdigit(ic->command[i]))
         {
@@ -783,94 +4787,86 @@ void command_one_shot(InputController* ic, SoundController* sc)
         return;
     }
 
-    for (uint8_t i = 0; i < sc->activeCount; ++i)
+    char description[16];
+    if (voice_command_push(sc, (VoiceCommand){ .type = VOICE_COMMAND_ONE_SHOT, .sampleIndex = sampleI, .quantize = quantize }))
+        printf(BOLD_GREEN "\t\tSample %s engaged for one shot on the %s\n" RESET, sc->samples[sampleI]->name, quantize_describe(quantize, description, sizeof(description)));
+}
+
+void command_preload(InputController* ic, SoundController* sc)
+{
+    // p38;
+    // p<sample index>;
+    if (ic->command[1] == '\0' || strspn(ic->command + 1, "0123456789") != strlen(ic->command + 1))
     {
-        if (sc->samples[sampleI] == sc->activeSamples[i])
-        {
-            printf(MAGENTA "\t\tWARNING: One shot launch aborted - Sample %s already active\n" RESET, sc->samples[sampleI]->name);
-            return;
-        }
+        printf(MAGENTA "\t\tWARNING: Parsing of preload command found unvaild sample index. Command: %s\n" RESET, ic->command);
+        return;
     }
-
-    Sample* sample = sc->samples[sampleI];
-    sample->cursor = 0;
-    sample->nextSample = -1;
-    sample->oneShot = true;
-    sample->volume = 1;
-    sample->newSample = true;
-
-    sc->oneShotActive[sc->oneShotCount++] = sample;
-    sc->newQueued = true;
-    printf(BOLD_GREEN "\t\tSample %s engaged for one shot\n" RESET, sample->name);
+    uint16_t sampleI = atoi(ic->command + 1);
+    if (sc->sampleCount <= sampleI)
+    {
+        printf(MAGENTA "\t\tWARNING: Sample Index out of range %u\n" RESET, sampleI);
+        return;
+    }
+    if (atomic_load_explicit(&sc->samples[sampleI]->state, memory_order_acquire) == SAMPLE_READY)
+        printf(BOLD_GREEN "\t\tSample %s is already loaded\n" RESET, sc->samples[sampleI]->name);
+    else
+        sample_request(sc, sampleI);
 }
 
-void command_sample_launch(InputController* ic, SoundController* sc)
+void command_sample_launch(InputController* ic, SoundController* sc, Quantize quantize)
 {
     // l38c2m;
-    // l<sample index>c<channel><option>;
+    // l<sample index>c<channel><option>q<quantize>;
     uint16_t sampleI = 0;
     uint8_t channel = 0;
     char option = ic->command[strlen(ic->command) -1];
 
     parse_sample_to_channel(ic->command, &sampleI, &channel);
     //printf("sample %u, channel %u\n", sampleI, channel);
-    if (sampleI >= sc->sampleCount || channel >= MAX_ACTIVE_SAMPLES)
+    if (sampleI >= sc->sampleCount || channel >= MAX_CHANNELS)
     {
         printf(MAGENTA "\t\tWARNING: Parsing of launch samples failed. Command: %s\n" RESET, ic->command);
         return;
     }
 
-    for (uint8_t i = 0; i < sc->activeCount; ++i)
-    {
-        if (sc->samples[sampleI] == sc->activeSamples[i])
-        {
-            printf(MAGENTA "\t\tWARNING: Sample launch aborted - Sample %s already active\n" RESET, sc->samples[sampleI]->name);
-            return;
-        }
-    }
-
     Sample* sample = sc->samples[sampleI];
-    sample->cursor = 0;
-    sample->nextSample = -1;
+    VoiceCommand command = { .type = VOICE_COMMAND_LAUNCH, .sampleIndex = sampleI, .channel = channel, .volume = VOICE_VOLUME_UNCHANGED, .quantize = quantize };
     if (option == LAUNCH_OPTION_MUTE || option == LAUNCH_OPTION_FADE)
-        sample->volume = 0;
-    if (sc->activeSamples[channel] == NULL)
+        command.volume = 0;
+    if (option == LAUNCH_OPTION_FADE) // ramp starts once the sample is playing
     {
-        sample->newSample = true;
-        sc->activeSamples[channel] = sample;
-        sc->activeIndex[sc->activeCount++] = channel;
-        sc->newQueued = true;
-        if (option == LAUNCH_OPTION_FADE)
-            lauch_fade_in(ic, sampleI, channel, LAUNCH_FADE_IN_TIME);
-        printf(BOLD_GREEN "\t\tSample %s launched into channel %u\n" RESET, sample->name, channel);
-
+        command.rampTarget = LAUNCH_FADE_IN_VOLUME;
+        command.rampFrames = LAUNCH_FADE_IN_TIME * sc->sampleRate;
+        command.rampType = VOLUME_RAMP_LINEAR;
     }
+    bool channelEmpty = channel_feed_sample(sc, channel) == NULL;
+    if (!voice_command_push(sc, command))
+        return;
+
+    char description[16];
+    quantize_describe(quantize, description, sizeof(description));
+    if (channelEmpty)
+        printf(BOLD_GREEN "\t\tSample %s launched into channel %u on the %s\n" RESET, sample->name, channel, description);
     else
-    {
-        sample->newSample = false;
-        sample->nextSample = channel;
-        sc->activeSamples[channel]->nextSample = sampleI;
-        if (option == LAUNCH_OPTION_FADE)
-            lauch_fade_in(ic, sampleI, channel, LAUNCH_FADE_IN_TIME);
-        printf(BOLD_GREEN "\t\tSample %s launched will be swapped at next loop into channel %u\n" RESET, sample->name, channel);
-    }
+        printf(BOLD_GREEN "\t\tSample %s launched will be swapped into channel %u on the %s\n" RESET, sample->name, channel, description);
 }
 
 void command_volume_slider(InputController* ic, SoundController* sc)
 {
-    //vs0.75c2-3
+    //vs0.75c2-3 linear, vse0.75c2-3 exponential
     float volume;
     uint8_t channel;
     uint8_t time;
+    Volume_Ramp_Type rampType = ic->command[2] == 'e' ? VOLUME_RAMP_EXPONENTIAL : VOLUME_RAMP_LINEAR;
 
-    int result = sscanf(ic->command, "vs%fc%hhu-%hhu", &volume, &channel, &time);
+    int result = sscanf(ic->command + (rampType == VOLUME_RAMP_EXPONENTIAL ? 3 : 2), "%fc%hhu-%hhu", &volume, &channel, &time);
     if (result != 3)
     {
         printf(MAGENTA "\t\tWARNING: Parsing of volume slider command failed. Command: %s\n" RESET, ic->command);
         return;
     }
 
-    if (sc->activeSamples[channel] == NULL)
+    if (channel >= MAX_CHANNELS || channel_feed_sample(sc, channel) == NULL)
     {
         printf(MAGENTA "\t\tWARNING: Channel %u is not active. Cannot set volume\n" RESET, channel);
         return;
@@ -886,20 +4882,32 @@ void command_volume_slider(InputController* ic, SoundController* sc)
         return;
     }
 
-    if(ic->sliderCount >= MAX_SLIDERS)
+    VoiceCommand command = { .type = VOICE_COMMAND_RAMP, .channel = channel, .rampTarget = volume, .rampFrames = time * sc->sampleRate, .rampType = rampType };
+    if (voice_command_push(sc, command))
+        printf(BOLD_GREEN "\t\tVolume slider set to %0.2f on channel %u over %u sec (%s)\n" RESET, volume, channel, time,
+               rampType == VOLUME_RAMP_EXPONENTIAL ? "exponential" : "linear");
+}
+
+void command_steal_policy(InputController* ic, SoundController* sc)
+{
+    //vpo oldest, vpq quietest, vpp lowest priority
+    switch (ic->command[2])
     {
-        printf(MAGENTA "\t\tWARNING: Maximum number of volume sliders reached. Command: %s\n" RESET, ic->command);
-        return;
+    case 'o':
+        sc->stealPolicy = VOICE_STEAL_OLDEST;
+        printf(BOLD_GREEN "\t\tWith no free voice the oldest is stolen\n" RESET);
+        break;
+    case 'q':
+        sc->stealPolicy = VOICE_STEAL_QUIETEST;
+        printf(BOLD_GREEN "\t\tWith no free voice the quietest is stolen\n" RESET);
+        break;
+    case 'p':
+        sc->stealPolicy = VOICE_STEAL_PRIORITY;
+        printf(BOLD_GREEN "\t\tWith no free voice the lowest priority is stolen (one shots before loops)\n" RESET);
+        break;
+    default:
+        printf(MAGENTA "\t\tWARNING: Invalid steal policy (vpo - oldest | vpq - quietest | vpp - priority). Command: %s\n" RESET, ic->command);
     }
-
-    ic->slider[ic->sliderCount].channel = channel;
-    ic->slider[ic->sliderCount].targetVolume = volume;
-    ic->slider[ic->sliderCount].framesLeft = time * 60; // assuming 60 frames per second
-    ic->slider[ic->sliderCount].active = true;
-    ic->sliderCount++;
-
-    printf(BOLD_GREEN "\t\tVolume slider set to %0.2f on channel %u over %u frames\n" RESET, volume, channel, time * 60);
-
 }
 
 void command_volume(InputController* ic, SoundController* sc)
@@ -946,7 +4954,7 @@ void command_volume(InputController* ic, SoundController* sc)
     float volume = atof(volumeStr);
     uint8_t channel = atoi(channelStr);
 
-    if (sc->activeSamples[channel] == NULL)
+    if (channel >= MAX_CHANNELS || channel_feed_sample(sc, channel) == NULL)
     {
         printf(MAGENTA "\t\tWARNING: Channel %u is not active. Cannot set volume\n" RESET, channel);
         return;
@@ -956,8 +4964,172 @@ void command_volume(InputController* ic, SoundController* sc)
         printf(MAGENTA "\t\tWARNING: Volume out of range (0.0 - 1.0). Command: %s\n" RESET, ic->command);
         return;
     }
-    sc->activeSamples[channel]->volume = volume;
-    printf(BOLD_GREEN "\t\tVolume of channel %u set to %0.2f\n" RESET, channel, volume);
+    if (voice_command_push(sc, (VoiceCommand){ .type = VOICE_COMMAND_VOLUME, .channel = channel, .volume = volume }))
+        printf(BOLD_GREEN "\t\tVolume of channel %u set to %0.2f\n" RESET, channel, volume);
+}
+
+void command_rate(InputController* ic, SoundController* sc)
+{
+    //r0.5c2 half speed now, r0c2-1.5 glide to a stop over 1.5 sec
+    float rate;
+    uint8_t channel;
+    float time = 0.0f;
+    int result = sscanf(ic->command + 1, "%fc%hhu-%f", &rate, &channel, &time);
+    if (result < 2)
+    {
+        printf(MAGENTA "\t\tWARNING: Parsing of rate command failed. Command: %s\n" RESET, ic->command);
+        return;
+    }
+
+    if (channel >= MAX_CHANNELS || channel_feed_sample(sc, channel) == NULL)
+    {
+        printf(MAGENTA "\t\tWARNING: Channel %u is not active. Cannot set rate\n" RESET, channel);
+        return;
+    }
+    if (rate < 0.0f || rate > VOICE_RATE_MAX)
+    {
+        printf(MAGENTA "\t\tWARNING: Rate out of range (0.0 - %0.1f). Command: %s\n" RESET, VOICE_RATE_MAX, ic->command);
+        return;
+    }
+    if (time < 0.0f)
+    {
+        printf(MAGENTA "\t\tWARNING: Glide time can't be negative. Command: %s\n" RESET, ic->command);
+        return;
+    }
+
+    VoiceCommand command = { .type = VOICE_COMMAND_RATE, .channel = channel, .rampTarget = rate, .rampFrames = (uint32_t)(time * sc->sampleRate) };
+    if (!voice_command_push(sc, command))
+        return;
+    if (command.rampFrames > 0)
+        printf(BOLD_GREEN "\t\tRate of channel %u gliding to %0.3f over %0.2f sec\n" RESET, channel, rate, time);
+    else
+        printf(BOLD_GREEN "\t\tRate of channel %u set to %0.3f\n" RESET, channel, rate);
+}
+
+void command_interpolation(InputController* ic, SoundController* sc)
+{
+    //ril2 linear, rih2 cubic hermite, ris2 windowed sinc
+    static const char* names[] = { "linear", "cubic hermite", "windowed sinc" };
+    Voice_Interpolation interpolation;
+    switch (ic->command[2])
+    {
+    case 'l':
+        interpolation = VOICE_INTERPOLATION_LINEAR;
+        break;
+    case 'h':
+        interpolation = VOICE_INTERPOLATION_HERMITE;
+        break;
+    case 's':
+        interpolation = VOICE_INTERPOLATION_SINC;
+        break;
+    default:
+        printf(MAGENTA "\t\tWARNING: Invalid interpolation (ril - linear | rih - cubic hermite | ris - windowed sinc). Command: %s\n" RESET, ic->command);
+        return;
+    }
+
+    uint8_t channel;
+    if (sscanf(ic->command + 3, "%hhu", &channel) != 1)
+    {
+        printf(MAGENTA "\t\tWARNING: Parsing of interpolation command failed. Command: %s\n" RESET, ic->command);
+        return;
+    }
+    if (channel >= MAX_CHANNELS || channel_feed_sample(sc, channel) == NULL)
+    {
+        printf(MAGENTA "\t\tWARNING: Channel %u is not active. Cannot set interpolation\n" RESET, channel);
+        return;
+    }
+
+    if (voice_command_push(sc, (VoiceCommand){ .type = VOICE_COMMAND_INTERPOLATION, .channel = channel, .interpolation = interpolation }))
+        printf(BOLD_GREEN "\t\tChannel %u resampling with %s interpolation\n" RESET, channel, names[interpolation]);
+}
+
+void command_tempo(InputController* ic, SoundController* sc, Quantize quantize)
+{
+    //t128 now, t128-8 ramp over 8 bars, t128-8q4 ramp starting on the next 4 bars
+    float bpm;
+    uint32_t bars = 0;
+    int result = sscanf(ic->command + 1, "%f-%u", &bpm, &bars);
+    if (result < 1)
+    {
+        printf(MAGENTA "\t\tWARNING: Parsing of tempo command failed. Command: %s\n" RESET, ic->command);
+        return;
+    }
+    if (bpm < sc->bpm / TEMPO_RATIO_MAX || bpm > sc->bpm * TEMPO_RATIO_MAX)
+    {
+        printf(MAGENTA "\t\tWARNING: Tempo out of range (%0.2f - %0.2f BPM). Command: %s\n" RESET, sc->bpm / TEMPO_RATIO_MAX, sc->bpm * TEMPO_RATIO_MAX, ic->command);
+        return;
+    }
+
+    VoiceCommand command = { .type = VOICE_COMMAND_TEMPO, .rampTarget = bpm, .rampFrames = bars, .quantize = quantize };
+    if (!voice_command_push(sc, command))
+        return;
+    char description[16];
+    quantize_describe(quantize, description, sizeof(description));
+    bool immediate = quantize.type == QUANTIZE_IMMEDIATE;
+    if (bars > 0)
+        printf(BOLD_GREEN "\t\tTempo ramping to %0.2f BPM over %u bars %s%s\n" RESET, bpm, bars, immediate ? "starting " : "from the ", description);
+    else
+        printf(BOLD_GREEN "\t\tTempo set to %0.2f BPM %s%s\n" RESET, bpm, immediate ? "" : "on the ", description);
+}
+
+void command_tempo_report(SoundController* sc)
+{
+    //ts what tempo stretching the loop voices has cost since the last ts
+    uint64_t nanoseconds = atomic_exchange_explicit(&sc->stretchNanoseconds, 0, memory_order_relaxed);
+    uint64_t frames = atomic_exchange_explicit(&sc->stretchFrames, 0, memory_order_relaxed);
+    uint32_t peak = atomic_exchange_explicit(&sc->stretchPeak, 0, memory_order_relaxed);
+    printf(BOLD_GREEN "\t\tTempo %0.2f BPM (session %0.2f BPM)\n" RESET, atomic_load_explicit(&sc->tempoBpm, memory_order_relaxed), sc->bpm);
+    if (frames == 0)
+    {
+        printf(BOLD_GREEN "\t\tNo loops tempo stretched since the last report\n" RESET);
+        return;
+    }
+    // a voice has sampleRate frames to render a second, so that over the cost of a frame is how many fit on a core
+    double perFrame = (double)nanoseconds / frames;
+    double core = perFrame * sc->sampleRate / 1e9;
+    printf(BOLD_GREEN "\t\tTempo stretch: %0.1f ns a frame (worst block %u ns), %0.2f%% of a core per voice, about %u stretched voices a core\n" RESET,
+           perFrame, peak, core * 100.0, (uint32_t)(1.0 / core));
+}
+
+void command_callback_stats(SoundController* sc)
+{
+    //cs how long the callback has taken against its period since the last cs
+    CallbackTiming* timing = sc->timing;
+    uint32_t counts[CALLBACK_HISTOGRAM_BUCKETS];
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < CALLBACK_HISTOGRAM_BUCKETS; ++i)
+    {
+        counts[i] = atomic_exchange_explicit(&timing->histogram[i], 0, memory_order_relaxed);
+        total += counts[i];
+    }
+    uint64_t max = atomic_exchange_explicit(&timing->maxDuration, 0, memory_order_relaxed);
+    uint32_t overruns = atomic_exchange_explicit(&timing->overruns, 0, memory_order_relaxed);
+    uint32_t xruns = atomic_exchange_explicit(&timing->xruns, 0, memory_order_relaxed);
+    double budget = atomic_load_explicit(&timing->budget, memory_order_relaxed) / 1e6;
+    if (total == 0)
+    {
+        printf(BOLD_GREEN "\t\tNo callbacks since the last report\n" RESET);
+        return;
+    }
+
+    // each percentile is the top of the bucket it lands in, never past the longest seen
+    const double percentiles[3] = { 0.5, 0.99, 0.999 };
+    double at[3];
+    uint64_t seen = 0;
+    uint32_t bucket = 0;
+    for (uint32_t p = 0; p < 3; ++p)
+    {
+        uint64_t rank = (uint64_t)ceil(percentiles[p] * total);
+        while (seen + counts[bucket] < rank)
+            seen += counts[bucket++];
+        uint64_t upper = callback_histogram_upper(bucket);
+        at[p] = (upper < max ? upper : max) / 1e6;
+    }
+    printf(BOLD_GREEN "\t\tCallback over %llu periods of %0.3f ms: p50 %0.3f ms (%0.1f%%), p99 %0.3f ms (%0.1f%%), p99.9 %0.3f ms (%0.1f%%), max %0.3f ms (%0.1f%%)\n" RESET,
+           (unsigned long long)total, budget, at[0], 100.0 * at[0] / budget, at[1], 100.0 * at[1] / budget, at[2], 100.0 * at[2] / budget,
+           max / 1e6, 100.0 * max / 1e6 / budget);
+    if (overruns > 0 || xruns > 0)
+        printf(MAGENTA "\t\tWARNING: %u callbacks over %0.0f%% of their period, %u xruns reported\n" RESET, overruns, FLIGHT_RECORDER_THRESHOLD * 100.0f, xruns);
 }
 
 int fire_command(InputController* ic, SoundController* sc);
@@ -1049,43 +5221,177 @@ void command_synth_frequence(InputController* ic, SoundController* sc)
     return;
 }
 
+void command_bus(InputController* ic, SoundController* sc)
+{
+    //bg0.8c2 channel gain, bp-0.5c2 channel pan, br1c2 channel to group, bv0.7g1 group gain, bm0.9 master gain
+    //bl0.9 limiter ceiling (bl0 off), bs soft clip on/off
+    float value;
+    uint32_t index = 0;
+    MixRouting* routing = &sc->routing;
+    switch (ic->command[1])
+    {
+    case 'g':
+    case 'p':
+    case 'r':
+    {
+        char format[] = "b_%fc%u";
+        format[1] = ic->command[1];
+        if (sscanf(ic->command, format, &value, &index) != 2 || index >= MAX_CHANNELS)
+        {
+            printf(MAGENTA "\t\tWARNING: Parsing of bus command failed. Command: %s\n" RESET, ic->command);
+            return;
+        }
+        MixChannel* channel = &routing->channels[index];
+        if (ic->command[1] == 'g')
+        {
+            if (value < 0.0f || value > 1.0f)
+            {
+                printf(MAGENTA "\t\tWARNING: Gain out of range (0.0 - 1.0). Command: %s\n" RESET, ic->command);
+                return;
+            }
+            channel->gain = value;
+            printf(BOLD_GREEN "\t\tGain of channel %u set to %0.2f\n" RESET, index, value);
+        }
+        else if (ic->command[1] == 'p')
+        {
+            if (value < -1.0f || value > 1.0f)
+            {
+                printf(MAGENTA "\t\tWARNING: Pan out of range (-1.0 - 1.0). Command: %s\n" RESET, ic->command);
+                return;
+            }
+            channel->pan = value;
+            printf(BOLD_GREEN "\t\tPan of channel %u set to %0.2f\n" RESET, index, value);
+        }
+        else
+        {
+            if (value < 0.0f || value >= MIX_GROUP_COUNT)
+            {
+                printf(MAGENTA "\t\tWARNING: Group out of range (0 - %u). Command: %s\n" RESET, MIX_GROUP_COUNT -1, ic->command);
+                return;
+            }
+            channel->group = (uint8_t)value;
+            printf(BOLD_GREEN "\t\tChannel %u routed to group %u\n" RESET, index, channel->group);
+        }
+        break;
+    }
+    case 'v':
+        if (sscanf(ic->command, "bv%fg%u", &value, &index) != 2 || index >= MIX_GROUP_COUNT || value < 0.0f || value > 1.0f)
+        {
+            printf(MAGENTA "\t\tWARNING: Invalid group gain (0.0 - 1.0, groups 0 - %u). Command: %s\n" RESET, MIX_GROUP_COUNT -1, ic->command);
+            return;
+        }
+        routing->groupGain[index] = value;
+        printf(BOLD_GREEN "\t\tGain of group %u set to %0.2f\n" RESET, index, value);
+        break;
+    case 'm':
+        if (sscanf(ic->command, "bm%f", &value) != 1 || value < 0.0f || value > 1.0f)
+        {
+            printf(MAGENTA "\t\tWARNING: Invalid master gain (0.0 - 1.0). Command: %s\n" RESET, ic->command);
+            return;
+        }
+        routing->masterGain = value;
+        printf(BOLD_GREEN "\t\tMaster gain set to %0.2f\n" RESET, value);
+        break;
+    case 'l':
+        if (sscanf(ic->command, "bl%f", &value) != 1 || value < 0.0f || value > 1.0f)
+        {
+            printf(MAGENTA "\t\tWARNING: Invalid limiter ceiling (0.0 - 1.0, 0 for off). Command: %s\n" RESET, ic->command);
+            return;
+        }
+        routing->limiterCeiling = value;
+        if (value > 0.0f)
+            printf(BOLD_GREEN "\t\tMaster limiter ceiling set to %0.2f\n" RESET, value);
+        else
+            printf(BOLD_GREEN "\t\tMaster limiter off\n" RESET);
+        break;
+    case 's':
+        routing->softClip = !routing->softClip;
+        printf(BOLD_GREEN "\t\tSoft clip %s\n" RESET, routing->softClip ? "on" : "off");
+        break;
+    default:
+        printf(MAGENTA "\t\tWARNING: Invaild Bus Command: %s\n" RESET, ic->command);
+    }
+}
+
 int fire_command(InputController* ic, SoundController* sc)
 {
     if(ic->commandIndex == 0)
         return 0;
 
     int result = 0;
+    Quantize quantize = ic->launchQuantize;
 
     switch(ic->command[0])
     {
     case 'q':
         if (strcmp(ic->command, "quit") == 0)
             result = command_quit(ic, sc);
+        else
+            command_quantize(ic);
         break;
     case 'k':
+        quantize = (Quantize){ QUANTIZE_IMMEDIATE, 0 }; // kills are immediate unless given a quantize
+        if (!command_quantize_suffix(ic, &quantize))
+            break;
         if (strcmp(ic->command, "killall") == 0)
-            command_kill_all(sc);
+            command_kill_all(sc, quantize);
         else
-            command_kill(ic, sc);
+            command_kill(ic, sc, quantize);
         break;
     case 'l':
         if (isdigit(ic->command[1]))
-            command_sample_launch(ic, sc);
+        {
+            if (command_quantize_suffix(ic, &quantize))
+                command_sample_launch(ic, sc, quantize);
+        }
         else
             command_list(ic, sc);
         break;
     case 'o':
-        command_one_shot(ic, sc);
+        if (command_quantize_suffix(ic, &quantize))
+            command_one_shot(ic, sc, quantize);
+        break;
+    case 'p':
+        command_preload(ic, sc);
         break;
     case 'm':
         command_multi(ic, sc);
         break;
+    case 'b':
+        command_bus(ic, sc);
+        break;
     case 'v':
         if (ic->command[1] == 's')
             command_volume_slider(ic, sc);
+        else if (ic->command[1] == 'p')
+            command_steal_policy(ic, sc);
         else
             command_volume(ic, sc);
         break;
+    case 'r':
+        if (ic->command[1] == 'i')
+            command_interpolation(ic, sc);
+        else
+            command_rate(ic, sc);
+        break;
+    case 't':
+        if (ic->command[1] == 's')
+            command_tempo_report(sc);
+        else
+        {
+            quantize = (Quantize){ QUANTIZE_IMMEDIATE, 0 }; // tempo changes are immediate unless given a quantize
+            if (command_quantize_suffix(ic, &quantize))
+                command_tempo(ic, sc, quantize);
+        }
+        break;
+    case 'c':
+        if (ic->command[1] == 's')
+            command_callback_stats(sc);
+        else if (ic->command[1] == 'd') // dumps the flight recorder now
+            flight_recorder_dump(sc, atomic_load_explicit(&sc->timing->recordCount, memory_order_acquire));
+        else
+            printf(MAGENTA "\t\tWARNING: Invaild Callback Command (cs - stats | cd - dump): %s\n" RESET, ic->command);
+        break;
     case 'y':
         if (ic->command[1] == 'f')
             command_synth_frequence(ic, sc);
@@ -1108,6 +5414,9 @@ void tab_info(InputController* ic, SoundController* s)
     strcpy(command, ic->command);
     //printf("[DEBUG] command inputted: %s\n", command);
 
+    // tabbing on a launch or one shot already naming its sample starts loading it
+    if ((command[0] == 'l' || command[0] == 'o') && isdigit(command[1]))
+        sample_request(s, (uint16_t)atoi(command + 1));
 
     if (command[0] == 'y')
     {
@@ -1138,6 +5447,8 @@ char get_char_from_linux_key(uint8_t value)
     {
     case KEY_A:
         return 'a';
+    case KEY_B:
+        return 'b';
     case KEY_C:
         return 'c';
     case KEY_Q:
@@ -1176,6 +5487,14 @@ char get_char_from_linux_key(uint8_t value)
         return '1';
     case KEY_D:
         return 'd';
+    case KEY_E:
+        return 'e';
+    case KEY_G:
+        return 'g';
+    case KEY_H:
+        return 'h';
+    case KEY_R:
+        return 'r';
     case KEY_2:
         return '2';
     case KEY_3:
@@ -1226,6 +5545,7 @@ int input_process(InputController* ic, SoundController* s)
         case KEY_ENTER:
             printf(BLUE "Command Fired: %s\n" RESET, ic->command);
             result = fire_command(ic, s);
+            mix_publish(s);
             break;
         case KEY_ESC:
             if (ic->commandIndex > 0)
@@ -1260,68 +5580,198 @@ int input_process(InputController* ic, SoundController* s)
     return result;
 }
 
-void slider_update(InputController* ic, SoundController* sc)
+/* Offline render */
+
+typedef struct
 {
-    if (ic->sliderCount == 0)
-        return;
+    uint64_t frame;
+    uint32_t line;
+    char command[MAX_COMMAND_LENGTH];
+} OfflineScriptEvent;
+
+static int offline_event_compare(const void* a, const void* b)
+{
+    const OfflineScriptEvent* left = a;
+    const OfflineScriptEvent* right = b;
+    if (left->frame != right->frame)
+        return left->frame < right->frame ? -1 : 1;
+    return left->line < right->line ? -1 : (left->line > right->line);
+}
+
+/* Reads the script into events sorted by frame, lines at the same time keep their order. A time is in
+seconds, or in frames with an f suffix: "2.5 l1" or "110250f l1". Blank lines and # comments are skipped */
+static OfflineScriptEvent* offline_script_read(const char* path, uint32_t sampleRate, uint32_t* outCount)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+    {
+        printf(MAGENTA "\t\tWARNING: Couldn't open render script %s (%s)\n" RESET, path, strerror(errno));
+        return NULL;
+    }
 
-    for (uint8_t i = 0; i < ic->sliderCount; ++i)
+    uint32_t capacity = 64;
+    uint32_t count = 0;
+    OfflineScriptEvent* events = malloc(capacity * sizeof(OfflineScriptEvent));
+    assert(events != NULL && "ERROR: render script allocation failed");
+    char line[256];
+    uint32_t lineNumber = 0;
+    while (fgets(line, sizeof(line), file) != NULL)
     {
-        uint8_t channel = ic->slider[i].channel;
-        if (!ic->slider[i].active)
+        ++lineNumber;
+        line[strcspn(line, "\r\n")] = '\0';
+        char* cursor = line;
+        while (isspace((unsigned char)*cursor))
+            ++cursor;
+        if (*cursor == '\0' || *cursor == '#')
+            continue;
+
+        char* end = NULL;
+        double time = strtod(cursor, &end);
+        bool frames = end != cursor && *end == 'f';
+        if (frames)
+            ++end;
+        if (end == cursor || !isspace((unsigned char)*end) || time < 0.0)
         {
-            // Check if the sample has been swaped it
-            if (sc->activeSamples[channel] == sc->samples[ic->slider[i].index])
-            {
-                printf(BOLD_GREEN "\t\tSlider on channel %u activated after sample swap\n" RESET, channel);
-                ic->slider[i].active = true;
-            }
+            printf(MAGENTA "\t\tWARNING: Render script line %u has no vaild time, skipped: %s\n" RESET, lineNumber, line);
             continue;
         }
-        else if (ic->slider[i].active && sc->activeSamples[channel] == NULL)
+        while (isspace((unsigned char)*end))
+            ++end;
+        size_t length = strlen(end);
+        while (length > 0 && isspace((unsigned char)end[length - 1]))
+            end[--length] = '\0';
+        if (length == 0 || length >= MAX_COMMAND_LENGTH)
         {
-            printf(MAGENTA "\t\tWARNING: Channel %u is not active. Slider reset\n" RESET, channel);
-            ic->slider[i] = ic->slider[--ic->sliderCount];
-            --i;
+            printf(MAGENTA "\t\tWARNING: Render script line %u has no command or it's too long, skipped: %s\n" RESET, lineNumber, line);
             continue;
         }
 
-        float targetVolume = ic->slider[i].targetVolume;
-        uint16_t framesLeft = ic->slider[i].framesLeft;
-
-        float currentVolume = sc->activeSamples[channel]->volume;
-        float volumeStep = (targetVolume - currentVolume) / framesLeft;
-
-        sc->activeSamples[channel]->volume += volumeStep;
-        ic->slider[i].framesLeft--;
-        //  printf("\r\t\tChannel %u volume: %0.2f (target: %0.2f)       \n", channel, sc->activeSamples[channel]->volume, targetVolume);
-
-        if (ic->slider[i].framesLeft == 0)
+        if (count == capacity)
         {
-            sc->activeSamples[channel]->volume = targetVolume;
-            // Remove this slider
-            ic->slider[i] = ic->slider[--ic->sliderCount];
-            --i;
+            capacity *= 2;
+            events = realloc(events, capacity * sizeof(OfflineScriptEvent));
+            assert(events != NULL && "ERROR: render script allocation failed");
         }
+        OfflineScriptEvent* event = &events[count++];
+        event->frame = frames ? (uint64_t)time : (uint64_t)llround(time * sampleRate);
+        event->line = lineNumber;
+        memcpy(event->command, end, length + 1);
     }
+    fclose(file);
+
+    qsort(events, count, sizeof(OfflineScriptEvent), offline_event_compare);
+    *outCount = count;
+    return events;
 }
 
-void one_shot_check(SoundController* sc)
+/* Runs the engine off a virtual clock instead of the device. The callback, the MIDI sequencer and the
+synths take turns on this thread a period at a time in the same order as the main loop, so a render only
+depends on the script and the session and comes out the same every run. The period is cut short at
+each script event so commands are fired on their frame */
+bool offline_render(SoundController* sc, const char* scriptPath, const char* outputPath, double seconds)
 {
-    if(sc->oneShotCount == 0)
-        return;
+    uint32_t eventCount = 0;
+    OfflineScriptEvent* events = offline_script_read(scriptPath, sc->sampleRate, &eventCount);
+    if (events == NULL)
+        return false;
+
+    // without a length the render runs a loop past the last event
+    uint64_t totalFrames = (uint64_t)llround(seconds * sc->sampleRate);
+    if (seconds <= 0.0)
+        totalFrames = (eventCount > 0 ? events[eventCount - 1].frame : 0) + (sc->loopFrameLength + 1) / sc->channelCount;
+
+    ma_encoder encoder;
+    ma_encoder_config encoderConfig = ma_encoder_config_init(ma_encoding_format_wav, ma_format_f32, sc->channelCount, sc->sampleRate);
+    if (ma_encoder_init_file(outputPath, &encoderConfig, &encoder) != MA_SUCCESS)
+    {
+        printf(MAGENTA "\t\tWARNING: Couldn't open %s to render into\n" RESET, outputPath);
+        free(events);
+        return false;
+    }
+
+    // MIDI clocks step the sequencer inside the callback rather than waking its thread whenever it gets to it
+    if (sc->midiController != NULL)
+    {
+        pthread_mutex_lock(&sc->midiController->mutex);
+        sc->midiController->flags |= MIDI_CLOCK_SYNCHRONOUS;
+        pthread_mutex_unlock(&sc->midiController->mutex);
+    }
 
-    for (uint8_t i = 0; i < sc->oneShotCount; ++i)
+    // the rings are filled after each period instead, so the render doesn't depend on how fast the disk is
+    SampleStreamer* streamer = sc->voices.streamer;
+    if (streamer != NULL)
+        stream_threads_stop(streamer);
+
+    InputController ic = {0};
+    ic.launchQuantize = (Quantize){ QUANTIZE_BARS, 1 };
+    ic.inputFile = -1;
+    ma_device device;
+    memset(&device, 0, sizeof(device));
+    device.pUserData = sc;
+    float* period = malloc(OFFLINE_PERIOD_FRAMES * sc->channelCount * sizeof(float));
+    assert(period != NULL && "ERROR: render period allocation failed");
+
+    struct timespec start, finish;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t frame = 0;
+    uint32_t next = 0;
+    bool quit = false;
+    bool written = true;
+    while (frame < totalFrames && !quit)
     {
-        Sample* sample = sc->oneShotActive[i];
-        if (sample->cursor > sample->length)
+        for (; next < eventCount && events[next].frame <= frame; ++next)
+        {
+            printf(BLUE "Command Fired at %.3fs: %s\n" RESET, (double)frame / sc->sampleRate, events[next].command);
+            strcpy(ic.command, events[next].command);
+            ic.commandIndex = strlen(ic.command);
+            if (fire_command(&ic, sc) == END_MISSION)
+                quit = true;
+            mix_publish(sc);
+        }
+        process_midi_commands(sc);
+        controller_synth_generate_audio(sc);
+
+        uint64_t frames = totalFrames - frame;
+        if (frames > OFFLINE_PERIOD_FRAMES)
+            frames = OFFLINE_PERIOD_FRAMES;
+        if (next < eventCount && events[next].frame - frame < frames)
+            frames = events[next].frame - frame;
+        if (sc->loader != NULL)
+            sample_loads_wait(sc);
+        memset(period, 0, frames * sc->channelCount * sizeof(float));
+        data_callback_f32(&device, period, NULL, (ma_uint32)frames);
+        if (streamer != NULL)
+            stream_rings_fill(streamer);
+
+        ma_uint64 framesWritten = 0;
+        if (ma_encoder_write_pcm_frames(&encoder, period, frames, &framesWritten) != MA_SUCCESS || framesWritten != frames)
         {
-            //swaping with the most recently activated one shot sample
-            sc->oneShotActive[i] = sc->oneShotActive[--sc->oneShotCount];
-            sample->oneShot = false;
-            //printf("[DEBUG] oneshot %u is reset. Active one shots: %u\n", i, sc->oneShotCount);
+            printf(MAGENTA "\t\tWARNING: Writing to %s failed, render stopped at %.3fs\n" RESET, outputPath, (double)frame / sc->sampleRate);
+            written = false;
+            break;
         }
+        frame += frames;
     }
+    clock_gettime(CLOCK_MONOTONIC, &finish);
+    ma_encoder_uninit(&encoder);
+    free(period);
+    free(events);
+
+    if (sc->midiController != NULL)
+    {
+        pthread_mutex_lock(&sc->midiController->mutex);
+        sc->midiController->flags &= ~MIDI_CLOCK_SYNCHRONOUS;
+        pthread_mutex_unlock(&sc->midiController->mutex);
+    }
+
+    double renderedSeconds = (double)frame / sc->sampleRate;
+    double wallSeconds = (finish.tv_sec - start.tv_sec) + (finish.tv_nsec - start.tv_nsec) / 1e9;
+    if (written)
+        printf(BOLD_GREEN "\tRendered %.3fs to %s in %.3fs (%.1fx real time)\n" RESET, renderedSeconds, outputPath, wallSeconds,
+               wallSeconds > 0.0 ? renderedSeconds / wallSeconds : 0.0);
+    voice_workers_report(sc);
+    event_scheduler_report(sc);
+    return written;
 }
 
 /* Synth implmentation */
@@ -1538,6 +5988,12 @@ void synth_generate_audio(Synth* synth)
     while (synth->audio_thread_flags & SYNTH_BUFFER_BEING_READ)
         pthread_cond_wait(&synth->cond, &synth->mutex); // Wait if being currently read
 
+    if (synth->audio_thread_flags & SYNTH_BUFFER_WRAPPED)
+    {
+        synth->audio_thread_flags &= ~SYNTH_BUFFER_WRAPPED;
+        printf("WARNING - synth %s cursor wrapped around\n", synth->name);
+    }
+
     if (synth->FLAGS & SYNTH_NOTE_ON)
     {
         synth->cursor = synth->bufferMax;
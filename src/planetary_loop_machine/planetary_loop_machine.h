@@ -14,6 +14,13 @@
 #include <termios.h>
 #include <assert.h>
 #include <ctype.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <limits.h>
 #define MIDI_INTERFACE_IMPLEMENTATION
 #include "../../lib/MIDI_interface.h"
 
@@ -30,57 +37,811 @@ typedef struct Synth Synth;
 typedef struct LFO_Module LFO_Module;
 /* Sound Controller and Sample */
 
+typedef enum
+{
+    VOLUME_RAMP_LINEAR,
+    VOLUME_RAMP_EXPONENTIAL
+} Volume_Ramp_Type;
+#define VOLUME_RAMP_FLOOR 0.001f // -60dB, where exponential ramps start from or end at for silence
+
+typedef enum
+{
+    SAMPLE_READY,       // loaded, what every sample is unless the session loads lazily
+    SAMPLE_INDEXED,     // only its name and length are known
+    SAMPLE_QUEUED,
+    SAMPLE_LOADING,
+    SAMPLE_FAILED
+} Sample_State;
+
+/* Sample storage. Samples can be held packed instead of as f32, int16 at 1/32768 a step (exact for the
+16 bit files most loops come from) or IEEE half, halving the memory and what the mixer reads per voice.
+The mixer converts as it loads, 8 samples at a time with AVX2 and F16C. Streamed samples stay f32 */
+typedef enum
+{
+    SAMPLE_FORMAT_F32,
+    SAMPLE_FORMAT_S16,
+    SAMPLE_FORMAT_F16
+} Sample_Format;
+#define SAMPLE_S16_SCALE 32768.0f
+
+/* Mono storage. In a stereo session a mono file, or a stereo one with the same audio on both sides, is
+kept as one channel. The voice still plays it as stereo frames, the mixers kernels read each mono frame
+once and widen it to both sides, so the pan is applied as it is mixed like any other sample. That halves
+the memory and what the mixer reads for it. Streamed samples keep every channel */
+
+// Decoded sample, read only once loaded. Any number of voices can play it at once
 typedef struct
 {
-    float* buffer;
+    union
+    {
+        float* buffer;
+        int16_t* bufferS16;     // SAMPLE_FORMAT_S16
+        uint16_t* bufferF16;    // SAMPLE_FORMAT_F16, IEEE half bits
+    };
     uint32_t length;
-    uint32_t cursor;
-    short nextSample;
-    bool newSample;
-    bool oneShot;
     uint16_t index; //index in **samples
     char name[30];
-    float volume;
+    float sourceBpm; // tempo the file was recorded at when it was stretched to the session, 0 otherwise
+    char* path;      // set when the sample streams from disk, buffer then only holds its first STREAM_HEAD_FRAMES
+    bool mapped;     // buffer points into a read only mapping of its cache file, unmapped by sound_controller_destroy
+    uint8_t format;  // Sample_Format of the buffer
+    uint8_t channels; // channels in the buffer, 1 for a mono sample in a stereo session, the sessions count otherwise
+    _Atomic uint8_t state; // Sample_State, published by the loader thread once the fields above are set
 } Sample;
 
-#define MAX_ACTIVE_SAMPLES 20
-#define NO_ACTIVE_SAMPLE -25
-#define MAX_ACTIVE_ONE_SHOT 5
+/* Sample cache. Decoded samples are kept in a folder next to the session as a page of header followed by
+the interleaved frames in the samples format, page aligned, so loading maps the file read only and points the Sample
+straight at it. Nothing is decoded or copied on a warm start and sessions open in several processes share
+the page cache. Plain samples go in SAMPLE_CACHE_DIRECTORY named by their path and checked against the
+files size and modification time, stretched ones in the stretch cache named by the files content hash */
+#define SAMPLE_CACHE_DIRECTORY ".sample_cache/"
+#define SAMPLE_CACHE_MAGIC 0x43534D50 // "PMSC"
+#define SAMPLE_CACHE_VERSION 3
+#define SAMPLE_CACHE_HEADER_BYTES 4096 // the frames start on a page
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t frames;
+    uint32_t sampleRate;
+    uint32_t channelCount;
+    int64_t sourceMtime;    // ns, 0 when the name already follows the contents
+    uint64_t sourceSize;
+    uint64_t sourceHash;    // FNV-1a of the path for a plain sample, of the contents for a stretched one
+    float sourceBpm;        // tempo stretched from, 0 for a plain sample
+    float bpm;              // tempo stretched to
+    uint32_t format;        // Sample_Format of the frames
+    uint32_t channels;      // channels in the frames, 1 when kept as mono
+} SampleCacheHeader;
+
+/* Tempo conformed loading. Samples at another tempo, given by a <name>.bpm sidecar holding the
+number or a tag in the filename like "bass_128bpm.wav", are time stretched to the session bpm with
+WSOLA as they load. The stretching runs over a thread pool once every file is decoded, and the result
+is kept in a cache folder next to the samples keyed by the files content hash and both tempos, so
+loading the session again reads the stretched audio straight back */
+#define STRETCH_WINDOW_FRAMES 1024  // grain length, ~23ms at 44.1k
+#define STRETCH_HOP_FRAMES (STRETCH_WINDOW_FRAMES / 2)
+#define STRETCH_SEEK_FRAMES 256     // how far either side of its nominal place a grain is searched for
+#define STRETCH_SEEK_STRIDE 4       // the similarity measure only looks at every 4th frame
+#define STRETCH_THREADS_MAX 8
+#define STRETCH_CACHE_DIRECTORY ".stretch_cache/"
+#define STRETCH_BPM_MIN 20.0f
+#define STRETCH_BPM_MAX 400.0f
+
+typedef struct
+{
+    Sample* sample;
+    float* source;              // decoded at the files own tempo, freed once stretched
+    float* output;              // stretched f32 for a packed sample, packed into its buffer and freed. NULL otherwise
+    uint32_t sourceFrames;
+    uint8_t channelCount;       // of the source and the stretched result, 1 for a mono sample
+    char cachePath[512];
+    SampleCacheHeader cacheHeader;
+} SampleStretchJob;
+
+typedef struct
+{
+    SampleStretchJob* jobs;
+    atomic_uint count;          // queued to by the loading threads
+    atomic_uint next;           // next job for a thread to take
+    char directory[512];        // cache folder, empty when it couldn't be made
+} SampleStretchQueue;
+
+/* Parallel loading. The session folder is scanned into a job per file in name order and the files are
+decoded over up to LOAD_THREADS_MAX threads. The arena isn't thread safe so each thread loads into an arena
+of its own, kept until the controller is destroyed, and the samples are gathered back in job order so a
+samples index follows its name whichever thread loaded it */
+#define LOAD_THREADS_MAX 8
+#define LOAD_PROGRESS_MICROSECONDS 50000
+
+typedef struct
+{
+    char path[512];
+    char name[256];
+    Sample* sample;             // NULL when the file couldn't be loaded
+} SampleLoadJob;
 
+typedef struct
+{
+    SampleLoadJob* jobs;
+    uint16_t count;
+    atomic_uint next;           // next job for a thread to take
+    atomic_uint done;           // jobs finished, for the progress line
+    SampleStretchQueue* stretch;
+    const char* cacheDirectory;
+    float bpm;
+    uint16_t sampleRate;
+    uint8_t channelCount;
+    uint8_t storage;            // Sample_Format the samples are kept in
+} SampleLoadQueue;
 
 typedef struct
 {
-    Sample** activeSamples;
-    short activeIndex[MAX_ACTIVE_SAMPLES];
-    Sample** oneShotActive;
-    uint8_t oneShotCount;
+    SampleLoadQueue* queue;
+    Arena* arena;
+} SampleLoadThread;
+
+/* Lazy loading. With lazyLoad set sound_controller_init only indexes the session, each sample has its name
+and length read from the file header and waits INDEXED. The first launch or one shot of it, a tab on a
+command naming it or a preload queues it for the loader threads, which load it the same way an eager load
+does and mark it READY. A launch of a sample that isn't ready is parked by the audio thread and quantized
+again once it is, so it comes in on the next boundary after the sample has loaded */
+typedef struct
+{
+    struct SampleLoader* loader;
+    Arena* arena;
+    pthread_mutex_t mutex;          // held over a load, realtime_setup takes it to prefault the arena
+} SampleLoaderThread;
+
+typedef struct SampleLoader
+{
+    Sample** samples;
+    char (*paths)[512];             // file of each sample
+    uint16_t sampleCount;
+    uint16_t* requests;             // ring of samples waiting to load, a sample is only ever queued once
+    uint32_t head;                  // under the mutex
+    uint32_t tail;
+    bool stop;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    SampleLoaderThread threadArgs[LOAD_THREADS_MAX];
+    pthread_t threads[LOAD_THREADS_MAX];
+    uint8_t threadCount;
+    uint8_t channelCount;
+    uint16_t sampleRate;
+    uint8_t storage;
+    float bpm;
+    char cacheDirectory[512];
+    char stretchDirectory[512];
+    uint8_t* reported;              // main thread only, the state sample_load_report last printed for each sample
+    _Atomic uint32_t launchesDropped; // counted by the audio thread when too many launches are parked
+    _Atomic size_t prefaultPage;    // set by realtime_setup, loads after it prefault their arena and cache pages
+} SampleLoader;
+
+/* Disk streaming. A sample over STREAM_MIN_SECONDS only has its head decoded at load, the rest is read
+from the file while it plays. Each voice on a streamed sample takes a ring, the voice plays it as a loop
+of STREAM_RING_FRAMES and a background thread decodes the sample into it ahead of the cursor, in the order
+the voice plays it: back to the head at the loop end, silence past the end of a one shot. Launching copies
+the resident head into the ring so a quantized launch starts on its frame, the thread has the heads length
+to open the file and catch up. The audio thread takes FREE rings to STREAMING and retires them, the stream
+thread closes RETIRED ones back to FREE, so neither ever writes where the other reads */
+#define STREAM_MIN_SECONDS 30
+#define STREAM_HEAD_FRAMES 16384        // resident for every streamed sample, ~0.37 s at 44.1k
+#define STREAM_RING_FRAMES 65536        // per voice, a multiple of STREAM_CHUNK_FRAMES
+#define STREAM_GUARD_FRAMES 4096        // left behind the cursor for interpolation and tempo stretch grains
+#define STREAM_LOOKAHEAD_FRAMES 1024    // ahead of the cursor a tempo stretch grain can read
+#define STREAM_CHUNK_FRAMES 4096        // decoded at a time
+#define STREAM_RINGS 16                 // streamed voices sounding at once
+#define STREAM_THREADS 2
+#define STREAM_POLL_MICROSECONDS 2000
+#define STREAM_READAHEAD_BYTES (1 << 20) // asked of the kernel ahead of the decoder with posix_fadvise
+
+typedef enum
+{
+    STREAM_RING_FREE,
+    STREAM_RING_STREAMING,
+    STREAM_RING_RETIRED
+} Stream_Ring_State;
+
+typedef struct
+{
+    float* buffer;                  // STREAM_RING_FRAMES frames
+    _Atomic uint32_t state;
+    uint32_t loopFrames;            // sample frames played before wrapping to the head or ending
+    const Sample* sample;
+    bool oneShot;
+    /* 7 byte hole */
+    _Atomic uint64_t written;       // stream frames decoded, published by the stream thread
+    _Atomic uint64_t read;          // stream frames played, published by the audio thread each period
+    uint64_t wraps;                 // audio thread only, times the voice has gone round the ring
+    ma_decoder decoder;             // stream thread only
+    uint64_t decoderFrame;          // sample frame the decoder reads next
+    bool decoderOpen;
+} StreamRing;
+
+typedef struct
+{
+    struct SampleStreamer* streamer;
+    uint8_t index;                  // services the rings index, index + stride, ...
+    uint8_t stride;
+} StreamThread;
+
+typedef struct SampleStreamer
+{
+    StreamRing rings[STREAM_RINGS];
+    StreamThread threadArgs[STREAM_THREADS];
+    pthread_t threads[STREAM_THREADS];
+    uint8_t threadCount;            // 0 when the rings are filled by stream_rings_fill instead
+    uint8_t channelCount;
+    uint32_t sampleRate;
+    _Atomic bool stop;
+    _Atomic uint32_t underruns;     // counted by the audio thread, taken by stream_report
+    _Atomic uint32_t ringsMissed;   // launches with no free ring, the voice only plays the head
+    _Atomic uint32_t failures;      // opens and seeks that failed on the stream threads
+} SampleStreamer;
+
+/* Varispeed, each voice plays at its own rate with the cursor held as 32.32 fixed point frames. At
+exactly unity with no fraction the buffer is mixed straight from the sample, otherwise it is resampled
+with the voices interpolation into a scratch block first. The sinc kernel isn't widened when pitching
+up, so rates over 1 alias a little more than they would through a proper resampler */
+typedef enum
+{
+    VOICE_INTERPOLATION_LINEAR,
+    VOICE_INTERPOLATION_HERMITE,    // 4 point cubic
+    VOICE_INTERPOLATION_SINC        // VOICE_SINC_TAPS point Blackman windowed sinc
+} Voice_Interpolation;
+
+#define VOICE_RATE_ONE (1u << 24)   // rates are 8.24 fixed point
+#define VOICE_RATE_MAX 4.0f
+#define VOICE_SINC_TAPS 8
+#define VOICE_SINC_PHASES 256       // table rows, interpolated between
+#define VOICE_RESAMPLE_BLOCK 512    // output samples resampled at a time
+
+// Playback state of one voice, everything the mixer touches for it on one cache line. The buffers format and
+// channels are the samples, read once a block rather than kept here
+typedef struct
+{
+    union
+    {
+        const float* buffer;    // the samples buffer, shared not copied
+        const int16_t* bufferS16;
+        const uint16_t* bufferF16;
+    };
+    const Sample* sample;
+    uint64_t cursor;        // 32.32 frames
+    uint32_t length;        // frames looped over
+    float volume;
+    // volume ramp rendered by the mixer, stepped every output sample
+    float rampStep;         // added to (linear) or multiplied with (exponential) the volume each sample
+    float rampTarget;
+    uint32_t rampRemaining; // output samples left, 0 when not ramping
+    // rate glide, stepped every frame
+    uint32_t rate;          // VOICE_RATE_ONE for the samples own speed
+    uint32_t rateTarget;
+    int32_t rateStep;
+    uint32_t rateRemaining; // frames left, 0 when not gliding
+    uint8_t rampType;       // Volume_Ramp_Type
+    bool oneShot;
+    uint8_t interpolation;  // Voice_Interpolation
+    uint8_t phase;          // channels of the current frame already played, when a segment ends part way through a frame
+} Voice;
+
+/* Tempo stretch. Off the session bpm a loop voices cursor keeps its place in the loop stepping at
+rate * tempo, while what is heard is a grain read from near the cursor at the voices own rate so the
+pitch stays put. Every VOICE_STRETCH_HOP_FRAMES a new grain starts at the cursor, nudged by up to
+VOICE_STRETCH_SEEK_FRAMES to where it best lines up with the grain playing, and the old one fades out
+over VOICE_STRETCH_FADE_FRAMES. That bounds the cost of a voice: two interpolated reads a frame while
+fading and one otherwise, plus one search a hop of (2 * SEEK + 1) * FADE / STRIDE multiply adds */
+#define VOICE_STRETCH_HOP_FRAMES 512
+#define VOICE_STRETCH_FADE_FRAMES 256
+#define VOICE_STRETCH_SEEK_FRAMES 128
+#define VOICE_STRETCH_SEEK_STRIDE 4
+#define VOICE_TEMPO_ONE (1ull << 32)    // tempo steps are 32.32 fixed point
+#define VOICE_STRETCH_TIMED_BLOCKS 16   // stretched voices are timed on one bus block in this many
+
+// Kept beside the Voice rather than in it, only loop voices off the session tempo touch it
+typedef struct
+{
+    uint64_t grain;         // 32.32 frames, the grain being faded in or heard
+    uint64_t fading;        // the grain fading out
+    uint32_t hopRemaining;  // frames until the next grain
+    uint32_t fadeRemaining; // frames left of the crossfade, 0 when only the grain is heard
+    bool engaged;           // false until the first stretched block and again once back at the session tempo
+    /* 7 byte hole */
+    // cost of the timed blocks, summed by whichever thread renders the voice and collected by the audio thread each period
+    uint64_t nanoseconds;
+    uint64_t frames;        // rendered in timed blocks only, so nanoseconds over frames is the cost of a frame
+    uint32_t peak;          // worst timed block in nanoseconds a frame
+    /* 4 byte hole */
+} VoiceStretch;
+
+#define MAX_CHANNELS 64 // loop channels, commands address them by number
+
+/* Voice pool, every sounding sample (loops and one shots) holds one of a fixed number of voices set at
+init. Free voices are kept on a free list and sounding ones in a dense live array, so taking or
+releasing a voice is O(1) and the mixer only walks what is playing. With none free a voice is stolen.
+The playback state the mixer uses (Voice) and the bookkeeping only the allocator uses (VoiceSlot) are
+seperate arrays indexed by the same voice number */
+typedef enum
+{
+    VOICE_STEAL_OLDEST,
+    VOICE_STEAL_QUIETEST,
+    VOICE_STEAL_PRIORITY    // lowest priority, the oldest of those
+} Voice_Steal_Policy;
+
+#define VOICE_NONE 0xFFFF
+#define VOICE_ONE_SHOT_CHANNEL 0xFF
+#define VOICE_PRIORITY_ONE_SHOT 1
+#define VOICE_PRIORITY_LOOP 2
+
+typedef struct
+{
+    uint64_t startFrame;    // transport frame it started on
+    uint16_t live;          // position in the live array
+    uint16_t nextFree;      // free list link while not sounding
+    uint8_t channel;        // VOICE_ONE_SHOT_CHANNEL for one shots
+    uint8_t priority;
+    /* 2 byte hole */
+} VoiceSlot;
+
+typedef struct
+{
+    Voice* voices;          // 64 byte aligned
+    VoiceSlot* slots;
+    VoiceStretch* stretch;
+    StreamRing** streams;   // ring each voice plays a streamed sample from, NULL otherwise
+    SampleStreamer* streamer; // NULL when nothing streams
+    uint16_t* live;         // dense, the voices sounding
+    uint16_t capacity;
+    uint16_t liveCount;
+    uint16_t freeHead;      // VOICE_NONE when every voice is sounding
+    uint16_t channelVoice[MAX_CHANNELS]; // voice playing each channel, VOICE_NONE when empty
+} VoicePool;
+
+// Pool invariants the audio thread checks once a period has settled, debug builds only. The main loop
+// only ever sees these flags, never the pool itself
+typedef enum
+{
+    VOICE_POOL_LIVE_INDEX = 1 << 0,     // a live voice doesn't point back to its place in the live array
+    VOICE_POOL_NO_SAMPLE = 1 << 1,      // a live voice without a sample
+    VOICE_POOL_CHANNEL = 1 << 2,        // a channel doesn't point to its voice
+    VOICE_POOL_LOST = 1 << 3            // the free list and live array don't add up to every voice
+} Voice_Pool_Fault;
+
+/* Mix routing, channels feed group buses which feed the master bus. One shots go to group 0 at unity */
+#define MIX_GROUP_COUNT 4
+#define MIX_BUS_FRAMES 256  // frames per bus block, small enough that every bus stays in L1
+
+typedef struct
+{
+    float gain;
+    float pan;      // -1 left to 1 right. Balance law as the samples are stereo, centre leaves both sides at unity
+    uint8_t group;
+    /* 3 byte hole */
+} MixChannel;
+
+typedef struct
+{
+    MixChannel channels[MAX_CHANNELS];
+    float groupGain[MIX_GROUP_COUNT];
+    float masterGain;
+    float limiterCeiling;   // peak the master limiter holds the output to, 0 to let it through untouched
+    bool softClip;          // soft clip after the limiter
+} MixRouting;
+
+/* Master limiter, a brickwall lookahead limiter on the output. The gain is worked out per block of
+LIMITER_BLOCK_FRAMES and ramped linearly across the block leaving the delay. Looking two blocks ahead
+means the ramp is always down before the peak gets to the output, so the latency is two blocks */
+#define LIMITER_BLOCK_FRAMES 32
+#define LIMITER_LATENCY_FRAMES (LIMITER_BLOCK_FRAMES * 2)
+#define LIMITER_RELEASE_TIME 0.08f // seconds back to unity
+#define LIMITER_CEILING_DEFAULT 0.98f
+
+typedef struct
+{
+    float* delay;           // 3 blocks of frames, the one being filled and the two being looked ahead over
+    uint32_t position;      // frame within the block being filled
+    uint32_t block;         // which of the 3 blocks is being filled
+    float peak;             // of the block being filled
+    float required;         // gain the last complete block needs
+    float gainStart;        // ramp over the block leaving the delay
+    float gainEnd;
+    float release;          // fraction of the way back to unity each block
+} MasterLimiter;
+
+// Position of the transport as published by the audio callback at the end of each period
+typedef struct
+{
+    uint32_t frame;     // global cursor within the loop
+    uint32_t loopCount; // loops played since start, wraps at 24 bits
+    uint8_t beat;       // beat shown on the display (1-4)
+} TransportPosition;
+
+/* Channel feed. The voices belong to the audio thread, what the commands and listings know of them is
+published next to the transport position at the end of each period. Each field is stored on its own, a
+reader can see a channel's volume a period apart from its sample, never a voice half way through a change */
+typedef struct
+{
+    _Atomic uint16_t sample[MAX_CHANNELS];  // index of the sample playing on each channel, VOICE_NONE when empty
+    _Atomic uint32_t volume[MAX_CHANNELS];  // f32 bits
+    _Atomic uint32_t rate[MAX_CHANNELS];    // VOICE_RATE_ONE for the samples own speed
+    _Atomic uint16_t oneShots;              // one shots sounding
+    _Atomic uint16_t live;                  // voices sounding
+} ChannelFeed;
+
+/* Tempo, set by the audio thread when a tempo command lands. The loop length, transport cursor, beat
+and MIDI tick grids and any events waiting on a quantized frame are rescaled on the frame the tempo
+changes, so everything keeps its place in the bar. A ramp steps the tempo every TEMPO_RAMP_STEP_FRAMES
+following how far through the ramps bars the transport is, so it finishes exactly on the bar */
+#define TEMPO_RAMP_STEP_FRAMES 256
+#define TEMPO_RATIO_MAX 2.0f    // furthest from the session bpm either way
+
+typedef struct
+{
+    float bpm;
+    float rampFrom;
+    float rampTo;
+    uint32_t rampBars;      // 0 when not ramping
+    uint32_t rampStartLoop; // loops started when the ramp began
+    float rampStartPhase;   // how far through that loop it began
+    uint64_t rampNext;      // transport frame of the next step
+    uint64_t step;          // VOICE_TEMPO_ONE at the session bpm, what a loop voice steps per frame over its rate
+    uint32_t baseLoopFrameLength; // at the session bpm, the samples were loaded at
+    uint32_t cursorFraction;      // of a sample past the transport cursor, left over from rescaling it
+} TempoState;
+
+// Points dividing the loop evenly (beats, MIDI ticks), stepped with a fractional accumulator
+typedef struct
+{
+    uint32_t next;      // global cursor of the next point
+    uint32_t step;      // whole samples between points
+    uint32_t remainder; // fractional part of the step in 1/divisions of a sample
+    uint32_t error;     // accumulated fractional part
+    uint32_t divisions;
+    uint32_t index;     // index of the next point in the loop
+} TransportGrid;
+
+/* Quantize, when a command lands relative to the transport */
+typedef enum
+{
+    QUANTIZE_IMMEDIATE,
+    QUANTIZE_BEAT,
+    QUANTIZE_BARS
+} Quantize_Type;
+
+typedef struct
+{
+    Quantize_Type type;
+    uint16_t bars;  // QUANTIZE_BARS: the next bar lined up to this many bars (1 = next bar, 4 = next 4 bar phrase)
+} Quantize;
+
+/* Voice commands, batched by the control thread and handed to the audio thread inside a mix snapshot.
+The audio thread is the only one changing the voice pool so the callback never sees it half updated */
+typedef enum
+{
+    VOICE_COMMAND_LAUNCH,
+    VOICE_COMMAND_ONE_SHOT,
+    VOICE_COMMAND_KILL,
+    VOICE_COMMAND_KILL_ALL,
+    VOICE_COMMAND_VOLUME,
+    VOICE_COMMAND_RAMP,
+    VOICE_COMMAND_RATE,         // rampTarget is the rate, rampFrames the glide
+    VOICE_COMMAND_INTERPOLATION,
+    VOICE_COMMAND_TEMPO         // rampTarget is the bpm, rampFrames the bars ramped over
+} Voice_Command_Type;
+
+#define VOICE_VOLUME_UNCHANGED -1.0f
+typedef struct
+{
+    Voice_Command_Type type;
+    uint16_t sampleIndex;
+    uint8_t channel;
+    uint8_t priority;   // for stealing, 0 for the default of its type (VOICE_PRIORITY_LOOP / VOICE_PRIORITY_ONE_SHOT)
+    float volume;       // VOICE_VOLUME_UNCHANGED to keep the samples volume on launch
+    float rampTarget;
+    uint32_t rampFrames; // 0 for no ramp, on launch the ramp starts from volume
+    Volume_Ramp_Type rampType;
+    Voice_Interpolation interpolation;
+    Quantize quantize;   // resolved to a transport frame by the audio thread when it takes the command
+} VoiceCommand;
+
+/* Mix snapshot, an immutable copy of everything the callback needs from the control side: the voice
+commands sent since the last snapshot, the synth list, the synth gains and the routing. The control
+thread fills a free snapshot and publishes it with one pointer swap, the callback takes it at the start
+of the period and marks the one it was using retired, which the control thread then reuses. A whole
+batch (every command in a mul;) lands in the same period */
+#define MIX_SNAPSHOT_POOL_SIZE 4 // live + published + one retired the control thread hasn't reclaimed yet + the one being built
+#define MIX_SNAPSHOT_MAX_COMMANDS 64
+
+typedef enum
+{
+    MIX_SNAPSHOT_FREE,
+    MIX_SNAPSHOT_PUBLISHED,
+    MIX_SNAPSHOT_LIVE,
+    MIX_SNAPSHOT_RETIRED
+} Mix_Snapshot_State;
+
+typedef struct
+{
+    _Atomic uint32_t state;     // Mix_Snapshot_State
+    uint32_t version;
+    uint32_t commandCount;
+    uint8_t synthCount;
     /* 3 byte hole */
+    Synth** synth;
+    float* synthVolume;
+    MixRouting routing;
+    Voice_Steal_Policy stealPolicy;
+    VoiceCommand commands[MIX_SNAPSHOT_MAX_COMMANDS];
+} MixSnapshot;
+
+// Commands waiting on their frame, audio thread only. The heap holds a full snapshot on top of every parked
+// launch coming back at once, a command that still doesn't fit is applied early and counted
+#define SCHEDULED_WAITING_MAX 64
+#define SCHEDULED_EVENT_MAX (MIX_SNAPSHOT_MAX_COMMANDS + SCHEDULED_WAITING_MAX)
+typedef struct
+{
+    uint64_t frame;     // transport frame the command is applied on
+    uint32_t sequence;  // keeps commands on the same frame in the order they were sent
+    /* 4 byte hole */
+    VoiceCommand command;
+} ScheduledEvent;
+
+typedef struct
+{
+    ScheduledEvent events[SCHEDULED_EVENT_MAX]; // min-heap on frame
+    uint32_t count;
+    uint32_t sequence;
+    VoiceCommand waiting[SCHEDULED_WAITING_MAX]; // launches parked until their sample has loaded, in order
+    uint32_t waitingCount;
+} EventScheduler;
+
+/* Real-time mode, opt in. realtime_setup locks memory and prefaults the arenas and mapped samples on the
+main thread, the audio thread sets FTZ/DAZ, SCHED_FIFO and its affinity on its first callback. Whatever
+fails is reported and the rest carries on */
+typedef struct
+{
+    bool enabled;
+    /* 3 byte hole */
+    int priority;   // SCHED_FIFO priority (1 - 99)
+    int cpu;        // core the audio thread is pinned to, -1 to leave it
+} RealtimeConfig;
+
+#define REALTIME_STATUS_DONE     (1 << 0) // the audio thread has ran its setup
+#define REALTIME_STATUS_FTZ_DAZ  (1 << 1)
+#define REALTIME_STATUS_FIFO     (1 << 2)
+#define REALTIME_STATUS_AFFINITY (1 << 3)
+
+/* Voice worker pool, opt in. The voices of each bus block are split into fixed partitions, one per
+worker plus one for the audio thread, each rendered into its own set of group buses. The partitions are
+summed in order so the output is the same whoever renders them. Partitions are claimed, the audio thread
+renders any a worker hasn't got to. Workers never touch the voices themselves, the audio thread copies the
+block into a slot and a worker renders its partition on the copy, which is taken back once it finishes. A
+partition a worker hasn't finished by VOICE_WORKERS_DEADLINE of the blocks share of the period is taken
+from it and rendered by the audio thread from the voices, whatever the worker ends up with is dropped.
+A slot stays out of use while a worker holds it, so with one slot per partition there is always a free one.
+An idle worker spins VOICE_WORKERS_SPINS pauses, enough to carry it across the blocks of a period, then sleeps
+on a futex the audio thread only wakes when a worker is asleep. In real-time mode workers only go SCHED_FIFO
+with the audio thread pinned, each pinned to a core other than its */
+#define VOICE_WORKERS_MAX 15
+#define VOICE_WORKERS_DEADLINE 0.5  // of the blocks share of the period budget
+#define VOICE_WORKERS_SPINS 4096
+
+typedef struct
+{
+    Voice* voice;
+    VoiceStretch* stretch;  // NULL unless the voice is tempo stretched
+    uint64_t tempo;         // TempoState step
+    float left;
+    float right;
+    uint8_t group;
+    uint8_t channelCount;
+    /* 6 byte hole */
+} VoiceJob;
+
+typedef enum
+{
+    VOICE_PARTITION_PENDING,
+    VOICE_PARTITION_DONE,   // finished by the worker that claimed it, the result is in the slot
+    VOICE_PARTITION_TAKEN   // taken back by the audio thread past the deadline
+} Voice_Partition_State;
+
+// A block as handed to the workers, written by the audio thread before the work is published
+typedef struct
+{
+    VoiceJob* jobs;         // pointing at voices and stretch below
+    Voice* voices;          // copied from the pool, the worker claiming a partition renders on its part
+    VoiceStretch* stretch;
+    float* buses;           // MIX_GROUP_COUNT buses per partition
+    uint32_t jobCount;
+    uint32_t count;
+    bool odd;
+    bool timed;             // stretched voices are timed this block
+    uint8_t groupsUsed[VOICE_WORKERS_MAX + 1];
+} VoiceBlockSlot;
+
+typedef struct
+{
+    struct VoiceWorkerPool* pool;
+    uint8_t index;
+} VoiceWorkerThread;
+
+typedef struct VoiceWorkerPool
+{
+    _Atomic uint64_t work;      // generation << 32 | slot << 16 | next partition to claim, published by the audio thread
+    uint8_t pad[56];            // keeping the claim word and the partition states on seperate cache lines
+    _Atomic uint64_t partitions[VOICE_WORKERS_MAX + 1]; // generation << 32 | Voice_Partition_State
+    _Atomic uint8_t holding[VOICE_WORKERS_MAX]; // slot + 1 a worker may be reading or rendering into, 0 for none
+    _Atomic uint32_t wake;      // futex word the idle workers sleep on, bumped to wake them
+    _Atomic uint32_t sleepers;  // workers asleep or on their way to it
+    _Atomic bool running;
+    uint8_t workerCount;
+    uint8_t partitionCount;     // workers + the audio thread
+    uint8_t slotCount;          // one per partition
+    uint8_t channelCount;
+    /* 3 byte hole */
+    uint32_t sampleRate;
+    uint32_t busSamples;
+    RealtimeConfig realtime;
+    VoiceBlockSlot slots[VOICE_WORKERS_MAX + 1];
+    // audio thread only, the partitions it renders itself
+    float* buses;               // MIX_GROUP_COUNT buses per partition
+    uint8_t groupsUsed[VOICE_WORKERS_MAX + 1];
+    _Atomic uint32_t taken;     // partitions taken back from a late worker, counted by the audio thread
+    VoiceWorkerThread threadArgs[VOICE_WORKERS_MAX];
+    pthread_t threads[VOICE_WORKERS_MAX];
+} VoiceWorkerPool;
+
+#define OFFLINE_PERIOD_FRAMES 512 // frames the offline render hands the callback at a time, cut short at script events
+
+/* Callback timing. The callback stamps its entry and exit with CLOCK_MONOTONIC, the duration is counted
+into a histogram of 8 buckets an octave (within 12.5%) and written to a ring of per callback records, the
+flight recorder. The main thread reads both without locking. A callback over FLIGHT_RECORDER_THRESHOLD
+of its period, or an xrun in miniaudio's log, has the main thread dump the ring to a file */
+#define CALLBACK_HISTOGRAM_SUB_BITS 3
+#define CALLBACK_HISTOGRAM_MIN_SHIFT 8     // everything under 256 ns shares the first bucket
+#define CALLBACK_HISTOGRAM_OCTAVES 24      // up to 4.3 s
+#define CALLBACK_HISTOGRAM_BUCKETS (1 + (CALLBACK_HISTOGRAM_OCTAVES << CALLBACK_HISTOGRAM_SUB_BITS))
+#define FLIGHT_RECORDER_RECORDS 1024       // a power of 2, ~12 s of 512 frame periods or ~3 s of 128 at 44.1k
+#define FLIGHT_RECORDER_THRESHOLD 0.9f     // of the period budget
+#define FLIGHT_RECORDER_COOLDOWN_NS 5000000000ull // dumps closer together than this are skipped
+#define FLIGHT_RECORDER_FILE "flight_recorder_%u.csv"
+
+#define CALLBACK_RECORD_OVERRUN (1 << 0)   // over the threshold
+#define CALLBACK_RECORD_XRUN    (1 << 1)   // miniaudio reported an xrun since the last callback
+
+typedef struct
+{
+    uint64_t start;     // CLOCK_MONOTONIC ns at entry
+    uint32_t duration;  // ns
+    uint32_t budget;    // ns of audio the period holds
+    uint16_t frames;
+    uint16_t voices;
+    uint8_t synths;
+    uint8_t midiClocks; // MIDI clocks sent this period
+    uint8_t events;     // voice commands applied this period
+    uint8_t flags;      // CALLBACK_RECORD flags
+} CallbackRecord;
+
+typedef struct
+{
+    _Atomic uint32_t histogram[CALLBACK_HISTOGRAM_BUCKETS]; // added to by the audio thread, taken by the report
+    _Atomic uint64_t maxDuration;
+    _Atomic uint32_t overruns;
+    _Atomic uint32_t budget;            // of the last period
+    _Atomic uint64_t recordCount;       // records written, the audio thread's only way of publishing them
+    CallbackRecord records[FLIGHT_RECORDER_RECORDS];
+    _Atomic uint32_t xruns;             // counted by the miniaudio log callback
+    _Atomic uint32_t xrunPending;       // set by the log callback, taken by the next callback
+    _Atomic uint64_t dumpRequest;       // record count when the dump was asked for, 0 when none
+    uint8_t midiClocks;                 // audio thread only, this period so far
+    uint8_t events;
+    /* 2 byte hole */
+    uint32_t dumpCount;                 // main thread only
+    uint64_t dumpAllowedAt;
+} CallbackTiming;
+
+typedef struct
+{
+    VoicePool voices;           // audio thread only
+    _Atomic uint32_t poolFaults; // Voice_Pool_Fault flags found by the audio thread, debug builds only
+    VoiceJob* voiceJobs;        // audio thread only, one per voice
     float bpm;
     Sample** samples;
     uint16_t sampleCount;
-    uint8_t activeCount;
     uint8_t beatCount;
+    /* 1 byte hole */
     uint32_t loopFrameLength; //4 beat timer for swapping samples or bring in queued samples
     uint32_t globalCursor;
-    bool newQueued;
+    uint32_t loopCount;
+    uint64_t transportFrame;    // output samples played since start, the time scheduled events are set against
+    TransportGrid beatGrid;
+    TransportGrid tickGrid;     // MIDI clock, MIDI_TICKS_PER_BAR per loop
+    TempoState tempo;           // audio thread only, bpm above stays the session bpm
+    _Atomic float tempoBpm;     // published by the audio thread each period
+    _Atomic uint64_t stretchNanoseconds; // tempo stretch cost since the last report, summed by the audio thread
+    _Atomic uint64_t stretchFrames;
+    _Atomic uint32_t stretchPeak;
+    uint32_t stretchBlock;      // audio thread only, bus blocks rendered, picks the ones stretched voices are timed on
+    CallbackTiming* timing;
+    _Atomic uint64_t transport; // packed TransportPosition, written by the audio thread only
+    ChannelFeed channels;       // written by the audio thread only, the commands read the voices from here
+    uint8_t displayedBeat;      // last beat printed by transport_display, main thread only
     uint8_t channelCount;
     uint8_t synthCount;
     uint8_t synthMax;
+    /* 1 byte hole */
+    uint32_t sampleRate;
     Synth** synth;
+    VoiceCommand* commandBatch;         // control thread only, commands waiting on the next publish
+    uint32_t commandBatchCount;
+    uint32_t mixVersion;
+    MixSnapshot* mixPool;
+    _Atomic(MixSnapshot*) mixPending;   // published by the control thread, taken by the audio thread
+    MixSnapshot* mixLive;               // audio thread only
+    MixRouting routing;                 // control thread only, copied into each snapshot
+    Voice_Steal_Policy stealPolicy;     // control thread only, copied into each snapshot
+    float* busScratch;                  // audio thread only, MIX_GROUP_COUNT buses of MIX_BUS_FRAMES frames
+    MasterLimiter limiter;              // audio thread only
+    VoiceWorkerPool* workers;           // NULL to render every voice on the audio thread
+    RealtimeConfig realtime;
+    _Atomic uint32_t realtimeStatus;    // REALTIME_STATUS flags, written by the audio thread
+    int realtimeFifoError;              // errno values from the audio thread setup, read once DONE is set
+    int realtimeAffinityError;
+    bool realtimeReported;              // main thread only
+    EventScheduler* scheduler;
+    _Atomic uint32_t commandsEarly;     // applied before their frame as the scheduler was full, counted by the audio thread
     MIDI_Controller* midiController;
     Arena* arena;
+    Arena* loadArenas[LOAD_THREADS_MAX]; // the samples, one arena per loading thread
+    uint8_t loadArenaCount;
+    SampleLoader* loader;               // NULL unless the session loads lazily
 } SoundController;
 
 //Only vaild format is f32 thus far
 //MIDI controller can be nulled to not active
-SoundController* sound_controller_init(float bpm, const char* loadDirectory, uint8_t beatsPerBar, uint8_t barsPerLoop, uint16_t sampleRate, uint8_t channelCount, ma_format format, uint8_t synthMax, MIDI_Controller* midiController);
+//lazyLoad only indexes the samples, each is loaded in the background the first time it's asked for
+//storage is the Sample_Format samples are kept in, SAMPLE_FORMAT_F32 unless memory is short
+SoundController* sound_controller_init(float bpm, const char* loadDirectory, uint8_t beatsPerBar, uint8_t barsPerLoop, uint16_t sampleRate, uint8_t channelCount, ma_format format, uint8_t synthMax, uint16_t voiceMax, MIDI_Controller* midiController, bool lazyLoad, Sample_Format storage);
 void data_callback_f32(ma_device* pDevice, void* pOutput, const void* pInput, ma_uint32 frameCount);
 void sound_controller_destroy(SoundController* sc);
 void process_midi_commands(SoundController* sc);
-//ran each loop to check status of one shot launched samples and reset their settings
-void one_shot_check(SoundController* sc);
+//add a change to the voice table to the current batch, sent to the audio thread on the next mix_publish
+bool voice_command_push(SoundController* sc, VoiceCommand command);
+//publish the batched commands and the synth list as one snapshot, picked up at the start of the next period
+void mix_publish(SoundController* sc);
 //generate for all attached synths
 void controller_synth_generate_audio(SoundController* sc);
+//lock-free read of the last position published by the audio callback
+void transport_position_read(SoundController* sc, TransportPosition* position);
+//ran each loop to print the beat display, only prints when the beat has changed
+void transport_display(SoundController* sc);
+//spawns the voice workers, call before starting the device. Stopped by sound_controller_destroy
+bool voice_workers_start(SoundController* sc, uint8_t workerCount);
+//call before starting the device, the audio thread finishes the setup on its first callback
+void realtime_setup(SoundController* sc, RealtimeConfig config);
+//ran each loop, prints how the audio thread setup went once it has ran
+void realtime_report(SoundController* sc);
+//ran each loop, dumps the flight recorder when the callback has overrun or miniaudio has reported an xrun
+void callback_timing_report(SoundController* sc);
+//ran each loop, warns when disk streaming has fallen behind or run out of rings
+void stream_report(SoundController* sc);
+//ran each loop, warns when the audio thread has had to take partitions back from late voice workers
+void voice_workers_report(SoundController* sc);
+//ran each loop, warns when quantized commands have been applied early as the event scheduler was full
+void event_scheduler_report(SoundController* sc);
+//starts loading a lazily loaded sample in the background, nothing for one that's loaded or on its way
+void sample_request(SoundController* sc, uint16_t index);
+//requests every sample a file names, a name or a sample number a line. False if the file can't be read
+bool sample_preload_list(SoundController* sc, const char* path);
+//ran each loop, prints each lazily loaded sample as it finishes loading
+void sample_load_report(SoundController* sc);
+//has miniaudio's xrun messages counted and dumped, pass ma_context_get_log of the context the device is made on
+void callback_xrun_log_attach(SoundController* sc, ma_log* log);
+//renders the session headless into a f32 WAV as fast as it can, driven by a script of "<seconds> <command>" lines
+//seconds of 0 or less renders a loop past the last command. Call in place of starting the device
+bool offline_render(SoundController* sc, const char* scriptPath, const char* outputPath, double seconds);
 
 
 /* Synth */
@@ -113,6 +874,7 @@ typedef enum
 } Synth_FLAGS;
 
 #define SYNTH_BUFFER_BEING_READ (1 << 0)
+#define SYNTH_BUFFER_WRAPPED    (1 << 1) // set by the audio thread, warning printed on the main thread
 typedef enum
 {
     SYNTH_TYPE_BASIC_SINEWAVE
@@ -181,8 +943,6 @@ float bpm_to_hz(float bpm);
 #define MAX_KEY_POLL 7
 #define MAX_COMMAND_LENGTH 63
 
-#define MAX_SLIDERS 8
-
 typedef struct
 {
     bool heldKeys[256];
@@ -192,23 +952,13 @@ typedef struct
     char command[MAX_COMMAND_LENGTH];
     uint8_t commandIndex;
     int inputFile;
-    uint8_t sliderCount;
-    /* 3 byte hole */
-    struct
-    {
-        uint8_t channel;
-        bool active;
-        uint16_t index;
-        float targetVolume;
-        uint16_t framesLeft;
-    } slider[MAX_SLIDERS];
+    Quantize launchQuantize; // used by launches and one shots without a q suffix, set with the q command
 } InputController;
 
 // passing in the pointer to allow stac allocation
 int input_controller_init(InputController* ic, uint32_t inputDeviceIndex);
 void input_controller_destroy(InputController* ic);
 
-// the three fuctions called in main loop
+// the two fuctions called in main loop
 void poll_keyboard(InputController* ic);
 int input_process(InputController* ic, SoundController* s);
-void slider_update(InputController* ic, SoundController* sc);